@@ -1,6 +1,6 @@
 /****
  *
- *   Part of the "Escapement" library for Arduino. Version 0.87
+ *   Part of the "Escapement" library for Arduino. Version 0.88
  *
  *   Escapement.cpp Copyright 2014-2016 by D. L. Ehnebuske 
  *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
@@ -34,7 +34,7 @@
  *
  *   The pendulum or bendulum the Escapement object drives is subject to the same sorts of temperature effects. To
  *   compensate for them, the Escapement object implements optional temperature compensation using the SparkFun TMP102
- *   temperature sensor.
+ *   temperature sensor or any other EscapementSensor (see EscapementSensor.h and setTempSensor()).
  *
  *   O P E R A T I O N
  *   =================
@@ -74,36 +74,153 @@
  *   switches to RUN mode. In MODEL mode, beat() returns the duration measured using the (corrected) Arduino 
  *   real-time clock.
  *
- *   RUN mode is used for normal operation. During RUN mode, beat() returns the beat length as calculated by the 
- *   linear least squares model defined during MODEL mode or, if the temperature is outside the model's range, the 
- *   value measured using the (corrected) Arduino real-time clock. If RUN mode detects that no model has been 
- *   calculated, it switches to MODEL mode. If it detects that the temperature is one for which we have not completed 
- *   data collection, it switches to COLLECT mode.
- *
- *   COLLECT mode collects information about the duration of TGT_SAMPLES beats for each of TEMP_STEPS half-degree C 
- *   "buckets" of temperature. Buckets are indexed by the variable tempIx. The 0th bucket is centered on TEMP_MIN. 
- *   This bucket, like all the buckets, runs for a half degree C. The highest temperature bucket is centered at 
- *   TEMP_MIN + (TEMP_STEPS - 1) / 2. Calibration information is not collected for temperatures outside this range. 
- *   If temperature sensing is not available, temperature compensation cannot be done so the temperature is assumed 
- *   to always be TEMP_MIN.
- *
- *   For each bucket there are two pieces of information, eeprom.uspb[] and eeprom.sampleCount[]. The first, 
- *   eeprom.uspb[] is the average beat duration (in microseconds) at the temperature of that bucket. The second, 
- *   eeprom.sampleCount[], is the number of samples that went into the average so far. A sample is collected if the 
- *   temperature is within 1/8 degree C of the center-temperature of the bucket when the beat takes place. Data 
- *   collection for a bucket consists of collecting TGT_SAMPLES samples for that bucket.
+ *   The model can be a straight line (MODEL_LINEAR), a parabola (MODEL_QUADRATIC), both least-squares fits, or 
+ *   straight lines from each completed bucket to the next (MODEL_PIECEWISE), for a pendulum or bendulum whose 
+ *   rate isn't linear in temperature. setModelOrder() picks one. By default (MODEL_AUTO), MODEL tries each 
+ *   completed bucket that has completed buckets on both sides, predicting it from all the others with each order, 
+ *   and uses the order whose predictions are best; with too few completed buckets for that, the line. Whatever 
+ *   the order, MODEL works out the model's beat duration at every bucket's temperature, modelKnots[], and RUN 
+ *   interpolates between them, so a beat costs the same whichever is used. The straight line, slope and 
+ *   yIntercept, is kept as well; it's what getM(), getB() and the recorder get. 
+ *
+ *   RUN mode is used for normal operation. During RUN mode, beat() returns the beat length as calculated by the model 
+ *   defined during MODEL mode or, if the temperature is outside the model's range, the value measured using the 
+ *   (corrected) Arduino real-time clock. If RUN mode detects that no model has been calculated, it switches to MODEL 
+ *   mode. If it detects that the temperature is one for which we have not completed data collection, it switches to 
+ *   COLLECT mode.
+ *
+ *   COLLECT mode collects information about the duration of TGT_SAMPLES beats for each of eeprom.tempSteps 
+ *   "buckets" of temperature, eeprom.tempRes of them to a degree C. Buckets are indexed by the variable tempIx. The 
+ *   0th bucket is centered on eeprom.tempMin. The highest temperature bucket is centered at eeprom.tempMin + 
+ *   (eeprom.tempSteps - 1) / eeprom.tempRes. Calibration information is not collected for temperatures outside this 
+ *   range. By default the range is TEMP_STEPS half-degree buckets from TEMP_MIN, 18 - 26.5 C. setTempRange() sets 
+ *   another before enable() -- say, 5 - 30 C a degree at a time for an unheated workshop -- of up to TEMP_STEPS_MAX 
+ *   buckets. The range is kept with the persistent parameters. If enable() finds it has changed, the buckets of the 
+ *   old range whose temperatures are in the new one keep their calibration information and the rest start empty; 
+ *   a cold start goes to setTempRange()'s range or the default. If temperature sensing is not available, 
+ *   temperature compensation cannot be done so the temperature is assumed to always be that of the 0th bucket.
+ *
+ *   For each bucket there are two pieces of information, the average beat duration (in microseconds) at the 
+ *   temperature of that bucket and eeprom.sampleCount[], the number of samples that went into the average so far. A 
+ *   sample is collected if the temperature is within a quarter of a bucket's width (1/8 degree C for half-degree 
+ *   buckets) of the center-temperature of the bucket when the beat takes place. Data collection for a bucket 
+ *   consists of collecting TGT_SAMPLES samples for that bucket. Each bucket's running average carries the remainder 
+ *   of its division from one sample to the next (in uspbRem[], in RAM), so it's the exact mean, not one that stops 
+ *   moving once the count passes the spread between ticks and tocks; a restart drops the remainders, which costs 
+ *   under a μs. 
+ *
+ *   Since all the buckets' average beat durations are within a few hundred microseconds of one another, they are 
+ *   kept in a compact form: a single base duration, eeprom.uspbBase, plus a signed 16-bit offset from it for each 
+ *   bucket, eeprom.uspbOffset[]. getUspb() and setUspb() decode and encode them. If a new average won't fit, 
+ *   setUspb() rebases the table around the middle of the values it holds; only if the values span more than 
+ *   CAL_OFFSET_MAX - CAL_OFFSET_MIN μs does an offset saturate. The sample counters saturate at CAL_COUNT_MAX. 
+ *   EEPROM written in the older, uncompressed settingsV1_t form, without the thermal lag (settingsV2_t), without 
+ *   the rate-of-change term (settingsV3_t), with the fixed, default temperature range (settingsV4_t) or as a single 
+ *   copy without a CRC (settingsV5_t) is converted when it's read.
  *
  *   If, during collection, the temperature changes enough to fall into a different bucket before TGT_SAMPLES 
  *   samples are collected, the progress made in collecting samples for the old temperature bucket is maintained in 
- *   eeprom.uspb[] and eeprom.sampleCount[], and collecting at the new temperature bucket is started or resumed. 
+ *   the calibration table, and collecting at the new temperature bucket is started or resumed. 
  *   When TGT_SAMPLES samples have been taken for a bucket, the Escapement object stores the contents of the eeprom 
  *   structure -- Escapement's persistent parameters -- in the Arduino's EEPROM and switches to MODEL mode. During 
  *   COLLECT mode, beat() returns the duration measured using the (corrected) Arduino real-time clock.
  *
+ *   Since collecting TGT_SAMPLES samples for a bucket takes hours, COLLECT mode also checkpoints the partial progress 
+ *   it has made every CHECKPOINT_BEATS beats (see setCheckpointInterval() to change how often). A checkpoint writes 
+ *   only the header and the buckets that have changed since they were last written, and the EEPROM store skips 
+ *   bytes that already hold the right value, so it causes very little EEPROM wear. 
+ *   That way a reset or a power interruption loses at most one checkpoint interval's worth of calibration progress.
+ *   The store holds two copies of the persistent parameters, each with a sequence number and a CRC, and every 
+ *   write -- whole or checkpoint -- goes to the one that isn't the latest good one, so a write cut short by a reset 
+ *   leaves the latest intact; at enable() the good copy with the later sequence number is the one used. Sample 
+ *   counts that can't be right (less than 1) are made harmless when read. 
+ *
+ *   Where the persistent parameters are kept is up to the EscapementStore given to setStore() before enable() is 
+ *   called. By default it's the Arduino's internal EEPROM, starting at address 0 (an EEPROMStore). An I2C FRAM chip 
+ *   (FRAMStore) is another option. Since FRAM doesn't wear out, setStore() arranges for a "wear free" store to be 
+ *   checkpointed every beat. In host builds, a FileStore keeps them in a file. See EscapementStore.h.
+ *
+ *   The Escapement doesn't touch the hardware directly. Everything it needs -- the ADC, the microsecond timebase, 
+ *   GPIO, I2C and the default store -- it gets through an EscapementHAL, so the state machine and its timing math 
+ *   can be built and run under g++ on a Linux host as well as on an Arduino. The Escapement(sensePin, kickPin) 
+ *   constructor uses the platform's default HAL (ArduinoHAL or HostHAL); Escapement(hal, sensePin, kickPin) runs on 
+ *   whatever hardware, real or simulated, hal describes. See EscapementHAL.h.
+ *
+ *   Because everything the Escapement does follows from a few inputs -- the real-time clock time at which each beat 
+ *   is detected, the temperature readings, and what the sketch asks of it -- a run can be recorded and replayed. 
+ *   Given an EscapementRecorder via setRecorder(), the Escapement reports those inputs along with what it made of 
+ *   them. extras/replay has a host tool that feeds a recording back through beat() and compares. See 
+ *   EscapementRecorder.h.
+ *
+ *   For tuning the magnet detection, setWaveCapture() has beat() keep the raw coil readings it takes while waiting 
+ *   for the magnet, in a ring buffer, and report the last of them -- the pulse the magnet induced -- to the recorder 
+ *   after each kick. extras/replay/detect.cpp runs captured pulses through the detector and variants of it.
+ *
+ *   The temperature is read during the SETTLE_TIME delay at the start of beat(), in the background if the HAL can 
+ *   do that (see EscapementHAL.h), and picked up once the kick is done. If the HAL can't, the time the read takes 
+ *   comes out of the delay. The delay calls the sensor's busy() as it goes, so a sensor read in parts (a 
+ *   FusedSensor) starts each part as the last one finishes and is done long before the delay is. A read that 
+ *   still isn't done after the kick -- only if the bus is timing out -- is finished there, so no transfer is left 
+ *   going when beat() returns for the sketch's own I2C use (or FRAMStore's) to run into. Normally, then, the I2C 
+ *   bus isn't on the path from the kick to beat()'s return. 
+ *
+ *   Since the temperature changes over minutes, not beats, it's only sampled every TEMP_INTERVAL seconds (see 
+ *   setTempInterval(); requestTemp() asks for a sample right away). Between samples the sensor is shut down, if 
+ *   it can be, which keeps it from warming itself and reading high, and each sample is a one-shot conversion 
+ *   started at least the sensor's conversion time ahead. In between, the temperature follows the trend of the last 
+ *   two samples, so it moves smoothly through the calibration buckets rather than in steps. 
+ *
+ *   A failed temperature reading doesn't end temperature compensation. The reading is retried, and the last good 
+ *   temperature is held, for up to TEMP_HOLD seconds (see setTempHold()). Only if readings fail for longer than 
+ *   that does the temperature become unknown, so that beats are timed by the (corrected) real-time clock; the 
+ *   sensor is still retried every so often, and compensation resumes as soon as it answers. Whether the 
+ *   Escapement is temperature compensated at all is decided by whether the sensor answered at enable() time. 
+ *
+ *   The pendulum doesn't follow the air temperature the sensor measures right away: a rod's thermal mass makes it 
+ *   lag by minutes to hours, which shows up as hysteresis, different beat durations at the same reading depending 
+ *   on whether it's warming or cooling. So the buckets and the model go by rodTemp, the temperature put through a 
+ *   first-order lag filter with time constant eeprom.tempLag, rather than by the reading itself. The time constant 
+ *   is estimated from the measured beat durations in COLLECT and RUN: every LAG_BLOCK beats, the mean duration 
+ *   and mean temperature become a sample, the temperature is put through each of LAG_CANDIDATES candidate lags, 
+ *   and a running least-squares fit of duration against each result is kept. When a model is made, once there 
+ *   are LAG_MIN_BLOCKS samples over a big enough spread of temperatures, the lag whose fit leaves the least 
+ *   residual, refined by a parabola through its neighbors, becomes eeprom.tempLag. setTempLag() fixes it instead. 
+ *
+ *   What the lag filter doesn't account for -- a rod whose parts lag differently, say, or a case that warms 
+ *   unevenly -- still shows up as beat durations that depend on whether the temperature is rising or falling. 
+ *   So the model has a second term, eeprom.rateSlope times tempRate, the temperature's rate of change, smoothed 
+ *   with a time constant of RATE_TIME. The buckets can't give it, since each averages over warming and cooling 
+ *   alike, so it's fitted from the same samples as the thermal lag: a running least-squares fit of the samples' 
+ *   durations against both their rodTemp and their tempRate. Once there are RATE_MIN_BLOCKS samples with rates 
+ *   spread by at least RATE_MIN_SPREAD, and that often after that, the fit's rate coefficient becomes 
+ *   eeprom.rateSlope. Until then, or if the two can't be told apart, the model stays linear in rodTemp. A change 
+ *   in the thermal lag changes what rodTemp means, so it drops the term and starts its fit over. 
+ *
+ *   If beat() misses a pass of the magnet -- the detector didn't see it, or something held beat() up until it was 
+ *   too late -- the next detection comes a whole number of beats after the last. When the measured duration is 
+ *   within 1/GAP_TOLERANCE of a beat of 2 to MAX_GAP_BEATS times the average of the last tick and tock, beat() 
+ *   counts the missed passes and returns the time for all of the beats it spans: the measured time, or in RUN mode 
+ *   the model's beat duration times the number of beats. Such a gap doesn't go into calibration. Only a duration 
+ *   that isn't accounted for that way and is more than 5 seconds is rejected. 
+ *
+ *   Electrical noise can make beat() see a pass that isn't there. To keep such beats out of the calibration, each 
+ *   beat's measured duration is checked against an acceptance gate: the duration of the last beat of the same kind 
+ *   (tick or tock), plus or minus GATE_SIGMAS (see setGate()) times the standard deviation of the difference, 
+ *   which is tracked as the beats go by and assumed to be at least GATE_MIN_SIGMA. A beat outside the gate is 
+ *   counted as an outlier, beat() returns 0 for it, and the next beat is measured from the last good one, so no 
+ *   time is lost. (The model isn't used for the prediction since the tick/tock asymmetry would widen the gate.) 
+ *   If GATE_RESYNC beats in a row are outliers, the pendulum has presumably changed; the next one is accepted, 
+ *   without going into the calibration, and the gate starts over. 
+ *
+ *   To show where a beat's time goes in the field, the Escapement keeps a few cheap counters in a beatStats_t: ADC 
+ *   readings per beat, time spent waiting for the noise floor and looking for the magnet's pulse, beats rejected, 
+ *   EEPROM writes, failed store operations, failed temperature readings and mode changes. getStats() returns them; 
+ *   resetStats() zeroes them. 
+ *
  *   The net effect of the COLLECT and MODEL modes is that the Escapement object automatically characterizes the 
  *   bendulum or pendulum it is driving by determining the average duration of beats at half-degree intervals as it 
- *   encounters different temperatures. It uses this information to calcualte a linear least-squares model of beat 
- *   duration as a function of temperature. It uses the model to calculate beat duration during RUN mode.
+ *   encounters different temperatures. It uses this information to calcualte a model of beat duration as a function 
+ *   of temperature. It uses the model to calculate beat duration during RUN mode.
  *
  *   This would work nearly perfectly except that, as hinted at above, the real-time clock in most Arduinos is stable 
  *   but not too accurate (it's a ceramic resonator, not a crystal). That is, real-time clock ticks are essentially 
@@ -124,6 +241,9 @@
  ****/
 
 #include "Escapement.h"
+#include <stddef.h>     // For offsetof()
+#include <string.h>     // For memset() and memcpy()
+#include <math.h>       // For exp()
 
 // Class Escapement
 
@@ -135,8 +255,45 @@
 
 // Escapement on specified sense and kick pins
 Escapement::Escapement(byte sPin, byte kPin){
+	init(EscapementHAL::getDefault(), sPin, kPin);
+}
+
+// Escapement on specified hardware, sense and kick pins
+Escapement::Escapement(EscapementHAL *h, byte sPin, byte kPin){
+	init(h, sPin, kPin);
+}
+
+// Common part of the constructors
+void Escapement::init(EscapementHAL *h, byte sPin, byte kPin) {
+	hal = h;								// The hardware we run on
 	sensePin = sPin;						// Pin on which we sense the bendulum's passing
 	kickPin = kPin;							// Pin on which we kick the bendulum as it passes
+	checkpointBeats = CHECKPOINT_BEATS;		// Default checkpoint interval for partial COLLECT progress
+	checkpointMinutes = 0;
+	store = NULL;							// The hardware's store unless setStore() says otherwise (see enable())
+	enabled = false;						// The persistent parameters haven't been read yet
+	recorder = NULL;						// Nobody's recording
+	waveBuf = NULL;							// No waveform capture
+	topTime = 0;
+	gateSigmas = GATE_SIGMAS;				// Default acceptance gate
+	tempPending = false;					// No background temperature read under way
+	tempInterval = TEMP_INTERVAL;			// Default temperature sampling interval
+	temp = NO_TEMP;							// Not enabled yet
+	sensor = &tmp102;						// By default, the temperature comes from a TMP102
+	tempState = TEMP_IDLE;
+	tempOneShot = false;
+	tempPresent = false;
+	tempHold = TEMP_HOLD;					// Default time to hold the temperature through failed readings
+	rodTemp = NO_TEMP;
+	tempRate = 0;
+	modelChoice = MODEL_AUTO;				// Choose the model's order by how well it fits
+	modelOrder = MODEL_LINEAR;
+	rangeMin = TEMP_MIN;					// Default temperature range
+	rangeSteps = TEMP_STEPS;
+	rangeRes = TEMP_RES;
+	rangeSet = false;
+	lagSet = false;							// No thermal lag asked for
+	resetStats();
 }
 
 /*
@@ -145,39 +302,129 @@ Escapement::Escapement(byte sPin, byte kPin){
  *
  */
 
+// Report inputs and outputs to r (NULL to stop). To record a whole run, call before enable().
+void Escapement::setRecorder(EscapementRecorder *r) {
+	recorder = r;
+}
+
+// Capture the coil readings leading up to each detection in buf, which holds size readings, and report them to the 
+// recorder. size is rounded down to a multiple of N_SAMPLES so the oldest reading starts an averaging group. 
+// NULL turns capture off.
+void Escapement::setWaveCapture(uint16_t *buf, unsigned int size) {
+	waveSize = size - size % N_SAMPLES;
+	waveBuf = waveSize == 0 ? NULL : buf;
+}
+
+// Use s to keep the persistent parameters. Must be called before enable(). A store that doesn't wear out gets 
+// checkpointed every beat; otherwise checkpointing reverts to the default interval.
+void Escapement::setStore(EscapementStore *s) {
+	store = s;
+	checkpointBeats = s->isWearFree() ? 1 : CHECKPOINT_BEATS;
+	checkpointMinutes = 0;
+}
+
+// Calibrate for temperatures from minC to maxC degrees C in buckets 1/res degree C wide (res = 1, 2 or 4). Must be 
+// called before enable(), which changes the range kept with the persistent parameters to this one if it's 
+// different. Return false, changing nothing, if the range is empty or takes more than TEMP_STEPS_MAX buckets.
+boolean Escapement::setTempRange(int minC, int maxC, byte res) {
+	if ((res != 1 && res != 2 && res != 4) || minC > maxC || minC < -128 || maxC > 127 || 
+			(maxC - minC) * res + 1 > TEMP_STEPS_MAX) {
+		return false;
+	}
+	rangeMin = minC;
+	rangeSteps = (maxC - minC) * res + 1;
+	rangeRes = res;
+	rangeSet = true;
+	return true;
+}
+
 // Enable the Escapement -- do the initialization that needs to be done in setup()
 void Escapement::enable(byte initialMode) {
-	analogReference(EXTERNAL);				// We have an external reference, a 47k+47k voltage divider between
-											//   3.3V and ground
-	pinMode(sensePin, INPUT);				// Set sense pin to INPUT since we read from it
-	pinMode(kickPin, INPUT);				// Put the kick pin in INPUT (high impedance) mode so that the
+	hal->adcBegin();						// Set up the ADC's reference voltage
+	hal->pinMode(sensePin, INPUT);			// Set sense pin to INPUT since we read from it
+	hal->pinMode(kickPin, INPUT);			// Put the kick pin in INPUT (high impedance) mode so that the
 											//   induced current doesn't flow to ground
-	Wire.begin();							// Prep to talk to the TMP102 temperature sensor
+	hal->i2cBegin();						// Prep to talk to the TMP102 temperature sensor (and maybe FRAM)
+	sensor->begin(hal);						// Get the temperature sensor ready
+	if (store == NULL) {					// If nobody called setStore(), use the hardware's store. (Not in the 
+		store = hal->store();				//   constructor: a global Escapement may be built before the HAL is.)
+	}
+	if (!store->begin()) {					// Get the persistent parameter store ready
+		stats.storeFailures++;				//   (If it isn't, reading it fails and the defaults are used)
+	}
+	enabled = true;							// From here on, changes to the persistent parameters are written
 	beatCounter = 1;						// Initialize beatCounter
-	temp = readTemp();						// Try reading the temp sensor
+	tempPending = false;					// No background temperature read under way
+	for (byte i = 0; i <= TEMP_RETRIES; i++) {
+		temp = readTemp();					// Try reading the temp sensor, giving it a few chances
+		if (temp != NO_TEMP) break;
+	}
+	tempPresent = temp != NO_TEMP;			// Whether we can compensate for temperature from now on
+	tempReading = tempPrev = temp;			// That's the first sample; there's no trend yet
+	tempTime = tempTryTime = hal->micros();
+	tempSpan = 0;
+	tempFails = 0;
+	tempExpired = false;
+	if (tempPresent) {						// If there's a sensor, set it up for the sampling interval
+		configureTemp();
+	}
 	slope = yIntercept = 0;					// There's no model yet
 	tick = true;							// Whether currently awaiting a tick or a tock
 	tickLength = tockLength = 0;			// Length of last tick and tock periods (μs)
+	gateVar = 0;							// Nothing learned for the acceptance gate yet
+	gateRejects = 0;
 	lastTime = 0;							// Real time clock time (μs) last time through beat()
 	deltaT = 0;								// Length of last beat (μs)
+	beatsSinceCheckpoint = 0;				// No COLLECT progress to checkpoint yet
+	msSinceCheckpoint = 0;
+	dirtyBuckets = 0;
+	memset(uspbRem, 0, sizeof(uspbRem));	// Averages read from the store carry no remainder
+	findSlot();								// Find the latest persistent parameters in the store, if any
 
 	if (initialMode != COLDSTART) {			// If forced cold start isn't requested
 		if (readEEPROM()) {					//   Try getting info from EEPROM. If that works
-			if ((temp != NO_TEMP) == eeprom.compensated) {
+			if (rangeSet) {					//      Change the temperature range if asked to
+				remapBuckets(rangeMin, rangeSteps, rangeRes);
+			}
+			if (recorder != NULL) {			//      Record what we're starting from
+				recorder->recordSettings(&eeprom, sizeof(eeprom));
+			}
+			if (tempPresent == eeprom.compensated) {
 											//      If temp compensation mode matches
-				setRunMode(WARMSTART);		//		  Start in WARMSTART mode
+				switchMode(WARMSTART);		//		  Start in WARMSTART mode
 			} else {
-				setRunMode(CALIBRATE);		//      Otherwise start in CALIBRATE mode
+				switchMode(CALIBRATE);		//      Otherwise start in CALIBRATE mode
 			}
 		} else {							//   Else (invalid data in EEPROM)
-			setRunMode(COLDSTART);			//     Cold start
+			switchMode(COLDSTART);			//     Cold start
 		}
 	} else {								//  Else (forced cold start)
-		setRunMode(COLDSTART);				//    Cold start
+		switchMode(COLDSTART);				//    Cold start
+	}
+	rodTemp = temp;							// Start the pendulum off at the air temperature
+	rodFilt = temp;
+	rateFilt = temp;						// And with the temperature steady
+	tempRate = 0;
+	if (lagSet) {							// Fix the thermal lag if asked to before now
+		fixLag(lagChoice);
 	}
-	tempIx = getTempIx(temp);				// Set up tempIx based on the temp
+	resetLag();								// Nothing to estimate the thermal lag from yet
+	tempIx = getTempIx(rodTemp);			// Set up tempIx based on the temp
+	record(REC_ENABLE, initialMode, rangeSet ? ((int32_t)rangeRes << 16) | ((int32_t)rangeSteps << 8) | 
+		(byte)rangeMin : 0);
 }
  
+// Read the coil voltage, capturing the reading if a waveform capture is on
+inline unsigned int Escapement::readCoil() {
+	unsigned int v = hal->adcRead(sensePin);
+	if (waveBuf != NULL) {
+		waveBuf[waveIx] = v;
+		if (++waveIx == waveSize) waveIx = 0;
+		waveReads++;
+	}
+	return v;
+}
+
 // Do one beat return length of a beat in μs
 long Escapement::beat(){
 	unsigned int currCoil = 0;					// The value read from coilPin. To get the value in volts, multiply by 
@@ -186,147 +433,242 @@ long Escapement::beat(){
 												//   is about 1.6 mV, más o menos. The exact value doesn't really matter 
 												//   since we're looking for a peak above noise.
 	unsigned int pastCoil = 0;					// The previous value of currCoil
+	uint16_t reads = 0;							// ADC readings taken this beat
+	uint32_t mark;								// Real-time clock time at the start of what's being timed (μs)
 	
+	ESCAPEMENT_PROBE(PROBE_BEAT_START);
+	mark = hal->micros();
+	if (tempPresent) {							// If temperature sensor is present
+		startTemp();							//   Sample it while we wait, if it's time
+	}
+	uint32_t spent = (hal->micros() - mark) / 1000;	// (If the HAL reads in the foreground, that's part of the wait)
+	while (tempPending && spent < SETTLE_TIME && sensor->busy()) {
+		hal->delay(1);							// Move a background read along while waiting: a sensor read in parts 
+		spent++;								//   starts each part as the last one finishes
+	}
 	// watch for passing magnet
-	delay(SETTLE_TIME);							// Wait for things to calm down
+	hal->delay(spent < SETTLE_TIME ? SETTLE_TIME - spent : 0);	// Wait for things to calm down
+	mark = hal->micros();
 	do {										// Wait for the voltage to fall below the noise floor
-		currCoil = analogRead(sensePin);
+		currCoil = hal->adcRead(sensePin);
+		reads++;
 	} while (currCoil > NOISE_SIZE);
 	currCoil /= NOISE_SIZE;
+	stats.noiseWaitLast = hal->micros() - mark;
+	if (waveBuf != NULL) {						// If capturing the waveform, start over
+		waveIx = 0;
+		waveReads = 0;
+		waveStart = hal->micros();
+	}
  	do {										// Wait for the magnet to pass over coil,
 		pastCoil = currCoil;					//   Indicated by the voltage induced in the coil beginning to fall
-		currCoil = analogRead(sensePin);
+		currCoil = readCoil();
 		for (int i = 1; i < N_SAMPLES; i++) {
-			currCoil += analogRead(sensePin);
+			currCoil += readCoil();
 		}
 		currCoil /= N_SAMPLES * NOISE_SIZE;
+		reads += N_SAMPLES;
 	} while (currCoil >= pastCoil);
+	ESCAPEMENT_PROBE(PROBE_DETECTED);
 	lastTime = topTime;
-	topTime = micros();							// Remember when magnet went by
+	topTime = hal->micros();					// Remember when magnet went by
+	mark += stats.noiseWaitLast;				// The search for the pulse began when the wait ended
+	stats.peakLast = topTime - mark;
+	stats.beats++;
+	stats.adcReads += reads;
+	stats.adcReadsLast = reads;
+	if (reads > stats.adcReadsMax) stats.adcReadsMax = reads;
+	stats.noiseWaitMs += (stats.noiseWaitLast + 500) / 1000;
+	if (stats.noiseWaitLast > stats.noiseWaitMax) stats.noiseWaitMax = stats.noiseWaitLast;
+	stats.peakMs += (stats.peakLast + 500) / 1000;
+	if (stats.peakLast > stats.peakMax) stats.peakMax = stats.peakLast;
 	
 	// Kick the magnet to keep it going
-	pinMode(kickPin, OUTPUT);					// Prepare kick pin for output
-	delay(DELAY_TIME);							// Wait desired time before pin turn-on
-	digitalWrite(kickPin, HIGH);				// Turn kick pin on
-	delay(KICK_TIME);							// Wait for duration of pulse
-	digitalWrite(kickPin, LOW);					// Turn it off
-	pinMode(kickPin, INPUT);					// Put kick pin in high impedance mode
+	hal->pinMode(kickPin, OUTPUT);				// Prepare kick pin for output
+	hal->delay(DELAY_TIME);						// Wait desired time before pin turn-on
+	hal->digitalWrite(kickPin, HIGH);			// Turn kick pin on
+	hal->delay(KICK_TIME);						// Wait for duration of pulse
+	hal->digitalWrite(kickPin, LOW);			// Turn it off
+	hal->pinMode(kickPin, INPUT);				// Put kick pin in high impedance mode
+	if (tempPending) {							// Finish the temperature read, so nothing is left on the bus when
+		while (sensor->busy());					//   beat() returns (it's done already unless the bus is timing out,
+	}											//   which the HAL limits)
+	if (waveBuf != NULL && recorder != NULL) {	// If capturing the waveform, report it now the kick is done
+		waveRecord_t w;
+		w.time = topTime;
+		w.span = topTime - waveStart;
+		w.reads = waveReads;
+		w.buf = waveBuf;
+		w.len = waveReads < waveSize ? waveReads : waveSize;
+		w.start = waveReads < waveSize ? 0 : waveIx;
+		recorder->recordWave(w);
+	}
+	ESCAPEMENT_PROBE(PROBE_PROCESS);
 
 	// Determine the length of time between beats in μs
 	if (lastTime == 0) {						// if first time through
 		lastTime = topTime;						//   Remember when we last saw the magnet go by
+		record(REC_BEAT, 0);
+		ESCAPEMENT_PROBE(PROBE_BEAT_END);
 		return 0;								//   Return 0 -- no interval between beats yet!
 	}
 	deltaT = topTime - lastTime;				// Assume microseconds per beat will be whatever we measured for this beat
 												// plus the (rounded) Arduino clock correction
-	deltaT += ((eeprom.bias * deltaT) + 432000L) / 864000L;
-	if (deltaT > 5000000) {						// If the measured beat is more than 5 seconds long
-		return deltaT = 0;						//   it can't be real -- just ignore it and return
+	deltaT = escBiasCorrect(deltaT, eeprom.bias);
+	byte span = beatsSpanned();
+	boolean resync = false;						// Whether the acceptance gate is starting over
+	if (span == 1 && deltaT > 5000000) {		// If the measured beat is more than 5 seconds long and not a gap
+		deltaT = 0;								//   it can't be real -- just ignore it and return
+		stats.rejected++;
+		record(REC_BEAT, 0);
+		ESCAPEMENT_PROBE(PROBE_BEAT_END);
+		return 0;
+	}
+	if (span == 1 && isOutlier()) {				// If the beat is outside the acceptance gate
+		if (++gateRejects < GATE_RESYNC) {		//   Unless that's happened too often, it wasn't a real pass
+			stats.outliers++;
+			deltaT = 0;
+			record(REC_BEAT, 0);
+			topTime = lastTime;					//     So time the next beat from the last real one
+			ESCAPEMENT_PROBE(PROBE_BEAT_END);
+			return 0;
+		}
+		stats.resyncs++;						//   Otherwise accept it, but start predicting over
+		tickLength = tockLength = 0;
+		gateVar = 0;
+		gateRejects = 0;
+		resync = true;							//   And keep it out of the calibration
+	}
+	if (tempPresent) {							// If temperature sensor is present
+		temp = updateTemp();					//   Update the temperature
+		rateTemp(deltaT);						//   And its rate of change
+		lagTemp(deltaT);						//   Work out the pendulum's from it
+		tempIx = getTempIx(rodTemp);			//   And figure out which "bucket" of temperatures it's in
+	}
+	if (span > 1 || resync || runMode == CALRTC || runMode == WARMSTART || temp == NO_TEMP || 
+			!eeprom.compensated) {
+		lagBeats = 0;							// Only a run of steady, measured beats makes a thermal lag sample
+		lagTime = topTime;
+	} else {
+		sampleLag();
+	}
+	if (span > 1 || resync) {					// If passes were missed (or the gate is starting over)
+		if (span > 1) {
+			stats.gaps++;						//   Count them
+			stats.missed += span - 1;
+			if (runMode == RUN && tempIx != NO_CAL && yIntercept != 0 && eeprom.sampleCount[tempIx] > TGT_SAMPLES) {
+				deltaT = span * modelUspb();
+			}									//   In RUN, the time is the model's for that many beats
+		}
+		if (span & 1) tick = !tick;				//   Keep tick and tock straight, and leave calibration alone
+		record(REC_BEAT, deltaT);
+		ESCAPEMENT_PROBE(PROBE_BEAT_END);
+		return deltaT;
 	}
 	if (tick) {									//   If tick
 		tickLength = deltaT;					//     Set tickLength to beat length
 	} else {									//   else (tock)
 		tockLength = deltaT;					//     Set tockLength to beat length
 	}
-	if (temp != NO_TEMP) {						// If temperature sensor is present
-		temp = readTemp();						//   Update the temperature
-		tempIx = getTempIx(temp);				//   And figure out which "bucket" of temperatures it's in
-	}
 
+	ESCAPEMENT_PROBE(PROBE_MODE | runMode);
 	switch (runMode) {
 		case COLDSTART:							// When cold starting
-			setRunMode(WARMSTART);				//   eeprom.* has already been set to default so switch to WARMSTART mode
+			switchMode(WARMSTART);				//   eeprom.* has already been set to default so switch to WARMSTART mode
 			break;
 		case WARMSTART:							// When warmstarting
 			if (++beatCounter > TGT_WARMUP) {	//   Let things tick along for TGT_WARMUP beats
-				setRunMode(MODEL);				//   then switch to MODEL
+				switchMode(MODEL);				//   then switch to MODEL
 			}
 			break;
 		case CALIBRATE:							// When starting a calibration,
-			setRunMode(WARMSTART);				//   Begin by warming up to be sure everything is settled
+			switchMode(WARMSTART);				//   Begin by warming up to be sure everything is settled
 			break;
 		case COLLECT:							// When doing calibration
 			if (tempIx == NO_CAL) break;		//   If outside temp range for which we do calibration, don't do it
 			if (eeprom.sampleCount[tempIx] > TGT_SAMPLES) {
 												//   If we already have all the data we need for this temp
-				setRunMode(RUN);				//     Switch to RUN mode
+				if (dirtyBuckets != 0) {		//     Checkpoint any partial progress made at other temps
+					checkpointEEPROM();
+				}
+				switchMode(RUN);				//     Switch to RUN mode
 				break;
 			}
 /****
  *
  *			Each of the tempIx buckets is the average beat duration at temperature t(tempIx) in degrees Celsius * 256
- *			where t(tempIx) = tempIx * 128 + TEMP_MIN * 256. If the current temperature corresponds to one of the buckets
- *			(i.e., it falls within 1/8 degree of one of the half-degree intervals), the running average is updated with 
- *			the current measured duration. If the current temperature falls somewhere else, nothing is done. If running
- *			uncompensated, temp is always TEMP_MIN * 256 and tempIx is always 0.
+ *			where t(tempIx) = tempIx * 256 / eeprom.tempRes + eeprom.tempMin * 256. If the current temperature 
+ *			corresponds to one of the buckets (i.e., it falls within a quarter of a bucket's width of one of them), 
+ *			the running average is updated with the current measured duration. If the current temperature falls 
+ *			somewhere else, nothing is done. If running uncompensated, temp is always eeprom.tempMin * 256 and tempIx 
+ *			is always 0. The temperature is rodTemp, the lagged one.
  *
  ****/
 
-			if(abs(temp - ((tempIx << 7) + (TEMP_MIN << 8))) <= 32) {
-												//   If current temp matches a tempIx bucket to within 1/8 degree C
-				eeprom.uspb[tempIx] += (deltaT - eeprom.uspb[tempIx]) / eeprom.sampleCount[tempIx];
-												//     Update running average
-				if (++eeprom.sampleCount[tempIx] > TGT_SAMPLES) {
+			if(abs(rodTemp - escBucketTemp(tempIx, eeprom.tempMin, eeprom.tempRes)) <= 
+					(1 << escTempShift(eeprom.tempRes)) / 4) {
+												//   If current temp matches a tempIx bucket to within 1/4 of a bucket
+				setUspb(tempIx,					//     Update running average
+					escRunningAverage(getUspb(tempIx), deltaT, eeprom.sampleCount[tempIx], &uspbRem[tempIx]));
+				dirtyBuckets |= 1UL << tempIx;	//     Note that the bucket needs writing
+				if (eeprom.sampleCount[tempIx] < CAL_COUNT_MAX) {
+					eeprom.sampleCount[tempIx]++;
+				}
+				if (eeprom.sampleCount[tempIx] > TGT_SAMPLES) {
 												//   If just reached a full smoothing interval
 					writeEEPROM();				//     Make calibration parms persistent
-					setRunMode(MODEL);			//     Switch to MODEL mode
+					switchMode(MODEL);			//     Switch to MODEL mode
+					break;
+				}
+			}
+			if (dirtyBuckets != 0) {			//   If there's partial progress that hasn't been saved
+				beatsSinceCheckpoint++;			//     Count the beat and the time toward the next checkpoint
+				msSinceCheckpoint += deltaT / 1000;
+				if ((checkpointBeats != 0 && beatsSinceCheckpoint >= checkpointBeats) ||
+					(checkpointMinutes != 0 && msSinceCheckpoint >= checkpointMinutes * 60000UL)) {
+					checkpointEEPROM();			//     And checkpoint it if it's time
 				}
 			}
 			break;
 		case MODEL:							// When finished calibrating
-			{
-				float xSum = 0.0;				//   Have a go at calculating the linear least squares for the data so far
-				float ySum = 0.0;
-				float xxSum = 0.0;
-				float xySum = 0.0;
-				int count = 0;
-				for (int i = 0; i < TEMP_STEPS; i++) {
-					if (eeprom.sampleCount[i] > TGT_SAMPLES) {
-						float x = (((TEMP_MIN << 1) + i) << 7);
-						float y = eeprom.uspb[i];
-						count++;
-						xSum += x;
-						ySum += y;
-						xxSum += x * x;
-						xySum += x * y;
-					}
-				}
-				if (count < 1) {				//   If not even one bucket is complete, continue collecting data
-					setRunMode(COLLECT);
-					break;
-				} else {						//   Otherwise calculate linear lsq model parameters
-					slope = count > 1 ? ((count * xySum - xSum * ySum) / (count * xxSum - xSum * xSum)) * 4096.0 : 0;
-					yIntercept = (ySum - (slope / 4096.0) * xSum) / count;
-					eeprom.speedAdj = 0;		//     and set the speed adjustment to 0 since it went with the old model (if any)
+												//   Have a go at calculating the linear least squares for the data so far
+			if (escFitLinear(eeprom.uspbBase, eeprom.uspbOffset, eeprom.sampleCount, eeprom.tempMin, eeprom.tempSteps, 
+					eeprom.tempRes, TGT_SAMPLES, &slope, &yIntercept) < 1) {
+				switchMode(COLLECT);			//   If not even one bucket is complete, continue collecting data
+				break;
+			}
+			makeModel();						//   Choose its order and precompute it for RUN
+			eeprom.speedAdj = 0;				//   Set the speed adjustment to 0 since it went with the old model (if any)
+			if (estimateLag() || estimateRate()) {
+				writeEEPROM();					//   If there's a better estimate of the thermal lag or the rate-of-change
+			}									//     term, keep it (a new lag leaves no rate fit to estimate from)
+			record(REC_MODEL, slope, yIntercept);
 #ifdef DEBUG
-					Serial.print("MODEL slope: ");
-					Serial.print(slope);
-					Serial.print(", yIntercept: ");
-					Serial.println(yIntercept);
+			Serial.print("MODEL slope: ");
+			Serial.print(slope);
+			Serial.print(", yIntercept: ");
+			Serial.println(yIntercept);
 #endif
-				}
-			}
-			setRunMode(RUN);					//  Switch to RUN mode
+			switchMode(RUN);					//  Switch to RUN mode
 			break;
 		case RUN:								// When running
 			if (tempIx == NO_CAL) break;		//   If outside temp range, use rtc measured value
 			if (yIntercept == 0) {				//   If the model hasn't been calculated
-				setRunMode(MODEL);				//     Use rtc measured value and build the model at the next beat
+				switchMode(MODEL);				//     Use rtc measured value and build the model at the next beat
 				break;
 			}
 			if (eeprom.sampleCount[tempIx] <= TGT_SAMPLES) {
-				setRunMode(COLLECT);			//   If not finished collecting data for this temp,
+				switchMode(COLLECT);			//   If not finished collecting data for this temp,
 				break;							//     use rtc measured value and switch to COLLECT
 			}
-			deltaT = slope * temp / 4096L + yIntercept;
-			deltaT += ((deltaT / 864L) * eeprom.speedAdj) / 1000L;
-												//     i.e., deltaT * eeprom.speedAdj / 864000 without large intermediate results
-												//     deltaT is what the model says it is + manual correction
+			deltaT = modelUspb();				//   deltaT is what the model says it is + manual correction
 			break;
 		case CALRTC:							// When calibrating the Arduino real-time clock
 			break;
 	}
 	tick = !tick;								// Switch whether a tick or a tock
+	record(REC_BEAT, deltaT);
+	ESCAPEMENT_PROBE(PROBE_BEAT_END);
 	return deltaT;								// Return calculated μs per beat
 }
 
@@ -338,21 +680,24 @@ long Escapement::beat(){
 
 // Return the current smoothing information for the current temp.
 int Escapement::getSmoothing() {
-	int ix = getTempIx(temp);
+	int ix = getTempIx(rodTemp);
 	return ix == NO_CAL ? 0 : eeprom.sampleCount[ix];
 }
  
-// Get, set or increment Arduino clock run rate correction in tenths of a second per day
+// Get, set or increment Arduino clock run rate correction in tenths of a second per day. Called before enable(), 
+// the change isn't persisted, and enable() replaces it with the persisted one (or 0 on a cold start).
 long Escapement::getBias(){
 	return eeprom.bias;
 }
 void Escapement::setBias(long factor){
 	eeprom.bias = factor;
 	writeEEPROM();								// Make it persistent
+	record(REC_BIAS, eeprom.bias);
 }
 long Escapement::incrBias(long factor){
 	eeprom.bias += factor;
 	writeEEPROM();								// Make it persistent
+	record(REC_BIAS, eeprom.bias);
 	return eeprom.bias;
 }
 
@@ -362,6 +707,13 @@ float Escapement::getTemp() {
 	return temp / 256.0;
 }
 
+// Get the pendulum's temperature -- the last temperature through the thermal lag filter -- in degrees C; ABS_ZERO 
+// if none
+float Escapement::getRodTemp() {
+	if (rodTemp == NO_TEMP) return ABS_ZERO;
+	return rodTemp / 256.0;
+}
+
 // Was the last beat a "tick" or a "tock"?
 boolean Escapement::isTick() {
 	return tick;
@@ -375,17 +727,15 @@ boolean Escapement::isTempComp() {
 // Get beats per minute as modeled. If no model or outside of temperature range return 0.0
 float Escapement::getBpmModel(){
 	if (yIntercept == 0 || tempIx == NO_CAL) return 0.0;
-	long dT = slope * temp / 4096L + yIntercept;
-	dT += eeprom.speedAdj / 864000L;
-	return 60000000.0 / dT;
+	return 60000000.0 / modelUspb();
 }
 
 // Get current beats per minute as measured by the (corrected) real-time clock
 float Escapement::getBpmRTC(){
-	unsigned long diff;
+	int32_t diff;
 	if (lastTime == 0) return 0;
 	diff = topTime - lastTime;
-	diff += ((eeprom.bias * diff) + 432000) / 864000;
+	diff = escBiasCorrect(diff, eeprom.bias);
 	return 60000000.0 / diff;
 }
 
@@ -408,17 +758,20 @@ long Escapement::getBeatDuration(){
 	if (lastTime == 0) return 0;
 	return topTime - lastTime;
 }
-// Get, set or increment the manual speed adjustment in tenths of a second per day
+// Get, set or increment the manual speed adjustment in tenths of a second per day. As with the bias, a change made 
+// before enable() doesn't last.
 long Escapement::getSpeedAdj() {
 	return eeprom.speedAdj;
 }
 void Escapement::setSpeedAdj(long speedAdj) {
 	eeprom.speedAdj = speedAdj;
 	writeEEPROM();								// Make it persistent
+	record(REC_SPEED, eeprom.speedAdj);
 }
 long Escapement::incrSpeedAdj(long incr) {
 	eeprom.speedAdj += incr;	
 	writeEEPROM();								// Make it persistent
+	record(REC_SPEED, eeprom.speedAdj);
 	return eeprom.speedAdj;						// Return new value
 }
 float Escapement::getM() {
@@ -428,29 +781,130 @@ long Escapement::getB() {
 	return yIntercept;
 }
 
+// Set the order of the model to MODEL_LINEAR, MODEL_QUADRATIC or MODEL_PIECEWISE, or to MODEL_AUTO to have MODEL 
+// choose it. If there's a model already, it's redone.
+void Escapement::setModelOrder(byte order) {
+	modelChoice = order > MODEL_AUTO ? MODEL_AUTO : order;
+	if (yIntercept != 0) makeModel();
+}
+byte Escapement::getModelOrder() {
+	return modelOrder;
+}
+
+float Escapement::getRateM() {
+	return eeprom.rateSlope / 4096.0 * 256.0;
+}
+float Escapement::getTempRate() {
+	return tempRate / 256.0;
+}
+
+// Set how often partial COLLECT progress is checkpointed to EEPROM: every beats COLLECT beats or every minutes 
+// minutes, whichever comes first. A value of 0 means no limit of that kind; both 0 turns checkpointing off.
+void Escapement::setCheckpointInterval(unsigned int beats, unsigned int minutes) {
+	checkpointBeats = beats;
+	checkpointMinutes = minutes;
+}
+
+// Set the acceptance gate's width to sigmas standard deviations; 0 turns it off
+void Escapement::setGate(byte sigmas) {
+	gateSigmas = sigmas;
+}
+
+// Read the temperature from s rather than the TMP102. Must be called before enable().
+void Escapement::setTempSensor(EscapementSensor *s) {
+	sensor = s;
+}
+
+// Set the time between temperature samples to seconds (at most TEMP_INTERVAL_MAX); 0 samples every beat
+void Escapement::setTempInterval(unsigned int seconds) {
+	tempInterval = seconds > TEMP_INTERVAL_MAX ? TEMP_INTERVAL_MAX : seconds;
+	if (tempPresent) {							// If already enabled with a sensor, set it up for the new interval
+		configureTemp();
+	}
+}
+
+// Take a temperature sample as soon as possible rather than waiting for the interval to be up
+void Escapement::requestTemp() {
+	if (tempState == TEMP_IDLE) {
+		tempState = tempOneShot ? TEMP_TRIGGER : TEMP_READ;
+	}
+}
+
+// Set how long, in seconds (at most TEMP_INTERVAL_MAX), the last good temperature is held while readings fail. 
+// After that the temperature is unknown, and compensation stops until readings come back.
+void Escapement::setTempHold(unsigned int seconds) {
+	tempHold = seconds > TEMP_INTERVAL_MAX ? TEMP_INTERVAL_MAX : seconds;
+}
+
+// Set the thermal lag time constant to seconds and stop estimating it; TEMP_LAG_AUTO goes back to estimating it, 
+// starting from the current value. 0 means the pendulum follows the temperature readings right away. It isn't 
+// written to the store right away (which would take two writes a call): it's kept with the persistent parameters 
+// the next time they're written or checkpointed. Called before enable(), it's applied to the ones enable() reads.
+void Escapement::setTempLag(unsigned int seconds) {
+	if (!enabled) {								// If the persistent parameters haven't been read yet
+		lagChoice = seconds;					//   Leave it to enable()
+		lagSet = true;
+		return;
+	}
+	fixLag(seconds);
+}
+unsigned int Escapement::getTempLag() {
+	return eeprom.tempLag;
+}
+
+// Get the calibration temperature range: the lowest and highest buckets' temperatures and the buckets to a degree
+int Escapement::getTempMin() {
+	return eeprom.tempMin;
+}
+float Escapement::getTempMax() {
+	return eeprom.tempMin + (eeprom.tempSteps - 1) / (float)eeprom.tempRes;
+}
+byte Escapement::getTempRes() {
+	return eeprom.tempRes;
+}
+
+// Get or zero the hot-path counters
+const beatStats_t &Escapement::getStats() {
+	return stats;
+}
+void Escapement::resetStats() {
+	memset(&stats, 0, sizeof(stats));
+}
+
 // Get/set the current run mode -- COLDSTART, WARMSTART, COLLECT, RUN or CALRTC
 byte Escapement::getRunMode(){
 	return runMode;
 }
 void Escapement::setRunMode(byte mode){
+	switchMode(mode);
+	record(REC_MODE);								// Mode changes beat() makes itself aren't recorded; replay redoes them
+}
+
+// Switch to run mode mode, doing whatever setting up the new mode needs
+void Escapement::switchMode(byte mode){
+	if (mode != runMode) stats.transitions++;
 	switch (mode) {
 		case COLDSTART:								//   Switch to cold starting mode
 			eeprom.id = 0;							//     Say eeprom not written,
 			eeprom.bias = 0;						//     rtc correction (tenths of a second per day) is zero
-			eeprom.compensated = temp != NO_TEMP;	//     and use whether we could read the temp to set compensated
-			break;
-		case WARMSTART:								//   Switch to warm starting mode
-			beatCounter = 1;						//     Reset the beat counter
-			break;
+			eeprom.tempLag = 0;						//     the pendulum is assumed to have no thermal lag
+			eeprom.lagFixed = false;
+			eeprom.tempMin = rangeMin;				//     the temperature range is setTempRange()'s or the default
+			eeprom.tempSteps = rangeSteps;
+			eeprom.tempRes = rangeRes;
+												//     and, as with CALIBRATE, the calibration info is reset
+			// fall through
 		case CALIBRATE:								//   Switch to starting a new calibration run
-			eeprom.compensated = temp != NO_TEMP;	//     Choose the calibration model: temp compensated or not
+			eeprom.compensated = tempPresent;		//     Choose the calibration model: temp compensated or not
 			eeprom.speedAdj = 0;					//     Default the clock speed adjustment
-			for (int i = 0; i < TEMP_STEPS; i++) {
-				eeprom.uspb[i] = 0;					//     Wipe out old calibration info, if any
-				eeprom.sampleCount[i] = 1;
-			}
+			eeprom.rateSlope = 0;					//     Start over without a rate-of-change term
+			clearTable();							//     Wipe out old calibration info, if any (the first checkpoint
+													//       has to overwrite all of it)
 			slope = yIntercept = 0;					//     Do away with the old linear least squares model, too
 			break;
+		case WARMSTART:								//   Switch to warm starting mode
+			beatCounter = 1;						//     Reset the beat counter
+			break;
 		case COLLECT:								//   Switch to data collection mode
 			break;
 		case MODEL:									//   Switch to model creation mode
@@ -465,27 +919,363 @@ void Escapement::setRunMode(byte mode){
 
 /*
  *
- * Private method to read the current temperature
+ * Private methods to read the current temperature
  *
  */
-int Escapement::readTemp() { 
- 	if (Wire.requestFrom(ADDRESS_TMP102,2) == 2) {
-		if (Wire.available() == 2) {
-												// Get the temp (in C * 256) from the TMP102. The first read returns
-												//   the most significant byte the second returns the least
-												//   significant byte. The binary point is between them.
-			return ((((byte)Wire.read()) << 8) | (byte)Wire.read());
-#ifdef DEBUG
+// Get a fresh temperature reading, waiting for it: have the sensor convert (if it converts on demand), give it 
+// time to, and read it
+int16_t Escapement::readTemp() { 
+	ESCAPEMENT_PROBE(PROBE_TEMP_START);
+	if (sensor->trigger()) {
+		hal->delay(sensor->getInfo().conversionMs);
+	}
+	int16_t t = sensor->read();
+	ESCAPEMENT_PROBE(PROBE_TEMP_END);
+	if (t == NO_TEMP) stats.i2cFailures++;
+	return t;
+}
+
+// Set the sensor up to suit tempInterval: sampling at an interval, it converts only when startTemp() triggers it, 
+// a beat or more before the reading is taken, if it can. Otherwise it's simply read when a sample is due.
+void Escapement::configureTemp() {
+	tempOneShot = sensor->setOneShot(tempInterval != 0);
+	tempState = tempOneShot ? TEMP_TRIGGER : TEMP_READ;
+	tempSpan = 0;								// Take a fresh sample, and start the trend over
+}
+
+// At the start of a beat, do whatever sampling the temperature calls for: trigger a one-shot conversion, or, once 
+// the sensor has had the time it needs to convert, start reading it in the background unless a read is already 
+// under way
+void Escapement::startTemp() {
+	if (tempState == TEMP_CONFIGURE) {			// Readings keep failing: maybe the sensor was reset
+		configureTemp();
+		return;
+	}
+	if (tempState == TEMP_TRIGGER) {
+		ESCAPEMENT_PROBE(PROBE_TEMP_START);
+		if (!sensor->trigger()) stats.i2cFailures++;
+		ESCAPEMENT_PROBE(PROBE_TEMP_END);
+		tempTriggerTime = hal->micros();
+		tempState = TEMP_READ;					// Read it next beat, or once it's had time to convert
+		return;
+	}
+	if (tempState != TEMP_READ || tempPending) return;
+	if (tempOneShot && hal->micros() - tempTriggerTime < sensor->getInfo().conversionMs * 1000UL) return;
+	ESCAPEMENT_PROBE(PROBE_TEMP_START);
+	tempPending = sensor->startRead();
+	ESCAPEMENT_PROBE(PROBE_TEMP_END);
+}
+
+// Pick up the reading startTemp() started (beat() has finished it), and note whether the next sample is due. 
+// Return the temperature: the last reading if sampling every beat (or there's no trend yet), otherwise the last 
+// reading carried forward along the line through it and the one before, for at most the time between them. 
+//
+// A failed reading is retried at the next beat, up to TEMP_RETRIES times, and then every TEMP_BACKOFF seconds (or 
+// the sampling interval, if that's longer), setting the sensor up again first. Meanwhile the last good reading is 
+// held. Once readings have been failing for tempHold seconds, the temperature is NO_TEMP until one succeeds.
+int16_t Escapement::updateTemp() {
+	if (tempPending) {							// beat() has seen the read finish
+		tempPending = false;
+		int16_t t = sensor->collect();
+		stats.tempReads++;
+		tempTryTime = topTime;
+		if (t == NO_TEMP) {
+			stats.i2cFailures++;
+			if (tempFails == 0) tempFailTime = topTime;
+			if (tempFails < 0xff) tempFails++;
+			tempState = tempFails > TEMP_RETRIES ? TEMP_IDLE : tempOneShot ? TEMP_TRIGGER : TEMP_READ;
 		} else {
-			Serial.println("Wire.available failed");
-#endif
+			if (temp == NO_TEMP) stats.tempRecovered++;
+			uint32_t ms = (topTime - tempTime) / 1000;
+			tempSpan = tempInterval == 0 || tempFails != 0 || ms > TEMP_INTERVAL_MAX * 1100UL || 
+				abs(t - tempReading) > TEMP_TREND_MAX ? 0 : ms;
+			tempFails = 0;
+			tempExpired = false;
+			tempPrev = tempReading;
+			tempReading = t;
+			tempTime = topTime;
+			tempState = tempInterval != 0 ? TEMP_IDLE : tempOneShot ? TEMP_TRIGGER : TEMP_READ;
 		}
-#ifdef DEBUG
-	} else {
-		Serial.println("Wire.requestFrom failed.");
-#endif
 	}
-	return NO_TEMP;
+	if (tempState == TEMP_IDLE) {
+		uint32_t wait = tempFails > TEMP_RETRIES && tempInterval < TEMP_BACKOFF ? TEMP_BACKOFF : tempInterval;
+		if (topTime - tempTryTime >= wait * 1000000UL) {
+			tempState = tempFails > TEMP_RETRIES ? TEMP_CONFIGURE : tempOneShot ? TEMP_TRIGGER : TEMP_READ;
+		}
+	}
+	if (tempFails != 0) {						// Readings are failing: hold the last good one, for a while
+		if (!tempExpired && topTime - tempFailTime < tempHold * 1000000UL) return tempReading;
+		if (temp != NO_TEMP) stats.tempLost++;
+		tempExpired = true;						//   Until one succeeds
+		return NO_TEMP;
+	}
+	if (tempSpan == 0) return tempReading;
+	uint32_t since = (topTime - tempTime) / 1000;
+	if (since > tempSpan) since = tempSpan;
+	return tempReading + (int32_t)(tempReading - tempPrev) * (int32_t)since / (int32_t)tempSpan;
+}
+
+/*
+ *
+ * Private methods for the thermal lag
+ *
+ */
+
+// Candidate thermal lag time constants (s). After the first, each is twice the one before.
+static const uint16_t lagTaus[LAG_CANDIDATES] = {0, 900, 1800, 3600, 7200, 14400};
+
+// Put temp through the thermal lag filter, a first-order lag with time constant eeprom.tempLag, for a beat us long, 
+// giving rodTemp. Without a lag, or without a temperature to start from, rodTemp is just temp.
+void Escapement::lagTemp(int32_t us) {
+	if (temp == NO_TEMP || rodTemp == NO_TEMP || eeprom.tempLag == 0) {
+		rodFilt = rodTemp = temp;
+		return;
+	}
+	float a = us / (eeprom.tempLag * 1e6);
+	rodFilt += (temp - rodFilt) * (a < 1.0 ? a : 1.0);
+	rodTemp = (int16_t)(rodFilt < 0 ? rodFilt - 0.5 : rodFilt + 0.5);
+}
+
+// Forget the thermal lag samples, and the rate-of-change term's fit to them
+void Escapement::resetLag() {
+	memset(lag, 0, sizeof(lag));
+	memset(&rate, 0, sizeof(rate));
+	lagMeanY = lagSyy = 0.0;
+	lagBlocks = 0;
+	lagBeats = 0;
+	lagTime = hal->micros();
+}
+
+// Add the beat to the thermal lag estimator's current block. At the end of the block, its mean beat duration and 
+// mean temperature make a sample. The temperature goes through each candidate lag, taken as constant over the block 
+// (so the filter is exact), and the running least-squares fits of duration against the results are updated the 
+// way Welford's algorithm updates a variance, which keeps float sums of nearly equal numbers accurate.
+void Escapement::sampleLag() {
+	if (lagBeats == 0) {
+		lagSumDt = 0;
+		lagSumTemp = 0;
+		lagSumRod = 0;
+		lagSumRate = 0;
+	}
+	lagSumDt += deltaT;
+	lagSumTemp += temp;
+	lagSumRod += rodTemp;
+	lagSumRate += tempRate;
+	if (++lagBeats < LAG_BLOCK) return;
+	if (lagBlocks == 0) lagRefDt = lagSumDt;
+	float y = (float)(lagSumDt - lagRefDt) / LAG_BLOCK;	// Relative to the first, so it's small and precise
+	float t = (float)lagSumTemp / LAG_BLOCK;
+	float s = (topTime - lagTime) / 1e6;		// The block's length (s)
+	lagTime = topTime;
+	lagBeats = 0;
+	if (lagBlocks < 0xffff) lagBlocks++;
+	float dy = y - lagMeanY;
+	lagMeanY += dy / lagBlocks;
+	float ry = y - lagMeanY;
+	lagSyy += dy * ry;
+	for (byte k = 0; k < LAG_CANDIDATES; k++) {
+		lagCandidate_t &c = lag[k];
+		float start = lagBlocks == 1 ? t : c.temp;
+		float x = t;							// The mean of the lagged temperature over the block
+		if (lagTaus[k] != 0) {
+			float e = exp(-s / lagTaus[k]);
+			c.temp = t + (start - t) * e;
+			x = t + (start - t) * (1.0 - e) * lagTaus[k] / s;
+		} else {
+			c.temp = t;
+		}
+		float dx = x - c.meanX;
+		c.meanX += dx / lagBlocks;
+		c.sxx += dx * (x - c.meanX);
+		c.sxy += dx * ry;
+	}
+	float x = (float)lagSumRod / LAG_BLOCK;		// And the fit for the rate-of-change term
+	float v = (float)lagSumRate / LAG_BLOCK;
+	if (rate.n < 0xffff) rate.n++;
+	float dx = x - rate.meanX;
+	float dv = v - rate.meanR;
+	dy = y - rate.meanY;
+	rate.meanX += dx / rate.n;
+	rate.meanR += dv / rate.n;
+	rate.meanY += dy / rate.n;
+	float rx = x - rate.meanX;
+	float rv = v - rate.meanR;
+	ry = y - rate.meanY;
+	rate.sxx += dx * rx;
+	rate.sxr += dx * rv;
+	rate.srr += dv * rv;
+	rate.sxy += dx * ry;
+	rate.sry += dv * ry;
+	if (rate.n % RATE_MIN_BLOCKS == 0 && estimateRate()) {
+		checkpointEEPROM();						// Refit it every so often, and keep it if it changed
+	}
+}
+
+// Choose the candidate lag whose fit leaves the least residual sum of squares and refine it with a parabola through 
+// it and its neighbors' (the residual grows about as the square of the error in the lag). Nothing is chosen until 
+// there are LAG_MIN_BLOCKS samples whose temperatures have a standard deviation of at least LAG_MIN_SPREAD, or if 
+// the lag is fixed. Return true if eeprom.tempLag changed.
+boolean Escapement::estimateLag() {
+	if (eeprom.lagFixed || lagBlocks < LAG_MIN_BLOCKS) return false;
+	if (lag[0].sxx < (float)lagBlocks * LAG_MIN_SPREAD * LAG_MIN_SPREAD) return false;
+	float sse[LAG_CANDIDATES];
+	byte best = 0;
+	for (byte k = 0; k < LAG_CANDIDATES; k++) {
+		sse[k] = lag[k].sxx > 0.0 ? lagSyy - lag[k].sxy * lag[k].sxy / lag[k].sxx : lagSyy;
+		if (sse[k] < sse[best]) best = k;
+	}
+	float tau = lagTaus[best];
+	if (best > 0 && best < LAG_CANDIDATES - 1) {	// The vertex of the parabola through it and its neighbors
+		float a = tau - lagTaus[best - 1];
+		float b = tau - lagTaus[best + 1];
+		float fa = sse[best] - sse[best - 1];
+		float fb = sse[best] - sse[best + 1];
+		float den = a * fb - b * fa;
+		if (den != 0.0) tau -= 0.5 * (a * a * fb - b * b * fa) / den;
+		tau = constrain(tau, lagTaus[best - 1], lagTaus[best + 1]);
+	}
+	uint16_t seconds = (uint16_t)(tau + 0.5);
+	if (seconds == eeprom.tempLag) return false;
+	eeprom.tempLag = seconds;
+	resetRate();								// The rate-of-change term went with the old lag
+	return true;
+}
+
+// Smooth temp with a first-order filter with time constant RATE_TIME, for a beat us long, and set tempRate to 
+// the filter's rate of change, which for a steady trend is the trend. Without a temperature now or at the last 
+// beat, there's no trend to go on.
+void Escapement::rateTemp(int32_t us) {
+	if (temp == NO_TEMP || rodTemp == NO_TEMP) {	// (rodTemp is the last beat's)
+		rateFilt = temp;
+		tempRate = 0;
+		return;
+	}
+	float a = us / (RATE_TIME * 1e6);
+	rateFilt += (temp - rateFilt) * (a < 1.0 ? a : 1.0);
+	float r = (temp - rateFilt) * (3600.0 / RATE_TIME);
+	tempRate = r < -32767.0 ? -32767 : r > 32767.0 ? 32767 : (int16_t)(r < 0 ? r - 0.5 : r + 0.5);
+}
+
+// Fix the thermal lag time constant at seconds, or, for TEMP_LAG_AUTO, go back to estimating it
+void Escapement::fixLag(unsigned int seconds) {
+	eeprom.lagFixed = seconds != TEMP_LAG_AUTO;
+	if (eeprom.lagFixed && seconds != eeprom.tempLag) {
+		eeprom.tempLag = seconds;
+		resetRate();							// The rate-of-change term went with the old lag
+	}
+}
+
+// Drop the model's rate-of-change term and start its fit over
+void Escapement::resetRate() {
+	eeprom.rateSlope = 0;
+	memset(&rate, 0, sizeof(rate));
+}
+
+// Set the rate-of-change term from its fit: the coefficient of the rate in the least-squares fit of beat duration 
+// against the pendulum's temperature and the rate. Nothing is set until there are RATE_MIN_BLOCKS samples whose 
+// rates have a standard deviation of at least RATE_MIN_SPREAD, or if the temperature and rate are too closely 
+// correlated (r^2 > 3/4) to tell their effects apart. Return true if eeprom.rateSlope changed.
+boolean Escapement::estimateRate() {
+	if (rate.n < RATE_MIN_BLOCKS || rate.srr < (float)rate.n * RATE_MIN_SPREAD * RATE_MIN_SPREAD) return false;
+	float den = rate.sxx * rate.srr - rate.sxr * rate.sxr;
+	if (den <= 0.25 * rate.sxx * rate.srr) return false;
+	float m = (rate.sxx * rate.sry - rate.sxr * rate.sxy) / den * 4096.0;
+	int32_t rateSlope = m < -65535.0 ? -65535L : m > 65535.0 ? 65535L : (int32_t)(m < 0 ? m - 0.5 : m + 0.5);
+	if (rateSlope == eeprom.rateSlope) return false;
+	eeprom.rateSlope = rateSlope;
+	return true;
+}
+
+/*
+ *
+ * Private methods for the model
+ *
+ */
+
+// Choose the model's order -- the one asked for, or the best, but no higher than the completed buckets allow -- and 
+// work out modelKnots[] for it. A least-squares fit gives each knot from the polynomial. For MODEL_PIECEWISE, the 
+// completed buckets' knots are their average beat durations, those between completed buckets are interpolated, 
+// and those beyond the ends follow the line's slope.
+void Escapement::makeModel() {
+	byte order = modelChoice == MODEL_AUTO ? bestOrder() : modelChoice;
+	int steps = eeprom.tempSteps;
+	float c[3];
+	int n = escFitPoly(eeprom.uspbOffset, eeprom.sampleCount, steps, TGT_SAMPLES, -1, 
+		order == MODEL_QUADRATIC ? 2 : 1, c);
+	if (n < (order == MODEL_QUADRATIC ? 3 : 2)) order = MODEL_LINEAR;
+	int32_t base = eeprom.uspbBase << 4;
+	for (int i = 0; i < steps; i++) {
+		float x = i - (steps - 1) / 2.0;
+		float y = (c[0] + x * (c[1] + x * c[2])) * 16.0;
+		modelKnots[i] = base + (int32_t)(y < 0 ? y - 0.5 : y + 0.5);
+	}
+	if (order == MODEL_PIECEWISE) {				// Move the line's knots onto the completed buckets
+		int last = -1;							// The last completed bucket so far
+		int32_t lastShift = 0;					// And how far it was from the line
+		for (int i = 0; i < steps; i++) {
+			if (eeprom.sampleCount[i] <= TGT_SAMPLES) continue;
+			int32_t shift = base + ((int32_t)eeprom.uspbOffset[i] << 4) - modelKnots[i];
+			for (int j = last + 1; j < i; j++) {
+				modelKnots[j] += last < 0 ? shift : lastShift + (shift - lastShift) * (j - last) / (i - last);
+			}
+			modelKnots[i] += shift;
+			last = i;
+			lastShift = shift;
+		}
+		for (int j = last + 1; j < steps; j++) {
+			modelKnots[j] += lastShift;
+		}
+	}
+	modelOrder = order;
+}
+
+// Return the order, MODEL_LINEAR, MODEL_QUADRATIC or MODEL_PIECEWISE, whose model best predicts the average beat 
+// durations of the completed buckets that have completed buckets on both sides, each from all the other completed 
+// buckets: the one with the least sum of squared prediction errors, the lower order if that's a tie. It takes 
+// four completed buckets to try MODEL_QUADRATIC; with fewer than three there's nothing to go by and it's 
+// MODEL_LINEAR.
+byte Escapement::bestOrder() {
+	float sse[3] = {0.0, 0.0, 0.0};				// Indexed by order
+	int steps = eeprom.tempSteps;
+	int prev = -1;								// The completed bucket before i, if any
+	int count = 0;								// The number of completed buckets
+	for (int i = 0; i < steps; i++) {
+		if (eeprom.sampleCount[i] > TGT_SAMPLES) count++;
+	}
+	for (int i = 0; i < steps; i++) {
+		if (eeprom.sampleCount[i] <= TGT_SAMPLES) continue;
+		int next = i + 1;						// The completed bucket after i, if any
+		while (next < steps && eeprom.sampleCount[next] <= TGT_SAMPLES) next++;
+		if (prev >= 0 && next < steps) {
+			float x = i - (steps - 1) / 2.0;
+			float y = eeprom.uspbOffset[i];
+			float c[3];
+			float e;
+			escFitPoly(eeprom.uspbOffset, eeprom.sampleCount, steps, TGT_SAMPLES, i, 1, c);
+			e = y - (c[0] + x * c[1]);
+			sse[MODEL_LINEAR] += e * e;
+			if (count >= 4) {
+				escFitPoly(eeprom.uspbOffset, eeprom.sampleCount, steps, TGT_SAMPLES, i, 2, c);
+				e = y - (c[0] + x * (c[1] + x * c[2]));
+				sse[MODEL_QUADRATIC] += e * e;
+			}
+			e = y - (eeprom.uspbOffset[prev] + 
+				(float)(eeprom.uspbOffset[next] - eeprom.uspbOffset[prev]) * (i - prev) / (next - prev));
+			sse[MODEL_PIECEWISE] += e * e;
+		}
+		prev = i;
+	}
+	if (count < 3) return MODEL_LINEAR;
+	byte best = MODEL_LINEAR;
+	if (count >= 4 && sse[MODEL_QUADRATIC] < sse[best]) best = MODEL_QUADRATIC;
+	if (sse[MODEL_PIECEWISE] < sse[best]) best = MODEL_PIECEWISE;
+	return best;
+}
+
+// Return the beat duration (μs) the model gives at rodTemp, with the rate-of-change term and speed adjustment
+int32_t Escapement::modelUspb() {
+	return escModelKnots(modelKnots, eeprom.tempSteps, eeprom.tempMin, eeprom.tempRes, rodTemp, 
+		escRateUspb(eeprom.rateSlope, tempRate), eeprom.speedAdj);
 }
 
 /*
@@ -500,11 +1290,142 @@ int Escapement::readTemp() {
  */
 int Escapement::getTempIx(int t) {
 	if (!eeprom.compensated) return 0;			// If not temp compensated, index is always 0
-	t = ((t + 64) / 128)  - (2 * TEMP_MIN);		// Convert t to index
-	if (t >= 0 && t < TEMP_STEPS) {				// If within limits
-		return t;								//   Return the index
+	if (t == NO_TEMP) return NO_CAL;			// No reading is out of range, even if tempMin is -128, where NO_TEMP 
+												//   would otherwise land
+	t = escTempIx(t, eeprom.tempMin, eeprom.tempSteps, eeprom.tempRes);
+												// Convert t to index
+	return t < 0 ? NO_CAL : t;					// If out of range index is NO_CAL
+}
+
+// Return the number of beats deltaT spans: n if it's within 1/GAP_TOLERANCE of a beat of n (2 .. MAX_GAP_BEATS) 
+// times the average of the last tick and tock, else 1. Until there's a tick and a tock to go by, 1.
+byte Escapement::beatsSpanned() {
+	if (tickLength <= 0 || tockLength <= 0) return 1;
+	int32_t expected = (tickLength + tockLength) / 2;
+	int32_t n = (deltaT + expected / 2) / expected;
+	if (n < 2 || n > MAX_GAP_BEATS) return 1;
+	int32_t err = deltaT - n * expected;
+	if (err < 0) err = -err;
+	return err <= expected / GAP_TOLERANCE ? (byte)n : 1;
+}
+
+// Return true if deltaT is outside the acceptance gate: further from the last beat of the same kind (tick or tock) 
+// than gateSigmas times the smoothed prediction error, or GATE_MIN_SIGMA if that's bigger. If it's inside, learn 
+// from its prediction error and reset the count of consecutive rejects. With no gate or nothing to predict from, 
+// every beat is inside.
+boolean Escapement::isOutlier() {
+	int32_t predicted = tick ? tickLength : tockLength;
+	if (gateSigmas == 0 || predicted <= 0) return false;
+	int32_t diff = deltaT - predicted;
+	uint32_t err = diff < 0 ? -diff : diff;
+	uint32_t var = gateVar > (uint32_t)GATE_MIN_SIGMA * GATE_MIN_SIGMA ? gateVar : (uint32_t)GATE_MIN_SIGMA * GATE_MIN_SIGMA;
+	if (err > 0xffff) return true;
+	err *= err;
+	if (err / ((uint16_t)gateSigmas * gateSigmas) > var) return true;
+	if (err > gateVar) {						// Smooth the square of the error over about 16 beats
+		gateVar += (err - gateVar) >> 4;
+	} else {
+		gateVar -= (gateVar - err) >> 4;
+	}
+	gateRejects = 0;
+	return false;
+}
+
+// Report an event of the given type to the recorder, if there is one. For REC_BEAT, aux is the bucket fill and 
+// model is what the model gives for the beat, if it covers the temperature.
+void Escapement::record(byte type, int32_t value, int32_t aux) {
+	if (recorder == NULL) return;
+	beatRecord_t r;
+	r.type = type;
+	r.mode = runMode;
+	r.temp = temp;
+	r.time = topTime;
+	r.value = value;
+	r.aux = type != REC_BEAT ? aux : tempIx == NO_CAL ? 0 : eeprom.sampleCount[tempIx];
+	r.model = type == REC_BEAT && value != 0 && yIntercept != 0 && tempIx != NO_CAL ? modelUspb() : 0;
+	recorder->record(r);
+}
+
+/*
+ *
+ * Private methods to decode and encode the compact calibration table
+ *
+ */
+
+// Get the average μs per beat for bucket ix
+int32_t Escapement::getUspb(int ix) {
+	return eeprom.uspbBase + eeprom.uspbOffset[ix];
+}
+
+// Set the average μs per beat for bucket ix to uspb. If uspb is too far from eeprom.uspbBase to be represented, 
+// rebase the table around the middle of the range of values it holds. If even that doesn't make room, saturate.
+void Escapement::setUspb(int ix, int32_t uspb) {
+	int32_t offset = uspb - eeprom.uspbBase;
+	if (offset < CAL_OFFSET_MIN || offset > CAL_OFFSET_MAX) {
+		int32_t lo = uspb;						// Find the range of the values in the table, including the new one
+		int32_t hi = uspb;
+		for (int i = 0; i < eeprom.tempSteps; i++) {
+			if (i != ix && eeprom.sampleCount[i] > 1) {
+				int32_t v = getUspb(i);
+				if (v < lo) lo = v;
+				if (v > hi) hi = v;
+			}
+		}
+		int32_t base = lo + (hi - lo) / 2;		// Rebase around the middle of it
+		for (int i = 0; i < eeprom.tempSteps; i++) {
+			offset = eeprom.sampleCount[i] > 1 ? getUspb(i) - base : 0;
+			eeprom.uspbOffset[i] = constrain(offset, CAL_OFFSET_MIN, CAL_OFFSET_MAX);
+		}
+		eeprom.uspbBase = base;
+		dirtyBuckets = 0xffffffffUL >> (32 - eeprom.tempSteps);	// Every bucket changed
+		offset = uspb - base;
 	}
-	return NO_CAL;								// If out of range index is NO_CAL
+	eeprom.uspbOffset[ix] = constrain(offset, CAL_OFFSET_MIN, CAL_OFFSET_MAX);
+}
+
+// Empty the calibration table: no base duration and no samples in any bucket, all of which need writing
+void Escapement::clearTable() {
+	eeprom.uspbBase = 0;
+	for (int i = 0; i < TEMP_STEPS_MAX; i++) {
+		eeprom.uspbOffset[i] = 0;
+		eeprom.sampleCount[i] = 1;
+		uspbRem[i] = 0;
+	}
+	dirtyBuckets = 0xffffffffUL >> (32 - eeprom.tempSteps);
+}
+
+// Change the temperature range to steps buckets from tempMin degrees C, res to a degree C, and make it persistent. 
+// A bucket whose temperature was a bucket's in the old range too keeps that bucket's calibration information; the 
+// rest start empty. (Uncompensated, there's only bucket 0, which holds every temperature, so it's kept.)
+void Escapement::remapBuckets(int8_t tempMin, byte steps, byte res) {
+	if (tempMin == eeprom.tempMin && steps == eeprom.tempSteps && res == eeprom.tempRes) return;
+	int16_t offset[TEMP_STEPS_MAX];				// The old table
+	uint16_t count[TEMP_STEPS_MAX];
+	int32_t base = eeprom.uspbBase;
+	int8_t oldMin = eeprom.tempMin;
+	byte oldSteps = eeprom.tempSteps;
+	byte oldRes = eeprom.tempRes;
+	memcpy(offset, eeprom.uspbOffset, sizeof(offset));
+	memcpy(count, eeprom.sampleCount, sizeof(count));
+	eeprom.tempMin = tempMin;
+	eeprom.tempSteps = steps;
+	eeprom.tempRes = res;
+	clearTable();
+	eeprom.uspbBase = base;
+	for (int i = 0; i < steps; i++) {
+		int16_t t = escBucketTemp(i, tempMin, res);
+		int j = escTempIx(t, oldMin, oldSteps, oldRes);	// The old bucket nearest this one's temperature
+		if (!eeprom.compensated) {
+			j = i == 0 ? 0 : -1;
+		} else if (j >= 0 && escBucketTemp(j, oldMin, oldRes) != t) {
+			j = -1;								//   Only the same temperature will do
+		}
+		if (j >= 0) {
+			eeprom.uspbOffset[i] = offset[j];
+			eeprom.sampleCount[i] = count[j];
+		}
+	}
+	writeEEPROM();
 }
 
 /*
@@ -513,27 +1434,251 @@ int Escapement::getTempIx(int t) {
  *
  */
 
-// Read EEPROM 
+// CRC-16-CCITT (x^16 + x^12 + x^5 + 1, starting from 0xffff) of the persistent parameters in s, all but the crc 
+// field itself
+static uint16_t settingsCrc(const settings_t *s) {
+	const byte *p = (const byte *)s;
+	uint16_t crc = 0xffff;
+	for (unsigned int i = 0; i < sizeof(settings_t); i++) {
+		if (i == offsetof(settings_t, crc)) {
+			i += sizeof(s->crc) - 1;
+			continue;
+		}
+		crc ^= (uint16_t)p[i] << 8;
+		for (byte j = 0; j < 8; j++) {
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+// Find the latest good copy of the persistent parameters in the store -- of those whose tag and CRC are right, the 
+// one with the later sequence number -- and take up its sequence number, so the next write supersedes it. With 
+// none, copy 0 stands in, so the first write leaves any older form there alone until it's done. Leaves the rest of 
+// eeprom unspecified; readEEPROM() reads the copy found.
+void Escapement::findSlot() {
+	uint16_t seq0, seq1;
+	boolean good0 = slotValid(0, &seq0);
+	boolean good1 = slotValid(1, &seq1);
+	slot = good1 && (!good0 || (int16_t)(seq1 - seq0) > 0) ? 1 : 0;	// (Sequence numbers wrap around)
+	eeprom.seq = slot == 1 ? seq1 : good0 ? seq0 : 0;
+	lastDirty = 0xffffffffUL;				// Nothing is known about the other copy, so the next write is whole
+}
+
+// Read copy s of the persistent parameters into eeprom and say whether it's good
+boolean Escapement::slotValid(byte s, uint16_t *seq) {
+	if (!storeRead(s * sizeof(settings_t), &eeprom, sizeof(eeprom))) return false;
+	*seq = eeprom.seq;
+	return eeprom.id == SETTINGS_TAG && eeprom.crc == settingsCrc(&eeprom);
+}
+
+// Make any sample counts that can't be right harmless: a count of 0 (which the running average would divide by) 
+// becomes 1, a bucket with no samples has no offset, and so has any bucket beyond the range in use
+void Escapement::checkTable() {
+	for (int i = 0; i < TEMP_STEPS_MAX; i++) {
+		if (eeprom.sampleCount[i] <= 1 || i >= eeprom.tempSteps) {
+			eeprom.sampleCount[i] = 1;
+			eeprom.uspbOffset[i] = 0;
+		}
+	}
+}
+
+// Read EEPROM: the latest good copy of the persistent parameters, which findSlot() has found, or, if there's none, 
+// the older form at the start of the store, converting it
 boolean Escapement::readEEPROM() {
-	
-	eeprom_read_block((void*)&eeprom, (const void*)0, sizeof(eeprom)); // Read from EEPROM
-	if (eeprom.id == SETTINGS_TAG) {			// If it looks like ours
-		return true;							//  Say we read it okay
+	uint16_t seq = eeprom.seq;
+	if (storeRead(slot * sizeof(settings_t), &eeprom, sizeof(eeprom)) && eeprom.id == SETTINGS_TAG && 
+			eeprom.crc == settingsCrc(&eeprom) && eeprom.tempSteps >= 1 && eeprom.tempSteps <= TEMP_STEPS_MAX && 
+			(eeprom.tempRes == 1 || eeprom.tempRes == 2 || eeprom.tempRes == 4)) {
+												// If it's good
+		checkTable();							//   Make sure it's safe to use
+		eeprom.crc = settingsCrc(&eeprom);		//   (Which may have changed it)
+		return true;							//   Say we read it okay
+	}
+	eeprom.seq = seq;
+	if (!storeRead(0, &eeprom.id, sizeof(eeprom.id))) {	// See what's at the start of the store
+		eeprom.id = 0;							//   If that didn't work, there's nothing there
+	}
+	eeprom.tempMin = TEMP_MIN;					// Otherwise, whatever it is, it's for the default temp range
+	eeprom.tempSteps = TEMP_STEPS;
+	eeprom.tempRes = TEMP_RES;
+	union {										// The older forms, any of which may be there
+		settingsV5_t v5;
+		settingsV4_t v4;
+		settingsV3_t v3;
+		settingsV2_t v2;
+		settingsV1_t v1;
+	} old;
+	if (eeprom.id == SETTINGS_V5_TAG && storeRead(0, &old.v5, sizeof(old.v5)) && old.v5.tempSteps >= 1 && 
+			old.v5.tempSteps <= TEMP_STEPS_MAX && (old.v5.tempRes == 1 || old.v5.tempRes == 2 || old.v5.tempRes == 4)) {
+												// If it's ours but from before there were two copies
+												//   Convert it (if it can't be read, use the defaults)
+		eeprom.bias = old.v5.bias;
+		eeprom.speedAdj = old.v5.speedAdj;
+		eeprom.compensated = old.v5.compensated;
+		eeprom.tempLag = old.v5.tempLag;
+		eeprom.lagFixed = old.v5.lagFixed;
+		eeprom.rateSlope = old.v5.rateSlope;
+		eeprom.tempMin = old.v5.tempMin;
+		eeprom.tempSteps = old.v5.tempSteps;
+		eeprom.tempRes = old.v5.tempRes;
+		clearTable();
+		eeprom.uspbBase = old.v5.uspbBase;
+		memcpy(eeprom.uspbOffset, old.v5.uspbOffset, sizeof(old.v5.uspbOffset));
+		memcpy(eeprom.sampleCount, old.v5.sampleCount, sizeof(old.v5.sampleCount));
+		checkTable();							//   Which may have been cut short while being written
+		writeEEPROM();							//   And store it in the new form
+		return true;
+	} else if (eeprom.id == SETTINGS_V4_TAG && storeRead(0, &old.v4, sizeof(old.v4))) {
+												// If it's ours but from before the temp range could be set
+												//   Convert it
+		eeprom.bias = old.v4.bias;
+		eeprom.speedAdj = old.v4.speedAdj;
+		eeprom.compensated = old.v4.compensated;
+		eeprom.tempLag = old.v4.tempLag;
+		eeprom.lagFixed = old.v4.lagFixed;
+		eeprom.rateSlope = old.v4.rateSlope;
+		clearTable();
+		eeprom.uspbBase = old.v4.uspbBase;
+		memcpy(eeprom.uspbOffset, old.v4.uspbOffset, sizeof(old.v4.uspbOffset));
+		memcpy(eeprom.sampleCount, old.v4.sampleCount, sizeof(old.v4.sampleCount));
+		checkTable();
+		writeEEPROM();							//   And store it in the new form
+		return true;
+	} else if (eeprom.id == SETTINGS_V3_TAG && storeRead(0, &old.v3, sizeof(old.v3))) {
+												// If it's ours but from before the rate-of-change term
+												//   Convert it
+		eeprom.bias = old.v3.bias;
+		eeprom.speedAdj = old.v3.speedAdj;
+		eeprom.compensated = old.v3.compensated;
+		eeprom.tempLag = old.v3.tempLag;
+		eeprom.lagFixed = old.v3.lagFixed;
+		eeprom.rateSlope = 0;
+		clearTable();
+		eeprom.uspbBase = old.v3.uspbBase;
+		memcpy(eeprom.uspbOffset, old.v3.uspbOffset, sizeof(old.v3.uspbOffset));
+		memcpy(eeprom.sampleCount, old.v3.sampleCount, sizeof(old.v3.sampleCount));
+		checkTable();
+		writeEEPROM();							//   And store it in the new form
+		return true;
+	} else if (eeprom.id == SETTINGS_V2_TAG && storeRead(0, &old.v2, sizeof(old.v2))) {
+												// If it's ours but from before the thermal lag
+												//   Convert it
+		eeprom.bias = old.v2.bias;
+		eeprom.speedAdj = old.v2.speedAdj;
+		eeprom.compensated = old.v2.compensated;
+		eeprom.tempLag = 0;
+		eeprom.lagFixed = false;
+		eeprom.rateSlope = 0;
+		clearTable();
+		eeprom.uspbBase = old.v2.uspbBase;
+		memcpy(eeprom.uspbOffset, old.v2.uspbOffset, sizeof(old.v2.uspbOffset));
+		memcpy(eeprom.sampleCount, old.v2.sampleCount, sizeof(old.v2.sampleCount));
+		checkTable();
+		writeEEPROM();							//   And store it in the new form
+		return true;
+	} else if (eeprom.id == SETTINGS_V1_TAG && storeRead(0, &old.v1, sizeof(old.v1))) {
+												// If it's ours but in the old, uncompressed form
+												//   Convert it
+		eeprom.bias = old.v1.bias;
+		eeprom.speedAdj = old.v1.speedAdj;
+		eeprom.compensated = old.v1.compensated;
+		eeprom.tempLag = 0;
+		eeprom.lagFixed = false;
+		eeprom.rateSlope = 0;
+		clearTable();
+		for (int i = 0; i < TEMP_STEPS; i++) {	//   (Buckets still holding a count of 1 don't count when rebasing)
+			if (old.v1.sampleCount[i] > 1) {
+				setUspb(i, old.v1.uspb[i]);
+				eeprom.sampleCount[i] = old.v1.sampleCount[i];
+			}
+		}
+		writeEEPROM();							//   And store it in the new form
+		return true;
 	} else {									// Otherwise
 		eeprom.id = 0;							//   Default id to note that eeprom not read
 		eeprom.bias = 0;						//   Default RTC speed correction
 		eeprom.speedAdj = 0;					//   Default manual speed adjustment
-		eeprom.compensated = temp != NO_TEMP;	//   True iff sensor hardware existed at enable() time
-		for (int i = 0; i < TEMP_STEPS; i++) {	//   Default eeprom.uspb, eeprom.temp and eeprom.sampleCount
-			eeprom.uspb[i] = 0;
-			eeprom.sampleCount[i] = 1;
-		}
+		eeprom.compensated = tempPresent;		//   True iff sensor hardware existed at enable() time
+		eeprom.tempLag = 0;						//   No thermal lag until one is estimated
+		eeprom.lagFixed = false;
+		eeprom.rateSlope = 0;					//   No rate-of-change term until one is fitted
+		clearTable();							//   Default the calibration table
 		return false;
 	}
 }
 
-// Write EEPROM
+// Write EEPROM: the whole thing, with the next sequence number, to the copy that isn't the latest. If that fails, 
+// everything is left to be written again by the next checkpoint. Before enable() there's no store to write to and 
+// nothing to write: enable() reads the persistent parameters over whatever the setters changed.
 void Escapement::writeEEPROM() {
+	if (!enabled) return;
 	eeprom.id = SETTINGS_TAG;					// Mark the EEPROM data structure as ours
-	eeprom_write_block((const void*)&eeprom, (void*)0, sizeof(eeprom)); // Write it to EEPROM
+	eeprom.seq++;								// Make it the latest
+	eeprom.crc = settingsCrc(&eeprom);
+	ESCAPEMENT_PROBE(PROBE_STORE_START);
+	boolean ok = storeWrite((1 - slot) * sizeof(settings_t), &eeprom, sizeof(eeprom));	// Write it to the store
+	ESCAPEMENT_PROBE(PROBE_STORE_END);
+	beatsSinceCheckpoint = 0;
+	msSinceCheckpoint = 0;
+	lastDirty = 0xffffffffUL;					// Either way, the copies may differ anywhere
+	if (!ok) {									// If it didn't take
+		dirtyBuckets = 0xffffffffUL >> (32 - eeprom.tempSteps);	//   Every bucket needs writing
+		return;
+	}
+	slot = 1 - slot;							// That's the latest now
+	stats.eepromWrites++;
+	stats.eepromBytes += sizeof(eeprom);
+	dirtyBuckets = 0;							// Everything is persistent now
+}
+
+// Checkpoint partial COLLECT progress: bring the copy that isn't the latest up to date by writing the header and 
+// only the buckets that changed since either copy was written. EEPROMStore doesn't rewrite unchanged bytes, so this 
+// is cheap on EEPROM wear.
+void Escapement::checkpointEEPROM() {
+	if (eeprom.id != SETTINGS_TAG) {			// If EEPROM doesn't hold our data yet
+		writeEEPROM();							//   Write the whole thing
+		return;
+	}
+	eeprom.seq++;
+	eeprom.crc = settingsCrc(&eeprom);
+	unsigned int base = (1 - slot) * sizeof(settings_t);
+	uint32_t changed = dirtyBuckets | lastDirty;
+	ESCAPEMENT_PROBE(PROBE_STORE_START);
+	boolean ok = storeWrite(base, &eeprom, offsetof(settings_t, uspbOffset)); // Header
+	for (int i = 0; ok && i < TEMP_STEPS_MAX; i++) {	// Changed buckets
+		if (changed & (1UL << i)) {
+			ok = storeWrite(base + offsetof(settings_t, uspbOffset) + i * sizeof(eeprom.uspbOffset[0]), 
+					&eeprom.uspbOffset[i], sizeof(eeprom.uspbOffset[0])) && 
+				storeWrite(base + offsetof(settings_t, sampleCount) + i * sizeof(eeprom.sampleCount[0]), 
+					&eeprom.sampleCount[i], sizeof(eeprom.sampleCount[0]));
+			stats.eepromBytes += sizeof(eeprom.uspbOffset[0]) + sizeof(eeprom.sampleCount[0]);
+		}
+	}
+	ESCAPEMENT_PROBE(PROBE_STORE_END);
+	beatsSinceCheckpoint = 0;
+	msSinceCheckpoint = 0;
+	if (!ok) {									// If it didn't take, that copy may differ anywhere now, and the 
+		lastDirty = 0xffffffffUL;				//   changed buckets stay dirty for the next checkpoint
+		return;
+	}
+	slot = 1 - slot;							// That's the latest now; the other differs in what just changed
+	lastDirty = dirtyBuckets;
+	dirtyBuckets = 0;
+	stats.eepromWrites++;
+	stats.eepromBytes += offsetof(settings_t, uspbOffset);
+}
+
+// Read len bytes at addr in the store into buf; false, counting the failure, if that didn't work
+boolean Escapement::storeRead(unsigned int addr, void *buf, unsigned int len) {
+	if (store->read(addr, buf, len)) return true;
+	stats.storeFailures++;
+	return false;
+}
+
+// Write len bytes from buf to addr in the store; false, counting the failure, if that didn't work
+boolean Escapement::storeWrite(unsigned int addr, const void *buf, unsigned int len) {
+	if (store->write(addr, buf, len)) return true;
+	stats.storeFailures++;
+	return false;
 }
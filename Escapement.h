@@ -1,6 +1,6 @@
 /****
  *
- *   Part of the "Escapement" library for Arduino. Version 0.87
+ *   Part of the "Escapement" library for Arduino. Version 0.88
  *
  *   Escapement.h Copyright 2014-2015 by D. L. Ehnebuske 
  *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
@@ -13,18 +13,20 @@
 #ifndef Escapement_H
 #define Escapement_H
 
-#include <Wire.h>       // Use the Wire library to talk to the TMP102 temperature sensor: it's an I2C device
-#include <avr/eeprom.h> // EEPROM read write library
-
-#if ARDUINO >= 100
-  #include <Arduino.h>  // Arduino 1.0
-#else
-  #include <WProgram.h> // Arduino 0022
-#endif
+#include "EscapementHAL.h"   // Hardware abstraction: ADC, timebase, GPIO, I2C and storage
+#include "EscapementStore.h" // Persistent storage backends
+#include "EscapementSensor.h" // Temperature sensors
+#include "EscapementMath.h"  // Timing and calibration arithmetic kernels
+#include "EscapementRecorder.h" // Recording inputs for replay
+#include "EscapementTelemetry.h" // Compact binary recording for serial telemetry
 
 // Compile-time options; uncomment to enable
 //#define DEBUG
 
+#if defined(DEBUG) && !defined(ARDUINO)
+  #undef DEBUG					// DEBUG output goes to Serial, so it's only available in Arduino builds
+#endif
+
 // Run mode constants
 #define COLDSTART		(0)
 #define WARMSTART		(1)
@@ -34,9 +36,16 @@
 #define RUN				(5)
 #define CALRTC			(6)
 
+// Model order constants
+#define MODEL_LINEAR	(0)					// A straight line through the buckets
+#define MODEL_QUADRATIC	(1)					// A parabola through them
+#define MODEL_PIECEWISE	(2)					// Straight lines from one completed bucket to the next
+#define MODEL_AUTO		(3)					// Whichever of those best predicts each bucket from the others
+
 // Mode run length constants
 #define TGT_WARMUP		(1024)				// Number of beats to run in WARMSTART mode
 #define TGT_SAMPLES	(8192)				// Number of beats to run COLLECT mode for a given temperature
+#define CHECKPOINT_BEATS	(1024)			// Default number of COLLECT beats between checkpoints of partial progress
 
 // Bendulum sensing and and pushing constants
 #define SETTLE_TIME 	(250)				// Time to delay to let things settle before looking for voltage spike (ms)
@@ -44,55 +53,329 @@
 #define DELAY_TIME		(1)					// Time by which to delay the start of the kick pulse (ms)
 #define KICK_TIME		(9)					// Duration of the kick pulse (ms). Try 5-10 for a pendulum, 20-30 for a bendulum
 #define NOISE_SIZE		(10)				// Assumed size of the noise in coil readings
+#define MAX_GAP_BEATS	(8)					// Most beats a gap between detections can span and still be accounted for
+#define GAP_TOLERANCE	(8)					// A gap must be within 1/GAP_TOLERANCE of a beat of a whole number of them
+#define GATE_SIGMAS		(4)					// Default acceptance gate: beats more than this many sigma off are outliers
+#define GATE_MIN_SIGMA	(2000)				// Smallest sigma the acceptance gate assumes (μs)
+#define GATE_RESYNC		(4)					// Consecutive outliers after which the gate starts over
 
 // Other constants
-#define ADDRESS_TMP102	(0x48)				// Wire address of the TMP102 temperature sensor
-#define NO_TEMP			(0xfc80)			// Value of readTemp() when no temp reading available (=-56 degrees C)
 #define NO_CAL			(-1)				// Value of getTempIx() when temperature is out of calibration temperature range
 #define ABS_ZERO		(-273.15)			// Value of getTemp() when no temp reading available
-#define TEMP_MIN		(18)				// Minimum temp we calibrate with (degrees C)
-#define TEMP_STEPS		(18)				// Number of 0.5C steps we keep track of
+#define TEMP_MIN		(18)				// Default minimum temp we calibrate with (degrees C)
+#define TEMP_STEPS		(18)				// Default number of temp buckets (and the number in older EEPROM forms)
+#define TEMP_RES		(2)					// Default number of temp buckets to a degree C (1, 2 or 4)
+#define TEMP_STEPS_MAX	(32)				// Most temp buckets setTempRange() allows (<= 32; see dirtyBuckets)
+#define TEMP_INTERVAL	(10)				// Default time between temperature samples (s; 0 = every beat)
+#define TEMP_INTERVAL_MAX	(3600)			// Longest time between temperature samples (s)
+#define TEMP_TREND_MAX	(512)				// Biggest change between samples that's carried forward (degrees C * 256)
+#define TEMP_RETRIES	(3)					// Failed temperature readings retried at the very next beat
+#define TEMP_BACKOFF	(10)				// Shortest time between retries after that (s)
+#define TEMP_HOLD		(300)				// Default time the last good temperature is held while readings fail (s)
+#define TEMP_LAG_AUTO	(0xffff)			// setTempLag() value that has the thermal lag estimated
+#define LAG_CANDIDATES	(6)					// Number of thermal lags the estimator compares
+#define LAG_BLOCK		(64)				// Beats averaged into each thermal lag sample (even, so ticks = tocks)
+#define LAG_MIN_BLOCKS	(256)				// Samples needed before the thermal lag is estimated
+#define LAG_MIN_SPREAD	(64)				// Standard deviation of their temperatures needed (degrees C * 256)
+#define RATE_TIME		(900)				// Time constant of the smoothing of the temperature's rate of change (s)
+#define RATE_MIN_BLOCKS	(256)				// Thermal lag samples needed to fit the rate-of-change term, and between refits
+#define RATE_MIN_SPREAD	(64)				// Standard deviation of their rates needed (degrees C * 256 per hour)
+
+// Temperature sampling states
+#define TEMP_IDLE		(0)					// Waiting until the next sample is due
+#define TEMP_TRIGGER	(1)					// Start a one-shot conversion at the start of the next beat
+#define TEMP_READ		(2)					// Read the temperature at the start of the next beat
+#define TEMP_CONFIGURE	(3)					// Set the sensor up again at the start of the next beat
+
+// Calibration table encoding constants
+#define CAL_OFFSET_MIN	(-32768L)			// Smallest bucket offset from eeprom.uspbBase (μs)
+#define CAL_OFFSET_MAX	(32767L)			// Largest bucket offset from eeprom.uspbBase (μs)
+#define CAL_COUNT_MAX	(0xffff)			// sampleCount[] saturates at this value
 
-// EEPROM data structure definition
+// EEPROM data structure definition. The store holds two copies, one after the other; each write goes to the one 
+// not holding the latest good copy, with the next sequence number, so a write cut short leaves the other intact.
 struct settings_t {							// Structure of data stored in EEPROM
-	unsigned int id;						// ID tag to know whether data (probably) belongs to this sketch
-	int bias;								// Empirically determined correction factor for the real-time clock in 0.1 s/day
-	long speedAdj;							// Speed adjustment factor in tenths of a second per day
+	uint16_t id;							// ID tag to know whether data (probably) belongs to this sketch
+	uint16_t seq;							// Sequence number of the write; the later good copy is the current one
+	uint16_t crc;							// CRC-16 of the rest of the structure (see settingsCrc())
+	int16_t bias;							// Empirically determined correction factor for the real-time clock in 0.1 s/day
+	int32_t speedAdj;						// Speed adjustment factor in tenths of a second per day
 	bool compensated;						// Set to true if the Escapement is temperature compensated, else false
-	long uspb[TEMP_STEPS];					// Measured μs per beat averaged over sampleCount samples
-	int sampleCount[TEMP_STEPS];			// Count of samples taken for this temp bucket
+	uint16_t tempLag;						// Thermal lag time constant (s); 0 if the pendulum follows the readings
+	bool lagFixed;							// Set to true if tempLag was set by setTempLag() rather than estimated
+	int32_t rateSlope;						// Model's rate-of-change term: μs per (degree C * 256 per hour) * 4096
+	int8_t tempMin;							// Temp of the 0th bucket (degrees C)
+	byte tempSteps;							// Number of buckets in use (<= TEMP_STEPS_MAX)
+	byte tempRes;							// Number of buckets to a degree C (1, 2 or 4)
+	int32_t uspbBase;						// Base beat duration (μs) the uspbOffset[] values are relative to
+	int16_t uspbOffset[TEMP_STEPS_MAX];		// Measured μs per beat averaged over sampleCount samples, less uspbBase
+	uint16_t sampleCount[TEMP_STEPS_MAX];	// Count of samples taken for this temp bucket (saturating)
+};
+
+#define SETTINGS_TAG (0x3db8)               // If this is in eeprom.id, the contents of eeprom is (probably) ours
+
+// EEPROM data structure definition with a single copy and no sequence number or CRC; converted to settings_t when 
+// read
+struct settingsV5_t {
+	uint16_t id;							// ID tag; SETTINGS_V5_TAG
+	int16_t bias;							// Correction factor for the real-time clock in 0.1 s/day
+	int32_t speedAdj;						// Speed adjustment factor in tenths of a second per day
+	bool compensated;						// True if temperature compensated
+	uint16_t tempLag;						// Thermal lag time constant (s)
+	bool lagFixed;							// True if tempLag was set by setTempLag()
+	int32_t rateSlope;						// Model's rate-of-change term
+	int8_t tempMin;							// Temp of the 0th bucket (degrees C)
+	byte tempSteps;							// Number of buckets in use
+	byte tempRes;							// Number of buckets to a degree C
+	int32_t uspbBase;						// Base beat duration (μs) the uspbOffset[] values are relative to
+	int16_t uspbOffset[TEMP_STEPS_MAX];		// Measured μs per beat averaged over sampleCount samples, less uspbBase
+	uint16_t sampleCount[TEMP_STEPS_MAX];	// Count of samples taken for this temp bucket (saturating)
+};
+
+#define SETTINGS_V5_TAG (0x3db7)            // If this is in eeprom.id, the contents of eeprom is in settingsV5_t form
+
+// EEPROM data structure definition with the fixed temperature range; converted to settings_t when read
+struct settingsV4_t {
+	uint16_t id;							// ID tag; SETTINGS_V4_TAG
+	int16_t bias;							// Correction factor for the real-time clock in 0.1 s/day
+	int32_t speedAdj;						// Speed adjustment factor in tenths of a second per day
+	bool compensated;						// True if temperature compensated
+	uint16_t tempLag;						// Thermal lag time constant (s)
+	bool lagFixed;							// True if tempLag was set by setTempLag()
+	int32_t rateSlope;						// Model's rate-of-change term
+	int32_t uspbBase;						// Base beat duration (μs) the uspbOffset[] values are relative to
+	int16_t uspbOffset[TEMP_STEPS];			// Measured μs per beat averaged over sampleCount samples, less uspbBase
+	uint16_t sampleCount[TEMP_STEPS];		// Count of samples taken for this temp bucket (saturating)
+};
+
+#define SETTINGS_V4_TAG (0x3db6)            // If this is in eeprom.id, the contents of eeprom is in settingsV4_t form
+
+// EEPROM data structure definition without the rate-of-change term; converted to settings_t when read
+struct settingsV3_t {
+	uint16_t id;							// ID tag; SETTINGS_V3_TAG
+	int16_t bias;							// Correction factor for the real-time clock in 0.1 s/day
+	int32_t speedAdj;						// Speed adjustment factor in tenths of a second per day
+	bool compensated;						// True if temperature compensated
+	uint16_t tempLag;						// Thermal lag time constant (s)
+	bool lagFixed;							// True if tempLag was set by setTempLag()
+	int32_t uspbBase;						// Base beat duration (μs) the uspbOffset[] values are relative to
+	int16_t uspbOffset[TEMP_STEPS];			// Measured μs per beat averaged over sampleCount samples, less uspbBase
+	uint16_t sampleCount[TEMP_STEPS];		// Count of samples taken for this temp bucket (saturating)
+};
+
+#define SETTINGS_V3_TAG (0x3db5)            // If this is in eeprom.id, the contents of eeprom is in settingsV3_t form
+
+// 0.88 EEPROM data structure definition, without the thermal lag; converted to settings_t when read
+struct settingsV2_t {
+	uint16_t id;							// ID tag; SETTINGS_V2_TAG
+	int16_t bias;							// Correction factor for the real-time clock in 0.1 s/day
+	int32_t speedAdj;						// Speed adjustment factor in tenths of a second per day
+	bool compensated;						// True if temperature compensated
+	int32_t uspbBase;						// Base beat duration (μs) the uspbOffset[] values are relative to
+	int16_t uspbOffset[TEMP_STEPS];			// Measured μs per beat averaged over sampleCount samples, less uspbBase
+	uint16_t sampleCount[TEMP_STEPS];		// Count of samples taken for this temp bucket (saturating)
+};
+
+#define SETTINGS_V2_TAG (0x3db4)            // If this is in eeprom.id, the contents of eeprom is in settingsV2_t form
+
+// Pre-0.88 EEPROM data structure definition; converted to settings_t when read
+struct settingsV1_t {
+	uint16_t id;							// ID tag; SETTINGS_V1_TAG
+	int16_t bias;							// Correction factor for the real-time clock in 0.1 s/day
+	int32_t speedAdj;						// Speed adjustment factor in tenths of a second per day
+	bool compensated;						// True if temperature compensated
+	int32_t uspb[TEMP_STEPS];				// Measured μs per beat averaged over sampleCount samples
+	int16_t sampleCount[TEMP_STEPS];		// Count of samples taken for this temp bucket
+};
+
+#define SETTINGS_V1_TAG (0x3db3)            // If this is in eeprom.id, the contents of eeprom is in settingsV1_t form
+
+// One of the thermal lag estimator's candidate lags
+struct lagCandidate_t {
+	float temp;								// The temperature through this lag (degrees C * 256)
+	float meanX;							// The mean of that over the samples
+	float sxx;								// The sum of the squares of its deviations from the mean
+	float sxy;								// The sum of the products of those and the beat durations' deviations
 };
 
-#define SETTINGS_TAG (0x3db3)               // If this is in eeprom.id, the contents of eeprom is (probably) ours
+// Running least-squares fit of beat duration against the pendulum's temperature and the temperature's rate of change
+struct rateFit_t {
+	uint16_t n;								// Number of samples (saturating)
+	float meanX;							// The mean of their pendulum temperatures (degrees C * 256)
+	float meanR;							// The mean of their rates of change (degrees C * 256 per hour)
+	float meanY;							// The mean of their beat durations, less lagRefDt / LAG_BLOCK (μs)
+	float sxx;								// The sums of the products of their deviations from the means
+	float sxr;
+	float srr;
+	float sxy;
+	float sry;
+};
+
+// Hot-path counters; see getStats(). Times are measured with the real-time clock.
+struct beatStats_t {
+	uint32_t beats;							// Calls to beat()
+	uint32_t adcReads;						// ADC readings taken by beat(), in all
+	uint16_t adcReadsLast;					// ADC readings taken by the last beat()
+	uint16_t adcReadsMax;					// Most ADC readings taken by any one beat()
+	uint32_t noiseWaitMs;					// Time spent waiting for the coil voltage to reach the noise floor (ms)
+	uint32_t noiseWaitLast;					// That wait in the last beat() (μs)
+	uint32_t noiseWaitMax;					// The longest that wait has been (μs)
+	uint32_t peakMs;						// Time spent in the loop looking for the magnet's pulse (ms)
+	uint32_t peakLast;						// That loop's time in the last beat() (μs)
+	uint32_t peakMax;						// The longest that loop has taken (μs)
+	uint16_t rejected;						// Beats rejected as more than 5 s long
+	uint16_t gaps;							// Times beat() found it had missed one or more passes
+	uint32_t missed;						// Passes missed in all
+	uint16_t outliers;						// Beats the acceptance gate rejected
+	uint16_t resyncs;						// Times the acceptance gate gave up and started over
+	uint16_t eepromWrites;					// Writes of the persistent parameters (whole or checkpoint)
+	uint32_t eepromBytes;					// Bytes handed to the store by those writes
+	uint16_t storeFailures;					// Store operations (begin, read or write) that failed
+	uint32_t tempReads;						// Temperature readings taken
+	uint16_t i2cFailures;					// Temperature readings (or sensor commands) that failed
+	uint16_t tempLost;						// Times readings failed for longer than the hold time
+	uint16_t tempRecovered;					// Times they came back after that
+	uint16_t transitions;					// Run mode changes
+};
 
 class Escapement {
 private:
 // Instance variables
 	byte sensePin;							// Pin on which we sense the bendulum's passing
 	byte kickPin;							// Pin on which we kick the bendulum as it passes
-	int beatCounter;						// In WARMSTART mode, the number of beats since peakScale changed
+	EscapementHAL *hal;						// The hardware we run on
+	int16_t beatCounter;					// In WARMSTART mode, the number of beats since peakScale changed
 	settings_t eeprom;						// Contents of EEPROM -- our persistent parameters
-	int temp;								// Temperature (degrees C * 256)
-	long tickLength;						// Duration of last tick (μs)
-	long tockLength;						// Duration of last tock (μs)
-	unsigned long topTime;					// Real-time clock time (μs) at time magnet passed over coil
-	unsigned long lastTime;					// topTime last time through beat()
-	long deltaT;							// Holds length of last beat (μs)
-	long yIntercept;						// Linear model of beat duration as a function of temp: y intercept
-	long slope;								// Linear model of beat duration as a function of temp: slope * 4096
-	int tempIx;								// Which "bucket" of temps we're dealing with currently
+	EscapementStore *store;					// Where the persistent parameters are kept
+	boolean enabled;						// Whether enable() has read them (nothing is written to store until then)
+	EscapementRecorder *recorder;			// Where inputs and outputs are reported, if anywhere
+	uint16_t *waveBuf;						// Waveform capture buffer (NULL if not capturing)
+	uint16_t waveSize;						// Size of waveBuf (readings; a multiple of N_SAMPLES)
+	uint16_t waveIx;						// Where the next reading goes in waveBuf
+	uint32_t waveReads;						// Readings taken since the capture started
+	uint32_t waveStart;						// Real-time clock time (μs) at which it started
+	int16_t temp;							// Temperature (degrees C * 256)
+	boolean tempPending;					// Whether a background temperature read has been started
+	int16_t tempReading;					// The last temperature read (degrees C * 256)
+	int16_t tempPrev;						// The one before it
+	uint32_t tempTime;						// topTime when tempReading was taken (μs)
+	uint32_t tempSpan;						// Time from tempPrev to tempReading (ms); 0 if there's no trend to follow
+	uint16_t tempInterval;					// Time between temperature samples (s; 0 = every beat)
+	byte tempState;							// Temperature sampling state: TEMP_IDLE, TEMP_TRIGGER or TEMP_READ
+	EscapementSensor *sensor;				// Where the temperature comes from
+	TMP102Sensor tmp102;					// The default sensor
+	boolean tempOneShot;					// Whether the sensor converts only when triggered
+	uint32_t tempTriggerTime;				// Real-time clock time (μs) at which it was last triggered
+	boolean tempPresent;					// Whether there was a temperature sensor at enable() time
+	byte tempFails;							// Consecutive failed temperature readings (saturating)
+	uint32_t tempTryTime;					// topTime when the temperature was last read, successfully or not (μs)
+	uint32_t tempFailTime;					// topTime of the first of the failed readings (μs)
+	boolean tempExpired;					// Whether they've been failing for longer than tempHold (latched, since 
+											//   topTime - tempFailTime wraps after 71.6 minutes)
+	uint16_t tempHold;						// How long the last good temperature is held while readings fail (s)
+	int16_t rodTemp;						// The pendulum's temperature: temp through the thermal lag filter
+	float rodFilt;							// The filter's state (degrees C * 256)
+	int16_t tempRate;						// The temperature's smoothed rate of change (degrees C * 256 per hour)
+	float rateFilt;							// The smoothing filter's state (degrees C * 256)
+	rateFit_t rate;							// Fit for the model's rate-of-change term
+	lagCandidate_t lag[LAG_CANDIDATES];		// Thermal lag estimator: the candidate lags
+	int32_t lagRefDt;						// The first sample's total beat duration (μs)
+	float lagMeanY;							// The mean of the samples' beat durations, less lagRefDt / LAG_BLOCK (μs)
+	float lagSyy;							// The sum of the squares of their deviations from it
+	uint16_t lagBlocks;						// Number of samples (saturating)
+	byte lagBeats;							// Beats in the current block
+	int32_t lagSumDt;						// The sum of their measured durations (μs)
+	int32_t lagSumTemp;						// And of their temperatures (degrees C * 256)
+	int32_t lagSumRod;						// And of their pendulum temperatures (degrees C * 256)
+	int32_t lagSumRate;						// And of the temperature's rates of change (degrees C * 256 per hour)
+	uint32_t lagTime;						// topTime at the start of the block (μs)
+	int32_t tickLength;						// Duration of last tick (μs)
+	int32_t tockLength;						// Duration of last tock (μs)
+	uint32_t topTime;						// Real-time clock time (μs) at time magnet passed over coil
+	uint32_t lastTime;						// topTime last time through beat()
+	int32_t deltaT;							// Holds length of last beat (μs)
+	int32_t yIntercept;						// Linear model of beat duration as a function of temp: y intercept
+	int32_t slope;							// Linear model of beat duration as a function of temp: slope * 4096
+	int32_t modelKnots[TEMP_STEPS_MAX];		// The model in use: its beat duration at each bucket's temp (μs * 16)
+	byte modelOrder;						// Its order: MODEL_LINEAR, MODEL_QUADRATIC or MODEL_PIECEWISE
+	byte modelChoice;						// The order asked for by setModelOrder(), or MODEL_AUTO
+	int16_t tempIx;							// Which "bucket" of temps we're dealing with currently
+	int8_t rangeMin;						// The temp range asked for by setTempRange(): the 0th bucket's temp (C),
+	byte rangeSteps;						//   the number of buckets
+	byte rangeRes;							//   and the number to a degree C
+	boolean rangeSet;						// Whether setTempRange() has been called
+	uint16_t lagChoice;						// The thermal lag given to setTempLag() before enable() (s)
+	boolean lagSet;							// Whether setTempLag() was called before enable()
 	boolean tick;							// Whether currently awaiting a tick or a tock
 	byte runMode;							// Run mode -- SETTLING, CALIBRATING or RUNNING
+	uint16_t checkpointBeats;				// COLLECT beats between checkpoints of partial progress (0 = no limit)
+	uint16_t checkpointMinutes;				// COLLECT minutes between checkpoints of partial progress (0 = no limit)
+	uint16_t beatsSinceCheckpoint;			// COLLECT beats since the last checkpoint
+	uint32_t msSinceCheckpoint;				// COLLECT time (ms) since the last checkpoint
+	uint32_t dirtyBuckets;					// Bit i set if bucket i changed since last written (TEMP_STEPS_MAX <= 32)
+	int16_t uspbRem[TEMP_STEPS_MAX];		// Remainder carried by each bucket's running average (not persistent)
+	byte slot;								// The copy in the store that's the latest good one, if there is one
+	uint32_t lastDirty;						// Bit i set if bucket i of the other copy may differ from it
+	beatStats_t stats;						// Hot-path counters
+	byte gateSigmas;						// Acceptance gate width in sigmas (0 = no gate)
+	uint32_t gateVar;						// Smoothed square of the accepted beats' prediction errors (μs^2)
+	byte gateRejects;						// Consecutive beats the gate has rejected
 // Utility methods
-	int readTemp();							// Read TMP102, return temp in degrees C * 256 or NO_TEMP if unable to read
+	void init(EscapementHAL *h, byte sPin, byte kPin);
+											// Common part of the constructors
+	int16_t readTemp();						// Read the sensor, return temp in degrees C * 256 or NO_TEMP if unable to
+	void configureTemp();					// Set the sensor up for tempInterval
+	void startTemp();						// Trigger or start reading the sensor in the background, if it's time
+	int16_t updateTemp();					// Take in a finished reading and return the temp, NO_TEMP if it failed
+	void lagTemp(int32_t us);				// Put temp through the thermal lag filter for a beat us μs long
+	void resetLag();						// Start the thermal lag estimator over
+	void sampleLag();						// Add the beat to the thermal lag estimator
+	boolean estimateLag();					// Estimate the thermal lag; true if it changed
+	void rateTemp(int32_t us);				// Update tempRate for a beat us μs long
+	void resetRate();						// Drop the rate-of-change term and start fitting it over
+	void fixLag(unsigned int seconds);		// Fix the thermal lag (TEMP_LAG_AUTO to estimate it)
+	boolean estimateRate();					// Fit the rate-of-change term; true if it changed
+	inline unsigned int readCoil();			// Read the coil voltage, capturing it if capturing
+	void makeModel();						// Choose the model's order and work out modelKnots
+	byte bestOrder();						// Find the order that best predicts each completed bucket from the others
+	int32_t modelUspb();					// Get the beat duration the model gives now (μs)
 	int getTempIx(int t);					// Get the temperature index for temperature t, t in degrees C * 256
-	boolean readEEPROM();					// Read EEPROM into instance variables
-	void writeEEPROM();						// Write EEPROM from instance variables
+	byte beatsSpanned();					// Get the number of beats deltaT covers; 1 unless passes were missed
+	boolean isOutlier();					// Check deltaT against the acceptance gate, learning from it if it passes
+	int32_t getUspb(int ix);				// Decode the average μs per beat for bucket ix from the calibration table
+	void setUspb(int ix, int32_t uspb);		// Encode uspb as the average μs per beat for bucket ix
+	void clearTable();						// Empty the calibration table
+	void remapBuckets(int8_t tempMin, byte steps, byte res);
+											// Change the temp range, keeping the buckets the old and new share
+	boolean readEEPROM();					// Read persistent parameters from the store into instance variables
+	void writeEEPROM();						// Write persistent parameters from instance variables to the store
+	void checkpointEEPROM();				// Write only the header and changed buckets to the store
+	void findSlot();						// Find the latest good copy of the persistent parameters in the store
+	boolean slotValid(byte s, uint16_t *seq);
+											// Whether copy s in the store is good; its sequence number
+	void checkTable();						// Make any sample counts that can't be right harmless
+	boolean storeRead(unsigned int addr, void *buf, unsigned int len);
+											// Read from the store, counting a failure
+	boolean storeWrite(unsigned int addr, const void *buf, unsigned int len);
+											// Write to the store, counting a failure
+	void switchMode(byte mode);				// Switch run mode (setRunMode() without recording)
+	void record(byte type, int32_t value = 0, int32_t aux = 0);
+											// Report an event to the recorder, if any
 
 public:
 // Constructors
 	Escapement(byte sensePin = A2, byte kickPin = 12);  // Escapement on specified sense and kick pins
+	Escapement(EscapementHAL *hal, byte sensePin = A2, byte kickPin = 12);
+											// Escapement on specified hardware, sense and kick pins
 // Operational methods
+	void setStore(EscapementStore *s);		// Use s to keep persistent parameters; call before enable()
+	boolean setTempRange(int minC, int maxC, byte res = TEMP_RES);
+											// Calibrate from minC to maxC C, res buckets to a degree; call before 
+											//   enable(); false if that's more than TEMP_STEPS_MAX buckets
+	void setRecorder(EscapementRecorder *r);// Report inputs and outputs to r for replay; call before enable()
+	void setTempSensor(EscapementSensor *s);// Read the temperature from s; call before enable()
+	void setWaveCapture(uint16_t *buf, unsigned int size);
+											// Capture coil readings around each pass in buf (NULL to stop)
 	void enable(byte initialMode = RUN);	// Do initialization of Escapement that needs to be done in sketch startup()
 	long beat();							// Do one beat (half a cycle) return  length of a beat in μs
 // Getters and setters
@@ -101,6 +384,7 @@ public:
 	void setBias(long factor);				// Set Arduino clock correction in tenths of a second per day
 	long incrBias(long factor);				// Increment Arduino clock correction by factor tenths of a second per day
 	float getTemp();						// Get the current temperature in C; -1 if none
+	float getRodTemp();						// Get the current temperature through the thermal lag filter in C
 	boolean isTick();						// True if the last beat was a "tick" false if it was a "tock"
 	boolean isTempComp();					// True if temperature compensated
 	float getBpmModel();					// Get the beats per minute as modeled
@@ -114,8 +398,26 @@ public:
 	long incrSpeedAdj(long incr);			// Increment manual adjustment by incr tenths of a second per day, return new value
 	float getM();							// Get slope of linear least squares model
 	long getB();							// Get yIntercept of linear least squares model
+	void setModelOrder(byte order);			// Set the model order (MODEL_AUTO to choose by fit)
+	byte getModelOrder();					// Get the order of the model in use
+	float getRateM();						// Get the model's rate-of-change term (μs per degree C per hour)
+	float getTempRate();					// Get the temperature's smoothed rate of change (degrees C per hour)
 	byte getRunMode();						// Get the current run mode -- SETTLING, CALIBRATING or RUNNING
 	void setRunMode(byte mode);				// Set the run mode
+	void setCheckpointInterval(unsigned int beats, unsigned int minutes = 0);
+											// Set how often partial COLLECT progress is checkpointed (0 = no limit)
+	void setGate(byte sigmas);				// Set the acceptance gate width in sigmas (0 = no gate)
+	void setTempInterval(unsigned int seconds);
+											// Set the time between temperature samples (0 = every beat)
+	void requestTemp();						// Take a temperature sample as soon as possible
+	void setTempHold(unsigned int seconds);	// Set how long the last good temperature is held while readings fail
+	void setTempLag(unsigned int seconds);	// Set the thermal lag time constant (TEMP_LAG_AUTO to estimate it)
+	unsigned int getTempLag();				// Get the thermal lag time constant (s)
+	int getTempMin();						// Get the temp of the lowest calibration bucket (degrees C)
+	float getTempMax();						// Get the temp of the highest calibration bucket (degrees C)
+	byte getTempRes();						// Get the number of calibration buckets to a degree C
+	const beatStats_t &getStats();			// Get the hot-path counters
+	void resetStats();						// Zero the hot-path counters
 };
 
 #endif
\ No newline at end of file
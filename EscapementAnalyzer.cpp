@@ -0,0 +1,137 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementAnalyzer.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See EscapementAnalyzer.h for description.
+ *
+ ****/
+
+#include "EscapementAnalyzer.h"
+#include <math.h>
+#include <string.h>
+
+BeatAnalyzer::BeatAnalyzer(uint16_t binUs, EscapementRecorder *nextRecorder) {
+	next = nextRecorder;
+	binWidth = binUs == 0 ? 1 : binUs;
+	bias = 0;
+	reset();
+}
+
+void BeatAnalyzer::reset() {
+	memset(bins, 0, sizeof(bins));
+	residuals = 0;
+	residualMean = residualSq = 0.0;
+	chained = false;
+	tick = true;
+	historyIx = historyLen = 0;
+	for (byte i = 0; i < ADEV_TAUS; i++) {
+		adevCount[i] = 0;
+		adevMean[i] = 0.0;
+	}
+	period = 0.0;
+}
+
+void BeatAnalyzer::record(const beatRecord_t &r) {
+	switch (r.type) {
+		case REC_ENABLE:						// A new start; the beat before it has nothing to do with what follows
+			chained = false;
+			break;
+		case REC_BIAS:
+			bias = r.value;
+			break;
+		case REC_BEAT:
+			if (r.value == 0 && chained && period != 0.0 && r.time - lastTime < period * 0.4375) {
+				break;							// A spurious pass the acceptance gate caught: ignore it
+			}
+			if (r.value == 0 || (chained && period != 0.0 && r.time - lastTime > period * 0.75)) {
+												// The first beat, a rejected one or a gap: start over
+				historyLen = 0;
+				tick = true;
+			} else if (chained) {
+				if (r.model != 0) {				// Residual: the measured duration less the model's prediction
+					int32_t residual = escBiasCorrect(r.time - lastTime, bias) - r.model;
+					int32_t ix = (residual >= 0 ? residual / binWidth : -((binWidth - 1 - residual) / binWidth)) + 
+						JITTER_BINS / 2;		// Round toward minus infinity
+					bins[ix < 0 ? 0 : ix >= JITTER_BINS ? JITTER_BINS - 1 : ix]++;
+					residuals++;
+					residualMean += (residual - residualMean) / residuals;
+					residualSq += ((float)residual * residual - residualSq) / residuals;
+				}
+			}
+			if (tick) sample(r.time);
+			tick = !tick;
+			lastTime = r.time;
+			chained = true;
+			break;
+	}
+	if (next != NULL) next->record(r);
+}
+
+void BeatAnalyzer::recordSettings(const void *buf, unsigned int len) {
+	if (len == sizeof(settings_t)) {
+		settings_t s;
+		memcpy(&s, buf, len);
+		bias = s.bias;
+	}
+	if (next != NULL) next->recordSettings(buf, len);
+}
+
+void BeatAnalyzer::recordWave(const waveRecord_t &w) {
+	if (next != NULL) next->recordWave(w);
+}
+
+// Add topTime sample t, taken a period after the last, and update the Allan deviation accumulators. With x the
+// samples, the term for averaging time m periods is (x[k] - 2 x[k - m] + x[k - 2m])^2; the differences are taken
+// in uint32_t so micros() wrapping around doesn't matter.
+void BeatAnalyzer::sample(uint32_t t) {
+	history[historyIx] = t;
+	if (historyLen < ADEV_HISTORY) historyLen++;
+	for (byte i = 0; i < ADEV_TAUS; i++) {
+		byte m = 1 << i;
+		if (historyLen <= 2 * m) break;
+		uint32_t x1 = history[(historyIx + ADEV_HISTORY - m) % ADEV_HISTORY];
+		uint32_t x2 = history[(historyIx + ADEV_HISTORY - 2 * m) % ADEV_HISTORY];
+		float d = (int32_t)((t - x1) - (x1 - x2));
+		adevCount[i]++;
+		adevMean[i] += (d * d - adevMean[i]) / adevCount[i];
+		if (i == 0) period += ((float)(t - x1) - period) / adevCount[0];
+	}
+	if (++historyIx == ADEV_HISTORY) historyIx = 0;
+}
+
+/*
+ *
+ * Getters
+ *
+ */
+
+uint32_t BeatAnalyzer::getBin(byte i) {
+	return i < JITTER_BINS ? bins[i] : 0;
+}
+uint16_t BeatAnalyzer::getBinWidth() {
+	return binWidth;
+}
+uint32_t BeatAnalyzer::getResidualCount() {
+	return residuals;
+}
+float BeatAnalyzer::getResidualMean() {
+	return residualMean;
+}
+float BeatAnalyzer::getResidualRms() {
+	return sqrt(residualSq);
+}
+float BeatAnalyzer::getTau(byte i) {
+	if (i >= ADEV_TAUS) return 0.0;
+	return (1 << i) * period / 1e6;
+}
+float BeatAnalyzer::getAdev(byte i) {
+	if (i >= ADEV_TAUS || adevCount[i] == 0 || period == 0.0) return 0.0;
+	return sqrt(adevMean[i] / 2.0) / ((1 << i) * period) * 1e6;
+}
+uint32_t BeatAnalyzer::getAdevCount(byte i) {
+	return i < ADEV_TAUS ? adevCount[i] : 0;
+}
@@ -0,0 +1,79 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementAnalyzer.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   On-device figures of merit for the clock, kept incrementally in fixed memory so that they don't need every beat 
+ *   shipped to a host. A BeatAnalyzer is an EscapementRecorder: give it to setRecorder() and it watches the beats 
+ *   go by, passing everything on to another recorder if it was given one. It keeps:
+ *
+ *     A histogram of the beat timing residuals: each beat's duration as measured by the (corrected) real-time 
+ *     clock, less what the model predicted for it, the prediction in its REC_BEAT record (see 
+ *     EscapementRecorder.h). That is the model RUN uses, with the thermal lag, rate-of-change term and speed 
+ *     adjustment, so in RUN the mean residual is the clock's rate error. Beats without a prediction aren't 
+ *     counted. There are JITTER_BINS bins of a width given to the constructor, centered on zero; the end bins 
+ *     also count everything beyond them. A pendulum's tick and tock usually differ, so expect the 
+ *     residuals to cluster around plus and minus half the difference.
+ *
+ *     The overlapping Allan deviation of the pendulum's period at ADEV_TAUS averaging times of 1, 2, 4, ... 
+ *     periods. It is computed from topTime, sampled once a period (every other beat) so that the tick/tock 
+ *     asymmetry doesn't show up as noise, using the last 2 * 2^(ADEV_TAUS - 1) + 1 samples. A rejected beat, 
+ *     or one that spans passes beat() missed, starts the sampling over and doesn't count as a residual. A 
+ *     spurious pass the acceptance gate rejected (see Escapement.cpp) is ignored.
+ *
+ *   The histogram and Allan deviation use about 350 bytes of RAM, and updating them takes a few float operations 
+ *   a beat.
+ *
+ ****/
+
+#ifndef EscapementAnalyzer_H
+#define EscapementAnalyzer_H
+
+#include "Escapement.h"
+
+#define JITTER_BINS		(32)				// Number of residual histogram bins
+#define JITTER_BIN_US	(250)				// Default residual histogram bin width (μs)
+#define ADEV_TAUS		(5)					// Number of Allan deviation averaging times, 1, 2, 4, ... periods
+#define ADEV_HISTORY	((2 << (ADEV_TAUS - 1)) + 1)
+											// Once-a-period topTime samples kept for the Allan deviation
+
+class BeatAnalyzer : public EscapementRecorder {
+private:
+	EscapementRecorder *next;				// Where records are passed on to, if anywhere
+	uint16_t binWidth;						// Residual histogram bin width (μs)
+	uint32_t bins[JITTER_BINS];				// Residual histogram
+	uint32_t residuals;						// Number of residuals counted
+	float residualMean;						// Their mean (μs)
+	float residualSq;						// The mean of their squares (μs^2)
+	int16_t bias;							// Real-time clock correction in effect (tenths of a second per day)
+	uint32_t lastTime;						// topTime of the last beat
+	boolean chained;						// Whether lastTime is the start of the current beat
+	boolean tick;							// Whether the current beat's topTime is sampled
+	uint32_t history[ADEV_HISTORY];			// Ring of once-a-period topTime samples
+	byte historyIx;							// Where the next sample goes in history
+	byte historyLen;						// How many samples history holds
+	uint32_t adevCount[ADEV_TAUS];			// Number of second differences averaged for each averaging time
+	float adevMean[ADEV_TAUS];				// The mean of their squares (μs^2)
+	float period;							// Mean period (μs)
+	void sample(uint32_t t);				// Add a once-a-period topTime sample
+public:
+	BeatAnalyzer(uint16_t binUs = JITTER_BIN_US, EscapementRecorder *nextRecorder = NULL);
+	void record(const beatRecord_t &r);
+	void recordSettings(const void *buf, unsigned int len);
+	void recordWave(const waveRecord_t &w);
+	void reset();							// Forget everything but the bias
+	uint32_t getBin(byte i);				// Get the count in bin i; bin i holds residuals from (i - JITTER_BINS/2)
+											//   to (i - JITTER_BINS/2 + 1) bin widths
+	uint16_t getBinWidth();					// Get the bin width (μs)
+	uint32_t getResidualCount();			// Get the number of residuals counted
+	float getResidualMean();				// Get their mean (μs)
+	float getResidualRms();					// Get their root mean square (μs)
+	float getTau(byte i);					// Get the i-th Allan deviation averaging time (s); 0 until known
+	float getAdev(byte i);					// Get the Allan deviation at the i-th averaging time (ppm); 0 until known
+	uint32_t getAdevCount(byte i);			// Get the number of terms the i-th Allan deviation averages
+};
+
+#endif
@@ -0,0 +1,209 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementHAL.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See EscapementHAL.h for description.
+ *
+ ****/
+
+#include "EscapementHAL.h"
+
+/*
+ *
+ * EscapementHAL defaults
+ *
+ */
+
+// Do the whole read now
+boolean EscapementHAL::i2cStartRead(byte addr, byte len) {
+	if (len > I2C_ASYNC_MAX) return false;
+	asyncLen = i2cRead(addr, asyncBuf, len);
+	return true;
+}
+
+byte EscapementHAL::i2cCollect(byte *buf, byte len) {
+	byte n = asyncLen < len ? asyncLen : len;
+	for (byte i = 0; i < n; i++) {
+		buf[i] = asyncBuf[i];
+	}
+	asyncLen = 0;
+	return n;
+}
+
+#if defined(ARDUINO)
+
+#include <Wire.h>       // Use the Wire library to talk to I2C devices like the TMP102 temperature sensor
+
+// Constructed on first use, so an Escapement constructed as a global (in whatever order) gets a whole one
+EscapementHAL *EscapementHAL::getDefault() {
+	static ArduinoHAL defaultHAL;
+	return &defaultHAL;
+}
+
+/*
+ *
+ * ArduinoHAL
+ *
+ */
+
+void ArduinoHAL::adcBegin() {
+	analogReference(EXTERNAL);				// We have an external reference, a 47k+47k voltage divider between
+											//   3.3V and ground
+}
+
+unsigned int ArduinoHAL::adcRead(byte pin) {
+	return analogRead(pin);
+}
+
+uint32_t ArduinoHAL::micros() {
+	return ::micros();
+}
+
+// Carry any background read along while waiting, then wait out the rest
+void ArduinoHAL::delay(uint32_t ms) {
+#if defined(TWI_AVAILABLE)
+	uint32_t start = ::micros();
+	while (twi.busy(::micros()) && ::micros() - start < ms * 1000UL);
+	uint32_t spent = (::micros() - start) / 1000;
+	ms = spent < ms ? ms - spent : 0;
+#endif
+	::delay(ms);
+}
+
+void ArduinoHAL::pinMode(byte pin, byte mode) {
+	::pinMode(pin, mode);
+}
+
+void ArduinoHAL::digitalWrite(byte pin, byte value) {
+	::digitalWrite(pin, value);
+}
+
+void ArduinoHAL::i2cBegin() {
+	Wire.begin();							// Wire is still there for FRAMStore (and the sketch)
+#if defined(TWI_AVAILABLE)
+	twi.begin();
+#endif
+}
+
+byte ArduinoHAL::i2cRead(byte addr, byte *buf, byte len) {
+#if defined(TWI_AVAILABLE)
+	while (twi.busy(::micros()));			// Let a background read finish first
+	return twi.read(addr, buf, len);
+#else
+	byte n = Wire.requestFrom(addr, len);
+	for (byte i = 0; i < n; i++) {
+		buf[i] = Wire.read();
+	}
+	return n;
+#endif
+}
+
+boolean ArduinoHAL::i2cWrite(byte addr, const byte *buf, byte len) {
+#if defined(TWI_AVAILABLE)
+	while (twi.busy(::micros()));
+	return twi.write(addr, buf, len);
+#else
+	Wire.beginTransmission(addr);
+	Wire.write(buf, len);
+	return Wire.endTransmission() == 0;
+#endif
+}
+
+#if defined(TWI_AVAILABLE)
+// Read in the background with EscapementTWI. busy() and delay() take the read along.
+boolean ArduinoHAL::i2cStartRead(byte addr, byte len) {
+	while (twi.busy(::micros()));			// One at a time
+	return twi.startRead(addr, len, ::micros());
+}
+
+boolean ArduinoHAL::i2cBusy() {
+	return twi.busy(::micros());
+}
+
+byte ArduinoHAL::i2cCollect(byte *buf, byte len) {
+	return twi.collect(buf, len);
+}
+#endif
+
+EscapementStore *ArduinoHAL::store() {
+#if defined(__AVR__)
+	return &eepromStore;
+#else
+	return &framStore;
+#endif
+}
+
+#elif !defined(__AVR__)
+
+#include <time.h>
+#include <string.h>
+
+// Constructed on first use, so an Escapement constructed as a global (in whatever order) gets a whole one
+EscapementHAL *EscapementHAL::getDefault() {
+	static HostHAL defaultHAL;
+	return &defaultHAL;
+}
+
+/*
+ *
+ * HostHAL
+ *
+ */
+
+// Host monotonic clock in μs
+static uint64_t hostMicros() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+HostHAL::HostHAL() {
+	epoch = hostMicros();
+	adcValue = 0;
+	memset(pinModes, INPUT, sizeof(pinModes));
+	memset(pinValues, LOW, sizeof(pinValues));
+}
+
+unsigned int HostHAL::adcRead(byte pin) {
+	(void)pin;								// Every pin reads the same
+	return adcValue;
+}
+
+uint32_t HostHAL::micros() {
+	return (uint32_t)(hostMicros() - epoch);
+}
+
+void HostHAL::delay(uint32_t ms) {
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+}
+
+void HostHAL::pinMode(byte pin, byte mode) {
+	if (pin < HAL_PINS) pinModes[pin] = mode;
+}
+
+void HostHAL::digitalWrite(byte pin, byte value) {
+	if (pin < HAL_PINS) pinValues[pin] = value;
+}
+
+byte HostHAL::i2cRead(byte addr, byte *buf, byte len) {
+	(void)addr; (void)buf; (void)len;
+	return 0;								// Nobody home
+}
+
+boolean HostHAL::i2cWrite(byte addr, const byte *buf, byte len) {
+	(void)addr; (void)buf; (void)len;		// Nobody home
+	return false;
+}
+
+EscapementStore *HostHAL::store() {
+	return &ramStore;
+}
+
+#endif
@@ -0,0 +1,187 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementHAL.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Hardware abstraction layer for the Escapement. Everything the Escapement needs from the hardware -- the ADC it 
+ *   senses the passing magnet with, the microsecond timebase and delays, the GPIO pin it kicks with, the I2C bus 
+ *   the temperature sensor is on and the store for its persistent parameters -- it gets through an EscapementHAL. 
+ *   There are two implementations:
+ *
+ *     ArduinoHAL    The real thing: analogRead(), micros(), delay(), pinMode(), digitalWrite(), I2C and a store. 
+ *                   Used by default in Arduino builds. On AVRs, I2C goes through EscapementTWI, which can't hang on 
+ *                   a stuck bus the way Wire can, and the store is the internal EEPROM. Elsewhere, I2C goes through 
+ *                   Wire, and since there's no EEPROM the library can count on, the store is an FRAMStore at 
+ *                   FRAM_ADDRESS; without the chip, the store fails (see getStats()) and nothing persists unless 
+ *                   setStore() gives the Escapement another.
+ *     HostHAL       For building and running on a Linux (or other POSIX) host under g++. The timebase is the host's 
+ *                   monotonic clock, the ADC returns adcValue, the GPIO pins just remember their state, there are no 
+ *                   I2C devices, and the persistent parameters are kept in RAM. Used by default in host builds. 
+ *                   Override its methods to simulate hardware.
+ *
+ *   Besides the blocking i2cRead(), a HAL can read an I2C device in the background: i2cStartRead() starts the 
+ *   transfer and returns, i2cBusy() says whether it's still going, and i2cCollect() picks up the result. beat() 
+ *   uses this to read the temperature during its settle delay rather than after the kick. The default does the 
+ *   whole transfer in i2cStartRead() with i2cRead(), blocking; beat() takes the time that takes out of the settle 
+ *   delay, so HALs that can't do better needn't do anything. On AVRs, ArduinoHAL really does read in the 
+ *   background, with EscapementTWI, and its delay() carries the read along while it waits. 
+ *
+ *   On the host, this header also supplies the handful of Arduino types and constants the library uses. On an AVR 
+ *   built without the Arduino core (as the simavr benchmarks in extras/bench/avr are) there is no default HAL; pass 
+ *   one to the Escapement's constructor.
+ *
+ *   The header also defines the library's probe points. When the library is built for an AVR with 
+ *   ESCAPEMENT_PROBES defined, each probe point writes its id to the GPIOR0 register -- a single-cycle "out" 
+ *   instruction -- so a simulator watching GPIOR0 can count the cycles spent between them. Otherwise the probe 
+ *   points compile to nothing.
+ *
+ ****/
+
+#ifndef EscapementHAL_H
+#define EscapementHAL_H
+
+#if defined(ARDUINO)
+  #if ARDUINO >= 100
+    #include <Arduino.h>  // Arduino 1.0
+  #else
+    #include <WProgram.h> // Arduino 0022
+  #endif
+#else
+  #include <stdint.h>
+  #include <stdlib.h>
+  #include <stddef.h>
+  typedef uint8_t byte;
+  typedef bool boolean;
+  #define INPUT			(0x0)
+  #define OUTPUT		(0x1)
+  #define LOW			(0x0)
+  #define HIGH			(0x1)
+  #define EXTERNAL		(0)
+  #define A2			(16)
+  #define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#endif
+
+#include "EscapementStore.h"
+#include "EscapementTWI.h"
+
+// Probe point ids
+#define PROBE_BEAT_START	(0x01)			// beat() entered
+#define PROBE_DETECTED		(0x02)			// Passing magnet detected
+#define PROBE_PROCESS		(0x03)			// Kick done; timing math and state machine starting
+#define PROBE_BEAT_END		(0x04)			// beat() returning
+#define PROBE_TEMP_START	(0x05)			// Temperature read starting
+#define PROBE_TEMP_END		(0x06)			// Temperature read done
+#define PROBE_STORE_START	(0x07)			// Write to persistent store starting
+#define PROBE_STORE_END		(0x08)			// Write to persistent store done
+#define PROBE_MODE			(0x10)			// Or'ed with runMode: the state machine path being taken
+#define PROBE_USER			(0x80)			// Ids from here up are for the sketch or test harness
+
+#if defined(ESCAPEMENT_PROBES) && defined(__AVR__)
+  #include <avr/io.h>
+  #define ESCAPEMENT_PROBE(id)	(GPIOR0 = (id))
+#else
+  #define ESCAPEMENT_PROBE(id)
+#endif
+
+#define HAL_PINS		(32)				// Number of pins whose state HostHAL keeps track of
+#define I2C_ASYNC_MAX	(4)					// Most bytes a background I2C read can get
+
+class EscapementHAL {
+protected:
+	byte asyncBuf[I2C_ASYNC_MAX];			// What the default i2cStartRead() read
+	byte asyncLen;							// How many bytes that was
+public:
+	EscapementHAL() {
+		asyncLen = 0;
+	}
+// ADC
+	virtual void adcBegin() {}				// Get the ADC ready
+	virtual unsigned int adcRead(byte pin) = 0;
+											// Read the voltage on pin (0 - 1023)
+// Timebase
+	virtual uint32_t micros() = 0;			// Microseconds since some arbitrary starting point; wraps at 2^32
+	virtual void delay(uint32_t ms) = 0;	// Wait ms milliseconds
+// GPIO
+	virtual void pinMode(byte pin, byte mode) = 0;
+											// Set pin to INPUT or OUTPUT
+	virtual void digitalWrite(byte pin, byte value) = 0;
+											// Set an OUTPUT pin LOW or HIGH
+// I2C
+	virtual void i2cBegin() {}				// Get the I2C bus ready
+	virtual byte i2cRead(byte addr, byte *buf, byte len) = 0;
+											// Read up to len bytes from device addr into buf; return count read
+	virtual boolean i2cWrite(byte addr, const byte *buf, byte len) = 0;
+											// Write len bytes from buf to device addr; true if successful
+	virtual boolean i2cStartRead(byte addr, byte len);
+											// Start reading len (<= I2C_ASYNC_MAX) bytes from device addr in the
+											//   background; false if that can't be done now
+	virtual boolean i2cBusy() { return false; }
+											// True while a started read is still going
+	virtual byte i2cCollect(byte *buf, byte len);
+											// Copy up to len bytes the started read got into buf and return the
+											//   count; 0 if it failed, none was started, or it's still going
+// Storage
+	virtual EscapementStore *store() = 0;	// Where to keep persistent parameters unless told otherwise
+
+	static EscapementHAL *getDefault();		// The HAL for the platform we're built for
+};
+
+#if defined(ARDUINO)
+
+// The Arduino
+class ArduinoHAL : public EscapementHAL {
+private:
+#if defined(__AVR__)
+	EEPROMStore eepromStore;				// The internal EEPROM
+#else
+	FRAMStore framStore;					// No EEPROM to count on, so an FRAM chip at FRAM_ADDRESS
+#endif
+public:
+#if defined(TWI_AVAILABLE)
+	EscapementTWI twi;						// The I2C driver; see it for timeout and bus recovery counts
+#endif
+	void adcBegin();
+	unsigned int adcRead(byte pin);
+	uint32_t micros();
+	void delay(uint32_t ms);
+	void pinMode(byte pin, byte mode);
+	void digitalWrite(byte pin, byte value);
+	void i2cBegin();
+	byte i2cRead(byte addr, byte *buf, byte len);
+	boolean i2cWrite(byte addr, const byte *buf, byte len);
+#if defined(TWI_AVAILABLE)
+	boolean i2cStartRead(byte addr, byte len);
+	boolean i2cBusy();
+	byte i2cCollect(byte *buf, byte len);
+#endif
+	EscapementStore *store();
+};
+
+#elif !defined(__AVR__)
+
+// A POSIX host
+class HostHAL : public EscapementHAL {
+protected:
+	RAMStore ramStore;						// Persistent parameters, such as they are
+	uint64_t epoch;							// Host clock (μs) at construction
+public:
+	unsigned int adcValue;					// What adcRead() returns
+	byte pinModes[HAL_PINS];				// Mode of each pin
+	byte pinValues[HAL_PINS];				// Value of each pin
+	HostHAL();
+	unsigned int adcRead(byte pin);
+	uint32_t micros();
+	void delay(uint32_t ms);
+	void pinMode(byte pin, byte mode);
+	void digitalWrite(byte pin, byte value);
+	byte i2cRead(byte addr, byte *buf, byte len);
+	boolean i2cWrite(byte addr, const byte *buf, byte len);
+	EscapementStore *store();
+};
+
+#endif
+
+#endif
@@ -0,0 +1,172 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementMath.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   The arithmetic kernels of the Escapement's timing and calibration math, pulled out of Escapement.cpp so they 
+ *   can be measured on their own (see extras/bench/host) and so that alternative implementations can be compared 
+ *   against exactly what the library does. They depend only on their arguments.
+ *
+ *   Units are the library's: durations in μs, temperatures in degrees C * 256, clock corrections in tenths of a 
+ *   second per day, and model slopes in μs per (degree C * 256) times 4096.
+ *
+ ****/
+
+#ifndef EscapementMath_H
+#define EscapementMath_H
+
+#include <stdint.h>
+
+// Return deltaT (μs) corrected for a real-time clock that is off by bias tenths of a second per day, rounded (half 
+// away from zero). bias * deltaT only fits in 32 bits for a beat of up to 2.1 s with a bias under 100 s/day, the 
+// usual case; anything bigger -- a gap of several beats, a clock run off a ceramic resonator -- takes a 64-bit 
+// intermediate.
+static inline int32_t escBiasCorrect(int32_t deltaT, int16_t bias) {
+	if ((uint32_t)deltaT < 0x200000UL && bias > -1000 && bias < 1000) {
+		int32_t n = bias * deltaT;
+		return deltaT + (n + (n < 0 ? -432000L : 432000L)) / 864000L;
+	}
+	int64_t n = (int64_t)bias * deltaT;
+	return deltaT + (int32_t)((n + (n < 0 ? -432000L : 432000L)) / 864000L);
+}
+
+// Return log2 of the width (degrees C * 256) of a temperature bucket when there are res (1, 2 or 4) per degree C
+static inline int escTempShift(int res) {
+	return res == 4 ? 6 : res == 1 ? 8 : 7;
+}
+
+// Return the temperature (degrees C * 256) at the center of bucket ix of those starting at tempMin (degrees C), res 
+// to a degree C
+static inline int16_t escBucketTemp(int ix, int tempMin, int res) {
+	return ((int32_t)tempMin << 8) + ((int32_t)ix << escTempShift(res));
+}
+
+// Return the index of the temperature bucket that t is nearest, counting from tempMin (degrees C) with res buckets 
+// to a degree C, or -1 if that's not one of the steps buckets.
+static inline int escTempIx(int t, int tempMin, int steps, int res) {
+	int shift = escTempShift(res);
+	int32_t x = (int32_t)t - ((int32_t)tempMin << 8) + (1 << (shift - 1));	// From the 0th bucket's lower edge
+	if (x < 0) return -1;
+	x >>= shift;
+	return x < steps ? (int)x : -1;
+}
+
+// Return the running average avg updated with the n-th sample. *rem carries the remainder of the division from one 
+// update to the next, so avg + *rem / n stays the exact mean; it must be 0 at the first sample, and n no more than 
+// 32767. (Just truncating each update stops the average moving once n exceeds the samples' spread around it, which 
+// for a clock's ticks and tocks is a few ms: the average freezes wherever it was.)
+static inline int32_t escRunningAverage(int32_t avg, int32_t sample, uint16_t n, int16_t *rem) {
+	int32_t d = sample - avg + *rem;
+	*rem = d % (int32_t)n;
+	return avg + d / (int32_t)n;
+}
+
+// Fit a line by least squares to the average beat durations, uspbBase + uspbOffset[i], of the steps buckets
+// starting at tempMin (degrees C), res to a degree C, whose sampleCount[i] exceeds minSamples. Set *slope (* 4096) 
+// and *yIntercept and return the number of buckets used. If there are none, leave *slope and *yIntercept alone. 
+// With only one, the line is flat.
+static inline int escFitLinear(int32_t uspbBase, const int16_t uspbOffset[], const uint16_t sampleCount[],
+		int tempMin, int steps, int res, uint16_t minSamples, int32_t *slope, int32_t *yIntercept) {
+	float xSum = 0.0;
+	float ySum = 0.0;
+	float xxSum = 0.0;
+	float xySum = 0.0;
+	int count = 0;
+	for (int i = 0; i < steps; i++) {
+		if (sampleCount[i] > minSamples) {
+			float x = escBucketTemp(i, tempMin, res);
+			float y = uspbBase + uspbOffset[i];
+			count++;
+			xSum += x;
+			ySum += y;
+			xxSum += x * x;
+			xySum += x * y;
+		}
+	}
+	if (count > 0) {
+		*slope = count > 1 ? ((count * xySum - xSum * ySum) / (count * xxSum - xSum * xSum)) * 4096.0 : 0;
+		*yIntercept = (ySum - (*slope / 4096.0) * xSum) / count;
+	}
+	return count;
+}
+
+// Fit a polynomial of the given degree (0 to 2) by least squares to the bucket offsets y[i] of the steps buckets
+// whose n[i] exceeds minSamples, leaving out bucket skip (-1 to leave out none). The polynomial is in x = i -
+// (steps - 1) / 2, the bucket index centered so the sums stay small: y = c[0] + c[1] * x + c[2] * x * x. If there
+// aren't enough buckets for the degree, the degree is reduced; unused coefficients are 0. Return the number of
+// buckets used.
+static inline int escFitPoly(const int16_t y[], const uint16_t n[], int steps, uint16_t minSamples, int skip,
+		int degree, float c[3]) {
+	float s[5] = {0.0, 0.0, 0.0, 0.0, 0.0};	// Sums of x^k
+	float t[3] = {0.0, 0.0, 0.0};			// Sums of x^k * y
+	int count = 0;
+	for (int i = 0; i < steps; i++) {
+		if (i != skip && n[i] > minSamples) {
+			float x = i - (steps - 1) / 2.0;
+			float xk = 1.0;
+			count++;
+			for (int k = 0; k < 5; k++) {
+				if (k < 3) t[k] += xk * y[i];
+				s[k] += xk;
+				xk *= x;
+			}
+		}
+	}
+	if (degree > count - 1) degree = count - 1;
+	c[0] = c[1] = c[2] = 0.0;
+	if (degree == 0) {
+		c[0] = t[0] / s[0];
+	} else if (degree == 1) {
+		c[1] = (s[0] * t[1] - s[1] * t[0]) / (s[0] * s[2] - s[1] * s[1]);
+		c[0] = (t[0] - c[1] * s[1]) / s[0];
+	} else if (degree == 2) {				// Cramer's rule on the normal equations
+		float d = s[0] * (s[2] * s[4] - s[3] * s[3]) - s[1] * (s[1] * s[4] - s[2] * s[3]) +
+			s[2] * (s[1] * s[3] - s[2] * s[2]);
+		c[0] = (t[0] * (s[2] * s[4] - s[3] * s[3]) - s[1] * (t[1] * s[4] - s[3] * t[2]) +
+			s[2] * (t[1] * s[3] - s[2] * t[2])) / d;
+		c[1] = (s[0] * (t[1] * s[4] - s[3] * t[2]) - t[0] * (s[1] * s[4] - s[2] * s[3]) +
+			s[2] * (s[1] * t[2] - t[1] * s[2])) / d;
+		c[2] = (s[0] * (s[2] * t[2] - t[1] * s[3]) - s[1] * (s[1] * t[2] - t[1] * s[2]) +
+			t[0] * (s[1] * s[3] - s[2] * s[2])) / d;
+	}
+	return count;
+}
+
+// Return the beat duration (μs) the piecewise-linear model gives at temperature temp, with offset (μs) added and
+// adjusted by speedAdj as escModelUspb() does. knots[i] is the model's beat duration (μs * 16) at the temperature
+// of bucket i of the steps buckets starting at tempMin (degrees C), res to a degree C; in between it's 
+// interpolated, and beyond the end knots the end segments are extended.
+static inline int32_t escModelKnots(const int32_t knots[], int steps, int tempMin, int res, int16_t temp, 
+		int32_t offset, int32_t speedAdj) {
+	int shift = escTempShift(res);
+	int32_t x = temp - ((int32_t)tempMin << 8);
+	int32_t seg = x < 0 ? 0 : x >> shift;
+	if (seg > steps - 2) seg = steps < 2 ? 0 : steps - 2;
+	int32_t v = knots[seg];
+	if (steps > 1) {
+		int32_t d = (knots[seg + 1] - v) * (x - (seg << shift));
+		int32_t half = 1L << (shift - 1);
+		v += d < 0 ? -((half - d) >> shift) : (d + half) >> shift;
+	}
+	int32_t uspb = ((v + 8) >> 4) + offset;
+	return uspb + ((uspb / 864L) * speedAdj) / 1000L;
+}
+
+// Return the beat duration (μs) the linear model gives at temperature temp, adjusted by speedAdj tenths of a
+// second per day (deltaT * speedAdj / 864000 without large intermediate results)
+static inline int32_t escModelUspb(int32_t slope, int32_t yIntercept, int16_t temp, int32_t speedAdj) {
+	int32_t uspb = slope * temp / 4096L + yIntercept;
+	return uspb + ((uspb / 864L) * speedAdj) / 1000L;
+}
+
+// Return the change in beat duration (μs) the model's rate-of-change term, rateSlope (μs per (degree C * 256 per
+// hour) * 4096), gives for a temperature changing at rate degrees C * 256 per hour. Added to yIntercept. 
+// rateSlope * rate must fit in 32 bits, as it does for rateSlope within +/-65535.
+static inline int32_t escRateUspb(int32_t rateSlope, int16_t rate) {
+	return rateSlope * rate / 4096L;
+}
+
+#endif
@@ -0,0 +1,108 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementRecorder.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See EscapementRecorder.h for description.
+ *
+ ****/
+
+#include "EscapementRecorder.h"
+
+#if defined(ARDUINO)
+
+/*
+ *
+ * PrintRecorder
+ *
+ */
+
+PrintRecorder::PrintRecorder(Print &p) {
+	out = &p;
+}
+
+void PrintRecorder::record(const beatRecord_t &r) {
+	out->print(REC_TYPES[r.type]);
+	out->print(',');
+	out->print(r.time);
+	out->print(',');
+	out->print(r.temp);
+	out->print(',');
+	out->print(r.mode);
+	out->print(',');
+	out->print(r.value);
+	out->print(',');
+	out->print(r.aux);
+	out->print(',');
+	out->println(r.model);
+}
+
+void PrintRecorder::recordSettings(const void *buf, unsigned int len) {
+	const byte *b = (const byte *)buf;
+	out->print("S,");
+	for (unsigned int i = 0; i < len; i++) {
+		if (b[i] < 0x10) out->print('0');
+		out->print(b[i], HEX);
+	}
+	out->println();
+}
+
+void PrintRecorder::recordWave(const waveRecord_t &w) {
+	out->print("W,");
+	out->print(w.time);
+	out->print(',');
+	out->print(w.span);
+	out->print(',');
+	out->print(w.reads);
+	out->print(',');
+	out->print(w.len);
+	out->print(',');
+	for (unsigned int i = 0, ix = w.start; i < w.len; i++) {
+		if (i != 0) out->print(' ');
+		out->print(w.buf[ix]);
+		if (++ix == w.len) ix = 0;
+	}
+	out->println();
+}
+
+#endif
+
+#if !defined(__AVR__)
+
+/*
+ *
+ * FileRecorder
+ *
+ */
+
+FileRecorder::FileRecorder(FILE *f) {
+	out = f;
+}
+
+void FileRecorder::record(const beatRecord_t &r) {
+	fprintf(out, "%c,%lu,%d,%u,%ld,%ld,%ld\n", REC_TYPES[r.type], (unsigned long)r.time, r.temp, r.mode, 
+		(long)r.value, (long)r.aux, (long)r.model);
+}
+
+void FileRecorder::recordSettings(const void *buf, unsigned int len) {
+	const byte *b = (const byte *)buf;
+	fprintf(out, "S,");
+	for (unsigned int i = 0; i < len; i++) {
+		fprintf(out, "%02X", b[i]);
+	}
+	fprintf(out, "\n");
+}
+
+void FileRecorder::recordWave(const waveRecord_t &w) {
+	fprintf(out, "W,%lu,%lu,%lu,%u,", (unsigned long)w.time, (unsigned long)w.span, (unsigned long)w.reads, w.len);
+	for (unsigned int i = 0, ix = w.start; i < w.len; i++) {
+		fprintf(out, i == 0 ? "%u" : " %u", w.buf[ix]);
+		if (++ix == w.len) ix = 0;
+	}
+	fprintf(out, "\n");
+}
+
+#endif
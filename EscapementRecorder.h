@@ -0,0 +1,134 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementRecorder.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Recording an Escapement's inputs. Given an EscapementRecorder via setRecorder(), an Escapement reports 
+ *   everything that determines what it does: the persistent parameters it starts with, the temperature and mode 
+ *   at enable(), the real-time clock time and temperature reading of every beat, and the mode changes and clock 
+ *   adjustments the sketch makes between beats. It also reports its outputs -- each beat's duration and each new 
+ *   model -- so that a replay of the recording (see extras/replay) can be checked against them.
+ *
+ *   Each event is a beatRecord_t:
+ *
+ *     type        time        temp        mode          value             aux             model
+ *     REC_ENABLE  -           reading     initial mode  -                 temp range      -
+ *     REC_BEAT    topTime     reading     mode after    deltaT returned   bucket fill     prediction
+ *     REC_MODE    -           -           new mode      -                 -               -
+ *     REC_BIAS    -           -           -             new bias          -               -
+ *     REC_SPEED   -           -           -             new speedAdj      -               -
+ *     REC_MODEL   -           -           -             slope             yIntercept      -
+ *
+ *   The bucket fill is the sample count of the current temperature's calibration bucket (0 if there isn't one). 
+ *   The prediction is the beat duration (μs) the model gives for the beat, whatever the mode: what beat() returns 
+ *   in RUN, with the thermal lag, rate-of-change term and speed adjustment. It's 0 if there's no model yet, the 
+ *   temperature is outside the calibration range or the beat was rejected. 
+ *   The temp range is what was given to setTempRange(), if anything: res << 16 | steps << 8 | (byte)minC, with 
+ *   steps the number of buckets; 0 if setTempRange() wasn't called. 
+ *   The persistent parameters, if enable() found valid ones, go to recordSettings() just before REC_ENABLE.
+ *
+ *   If a waveform capture is on (see Escapement::setWaveCapture()), the ADC readings leading up to each detection 
+ *   go to recordWave(), just before the beat's REC_BEAT, as a waveRecord_t. The readings are the ones beat() 
+ *   averages in groups of N_SAMPLES, oldest first, and the last one is the one that completed detection.
+ *
+ *   Two recorders are provided. Both write one line of text per event: the type letter (E, B, M, R, A or L) and 
+ *   then time, temp, mode, value, aux and model as decimal numbers, separated by commas. The settings are "S," and 
+ *   then the bytes in hex. A waveform is "W," then time, span, reads and the number of samples, separated by 
+ *   commas, and then a comma and the samples separated by spaces.
+ *
+ *     PrintRecorder  Writes to any Arduino Print, such as Serial or an SD card File. Only in Arduino builds. A beat 
+ *                    line is around 40 characters, which at 9600 baud takes about 40 ms to send. A waveform of a few 
+ *                    hundred samples is a kilobyte or so; use a fast serial rate.
+ *     FileRecorder   Writes to a stdio FILE. Only in host builds.
+ *
+ ****/
+
+#ifndef EscapementRecorder_H
+#define EscapementRecorder_H
+
+#if defined(ARDUINO)
+  #if ARDUINO >= 100
+    #include <Arduino.h>  // Arduino 1.0
+  #else
+    #include <WProgram.h> // Arduino 0022
+  #endif
+#else
+  #include <stdint.h>
+  typedef uint8_t byte;
+#endif
+#if !defined(__AVR__)
+  #include <stdio.h>
+#endif
+
+// Record types
+#define REC_ENABLE		(0)					// enable() was called
+#define REC_BEAT		(1)					// beat() returned
+#define REC_MODE		(2)					// The sketch changed the run mode
+#define REC_BIAS		(3)					// The sketch changed the real-time clock correction
+#define REC_SPEED		(4)					// The sketch changed the speed adjustment
+#define REC_MODEL		(5)					// A new model was calculated
+#define REC_TYPES		"EBMRAL"			// Letters for the record types in text recordings
+
+struct beatRecord_t {
+	byte type;								// REC_ENABLE .. REC_MODEL
+	byte mode;								// Run mode
+	int16_t temp;							// Temperature reading (degrees C * 256) or NO_TEMP
+	uint32_t time;							// Real-time clock time (μs)
+	int32_t value;							// Depends on type
+	int32_t aux;							// Depends on type
+	int32_t model;							// REC_BEAT: the model's prediction (μs) or 0; otherwise 0
+};
+
+struct waveRecord_t {
+	uint32_t time;							// Real-time clock time (μs) of the detection: topTime
+	uint32_t span;							// Time (μs) from the first of the readings to detection
+	uint32_t reads;							// How many readings were taken in that time
+	const uint16_t *buf;					// The capture buffer, a ring holding the last len readings
+	uint16_t len;							// Number of readings captured, at most the size of the buffer
+	uint16_t start;							// Index in buf of the oldest reading
+};
+
+class EscapementRecorder {
+public:
+	virtual void record(const beatRecord_t &r) = 0;
+											// Record r
+	virtual void recordSettings(const void *buf, unsigned int len) { (void)buf; (void)len; }
+											// Record the len bytes of persistent parameters at buf
+	virtual void recordWave(const waveRecord_t &w) { (void)w; }
+											// Record a captured waveform
+};
+
+#if defined(ARDUINO)
+
+// Text lines to an Arduino Print
+class PrintRecorder : public EscapementRecorder {
+private:
+	Print *out;
+public:
+	PrintRecorder(Print &p);
+	void record(const beatRecord_t &r);
+	void recordSettings(const void *buf, unsigned int len);
+	void recordWave(const waveRecord_t &w);
+};
+
+#endif
+
+#if !defined(__AVR__)
+
+// Text lines to a stdio FILE
+class FileRecorder : public EscapementRecorder {
+private:
+	FILE *out;
+public:
+	FileRecorder(FILE *f);
+	void record(const beatRecord_t &r);
+	void recordSettings(const void *buf, unsigned int len);
+	void recordWave(const waveRecord_t &w);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,415 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementSensor.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See EscapementSensor.h for description.
+ *
+ ****/
+
+#include "EscapementSensor.h"
+
+/*
+ *
+ * EscapementSensor defaults
+ *
+ */
+
+EscapementSensor::EscapementSensor() {
+	hal = NULL;
+	reading = NO_TEMP;
+	info.conversionMs = 0;
+	info.readUs = 0;
+	info.resolution = 1;
+	info.accuracy = 0;
+}
+
+// Do the whole read now
+boolean EscapementSensor::startRead() {
+	reading = read();
+	return true;
+}
+
+int16_t EscapementSensor::collect() {
+	int16_t t = reading;
+	reading = NO_TEMP;
+	return t;
+}
+
+const tempSensorInfo_t &EscapementSensor::getInfo() {
+	return info;
+}
+
+/*
+ *
+ * TMP102Sensor
+ *
+ */
+
+TMP102Sensor::TMP102Sensor(byte i2cAddr) {
+	addr = i2cAddr;
+	info.conversionMs = 35;					// 26 ms typically
+	info.readUs = 100;						// At 400 kHz; four times that at 100 kHz
+	info.resolution = 16;					// 1/16 degree C
+	info.accuracy = 128;					// 0.5 degree C
+}
+
+// Point the pointer register at the temperature register; it may be left over from before a reset
+void TMP102Sensor::begin(EscapementHAL *h) {
+	byte ptr = TMP102_TEMP;
+	hal = h;
+	hal->i2cWrite(addr, &ptr, 1);
+}
+
+int16_t TMP102Sensor::read() {
+	byte buf[2];
+	return convert(buf, hal->i2cRead(addr, buf, 2));
+}
+
+// Shut the TMP102 down between one-shot conversions, or have it convert once a second rather than its default four 
+// times. Either way, leave the pointer register at the temperature register.
+boolean TMP102Sensor::setOneShot(boolean oneShot) {
+	byte cmd[3] = {TMP102_CONFIG, TMP102_CFG_RES, TMP102_CFG_1HZ};
+	if (oneShot) cmd[1] |= TMP102_CFG_SD;
+	boolean ok = hal->i2cWrite(addr, cmd, 3);
+	cmd[0] = TMP102_TEMP;
+	hal->i2cWrite(addr, cmd, 1);
+	return ok && oneShot;
+}
+
+boolean TMP102Sensor::trigger() {
+	byte cmd[3] = {TMP102_CONFIG, TMP102_CFG_RES | TMP102_CFG_SD | TMP102_CFG_OS, TMP102_CFG_1HZ};
+	boolean ok = hal->i2cWrite(addr, cmd, 3);
+	cmd[0] = TMP102_TEMP;
+	return hal->i2cWrite(addr, cmd, 1) && ok;
+}
+
+boolean TMP102Sensor::startRead() {
+	return hal->i2cStartRead(addr, 2);
+}
+
+boolean TMP102Sensor::busy() {
+	return hal->i2cBusy();
+}
+
+int16_t TMP102Sensor::collect() {
+	byte buf[2];
+	return convert(buf, hal->i2cCollect(buf, 2));
+}
+
+// The first byte is the most significant byte the second is the least significant byte. The binary point is 
+// between them.
+int16_t TMP102Sensor::convert(const byte *buf, byte n) {
+	if (n != 2) return NO_TEMP;
+	return (int16_t)((buf[0] << 8) | buf[1]);
+}
+
+#if defined(ARDUINO)
+
+/*
+ *
+ * DS18B20Sensor
+ *
+ * The 1-Wire bus is driven by making the pin an output (low) and released by making it an input, letting the 
+ * pull-up have it. Each bit's timing is done with interrupts off.
+ *
+ */
+
+DS18B20Sensor::DS18B20Sensor(byte busPin) {
+	pin = busPin;
+	info.conversionMs = 750;				// At 12 bits
+	info.readUs = 7000;						// Reset, two command bytes and the nine-byte scratchpad
+	info.resolution = 16;					// 1/16 degree C
+	info.accuracy = 128;					// 0.5 degree C
+}
+
+void DS18B20Sensor::begin(EscapementHAL *h) {
+	hal = h;
+	digitalWrite(pin, LOW);
+	pinMode(pin, INPUT);
+}
+
+// There's no continuous mode: every reading needs a trigger()
+boolean DS18B20Sensor::setOneShot(boolean oneShot) {
+	(void)oneShot;
+	return true;
+}
+
+boolean DS18B20Sensor::trigger() {
+	return command(DS18B20_CONVERT);
+}
+
+// Read the scratchpad and check its CRC (x^8 + x^5 + x^4 + 1, least significant bit first). The temperature is in 
+// the first two bytes, least significant first, in 1/16 degree C.
+int16_t DS18B20Sensor::read() {
+	byte buf[9];
+	byte crc = 0;
+	if (!command(DS18B20_READ)) return NO_TEMP;
+	for (byte i = 0; i < 9; i++) {
+		buf[i] = readByte();
+		byte b = buf[i];
+		for (byte j = 0; j < 8; j++) {
+			byte mix = (crc ^ b) & 0x01;
+			crc >>= 1;
+			if (mix) crc ^= 0x8c;
+			b >>= 1;
+		}
+	}
+	if (crc != 0) return NO_TEMP;				// (An unplugged bus reads all ones, which fails the CRC)
+	if ((buf[4] & 0x9f) != 0x1f) return NO_TEMP;	// (A bus held low reads all zeros, which passes it, but 
+													//   the configuration register's reserved bits are ones)
+	return (int16_t)((buf[1] << 8) | buf[0]) << 4;
+}
+
+// Reset pulse: low for 480 μs, then the device answers by pulling the bus low
+boolean DS18B20Sensor::reset() {
+	noInterrupts();
+	pinMode(pin, OUTPUT);
+	delayMicroseconds(480);
+	pinMode(pin, INPUT);
+	delayMicroseconds(70);
+	boolean present = digitalRead(pin) == LOW;
+	interrupts();
+	delayMicroseconds(410);
+	return present;
+}
+
+// Each bit: low for 6 μs for a one or 60 μs for a zero, out of a 70 μs slot
+void DS18B20Sensor::writeByte(byte b) {
+	for (byte i = 0; i < 8; i++, b >>= 1) {
+		noInterrupts();
+		pinMode(pin, OUTPUT);
+		delayMicroseconds(b & 1 ? 6 : 60);
+		pinMode(pin, INPUT);
+		interrupts();
+		delayMicroseconds(b & 1 ? 64 : 10);
+	}
+}
+
+// Each bit: low for 6 μs, then sample 9 μs later; the device holds the bus low for a zero
+byte DS18B20Sensor::readByte() {
+	byte b = 0;
+	for (byte i = 0; i < 8; i++) {
+		noInterrupts();
+		pinMode(pin, OUTPUT);
+		delayMicroseconds(6);
+		pinMode(pin, INPUT);
+		delayMicroseconds(9);
+		if (digitalRead(pin) == HIGH) b |= 1 << i;
+		interrupts();
+		delayMicroseconds(55);
+	}
+	return b;
+}
+
+boolean DS18B20Sensor::command(byte cmd) {
+	if (!reset()) return false;
+	writeByte(DS18B20_SKIP_ROM);
+	writeByte(cmd);
+	return true;
+}
+
+#endif
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__)
+
+/*
+ *
+ * ATmegaSensor
+ *
+ * The sensor is ADC channel 8. The datasheet has it read against the internal 1.1 V reference, but with an 
+ * external reference connected to AREF, as the Escapement's is, the internal ones mustn't be selected. So it's 
+ * read against the external one, which makes a count worth about arefMv / 1024 degrees C.
+ *
+ */
+
+#include <avr/io.h>
+
+ATmegaSensor::ATmegaSensor(uint16_t aref, int16_t offsetC256) {
+	arefMv = aref;
+	offset = offsetC256;
+	info.conversionMs = 0;
+	info.readUs = 250;						// Two conversions
+	info.resolution = aref / 4;				// aref / 1024 mV per count at 1 mV per C
+	info.accuracy = 10 * 256;				// Until offsetC256 is set for the chip
+}
+
+// Switch the multiplexer to the sensor, throw away the first conversion (the input needs to settle), and put the 
+// multiplexer back as analogRead() left it
+int16_t ATmegaSensor::read() {
+	byte admux = ADMUX;
+	ADMUX = (admux & 0xf0) | 0x08;
+	convert();
+	uint16_t raw = convert();
+	ADMUX = admux;
+	return (int16_t)((int32_t)raw * arefMv / 4 - (ATMEGA_SENSOR_MV_C - 25) * 256L) + offset;
+}
+
+uint16_t ATmegaSensor::convert() {
+	ADCSRA |= _BV(ADSC);
+	while (ADCSRA & _BV(ADSC));
+	byte lo = ADCL;								// ADCL first; that latches ADCH
+	return lo | (ADCH << 8);
+}
+
+#endif
+
+/*
+ *
+ * FusedSensor
+ *
+ */
+
+FusedSensor::FusedSensor() {
+	count = 0;
+	next = 0;
+	good = false;
+}
+
+// The combination converts as slowly as its slowest member and is as coarse as its least accurate one, but reports 
+// as finely as its finest one
+boolean FusedSensor::add(EscapementSensor *s, int16_t weight) {
+	if (count == FUSED_MAX) return false;
+	const tempSensorInfo_t &si = s->getInfo();
+	if (count == 0 || si.conversionMs > info.conversionMs) info.conversionMs = si.conversionMs;
+	if (count == 0 || si.resolution < info.resolution) info.resolution = si.resolution;
+	if (count == 0 || si.accuracy > info.accuracy) info.accuracy = si.accuracy;
+	info.readUs = count == 0 ? si.readUs : info.readUs + si.readUs;
+	members[count].sensor = s;
+	members[count].weight = weight;
+	members[count].last = NO_TEMP;
+	members[count].oneShot = true;			// Until setOneShot() says otherwise, trigger() triggers it
+	members[count].failures = 0;
+	members[count].misses = 0;
+	count++;
+	return true;
+}
+
+void FusedSensor::begin(EscapementHAL *h) {
+	hal = h;
+	for (byte i = 0; i < count; i++) {
+		members[i].sensor->begin(h);
+	}
+}
+
+int16_t FusedSensor::read() {
+	for (byte i = 0; i < count; i++) {
+		take(i, members[i].sensor->read());
+	}
+	return fuse();
+}
+
+// The combination is one-shot if any member is; trigger() triggers only those
+boolean FusedSensor::setOneShot(boolean oneShot) {
+	boolean any = false;
+	for (byte i = 0; i < count; i++) {
+		members[i].oneShot = members[i].sensor->setOneShot(oneShot);
+		any |= members[i].oneShot;
+	}
+	return any;
+}
+
+boolean FusedSensor::trigger() {
+	boolean ok = true;
+	for (byte i = 0; i < count; i++) {
+		if (members[i].oneShot && !members[i].sensor->trigger()) ok = false;
+	}
+	return ok;
+}
+
+boolean FusedSensor::startRead() {
+	next = 0;
+	start();
+	return true;
+}
+
+// Each time a member's read finishes, take it in and start the next member's
+boolean FusedSensor::busy() {
+	while (next < count) {
+		if (members[next].sensor->busy()) return true;
+		take(next, members[next].sensor->collect());
+		next++;
+		start();
+	}
+	return false;
+}
+
+int16_t FusedSensor::collect() {
+	while (busy());
+	return fuse();
+}
+
+int16_t FusedSensor::getReading(byte i) {
+	return i < count ? members[i].last : NO_TEMP;
+}
+
+uint16_t FusedSensor::getFailures(byte i) {
+	return i < count ? members[i].failures : 0;
+}
+
+boolean FusedSensor::isStale(byte i) {
+	return i < count && members[i].misses > FUSED_MAX_MISSES;
+}
+
+void FusedSensor::start() {
+	while (next < count && !members[next].sensor->startRead()) {
+		take(next++, NO_TEMP);
+	}
+}
+
+void FusedSensor::take(byte i, int16_t t) {
+	if (t == NO_TEMP) {
+		members[i].failures++;
+		if (members[i].misses < 0xff) members[i].misses++;
+	} else {
+		members[i].last = t;
+		members[i].misses = 0;
+		good = true;
+	}
+}
+
+// The weighted average of the members' last good readings, rounded. Fails unless some member has read since last 
+// time and every member has read at some point and hasn't missed more than FUSED_MAX_MISSES readings in a row since.
+int16_t FusedSensor::fuse() {
+	int32_t sum = 0;
+	int32_t weights = 0;
+	boolean fresh = good;
+	good = false;
+	if (!fresh) return NO_TEMP;
+	for (byte i = 0; i < count; i++) {
+		if (members[i].last == NO_TEMP || members[i].misses > FUSED_MAX_MISSES) return NO_TEMP;
+		sum += (int32_t)members[i].weight * members[i].last;
+		weights += members[i].weight;
+	}
+	if (weights == 0) return NO_TEMP;
+	if (weights < 0) {
+		sum = -sum;
+		weights = -weights;
+	}
+	return (int16_t)((sum + (sum < 0 ? -weights : weights) / 2) / weights);
+}
+
+/*
+ *
+ * SimSensor
+ *
+ */
+
+SimSensor::SimSensor(uint16_t conversionMs, uint16_t readUs, uint16_t resolution, uint16_t accuracy) {
+	value = NO_TEMP;
+	info.conversionMs = conversionMs;
+	info.readUs = readUs;
+	info.resolution = resolution;
+	info.accuracy = accuracy;
+}
+
+void SimSensor::set(int16_t t) {
+	value = t;
+}
+
+int16_t SimSensor::read() {
+	return value;
+}
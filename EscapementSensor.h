@@ -0,0 +1,197 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementSensor.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Temperature sensors for the Escapement's temperature compensation. An Escapement reads the temperature from 
+ *   whatever EscapementSensor it's given via setTempSensor(); by default, a TMP102Sensor. Every sensor reports 
+ *   degrees C * 256 (NO_TEMP if a reading fails) and describes itself in a tempSensorInfo_t -- how long a 
+ *   conversion and a read take, its resolution and its accuracy -- so that a sketch can choose between them and 
+ *   the Escapement knows how long to leave between starting a conversion and reading it. Four are provided:
+ *
+ *     TMP102Sensor  A TI TMP102 on the I2C bus, through the HAL. Shut down between one-shot conversions when 
+ *                   sampled at an interval, converting once a second when sampled every beat. The default.
+ *     DS18B20Sensor A Maxim DS18B20, alone on a 1-Wire bus on one pin (with a 4.7k pull-up; parasite power isn't 
+ *                   supported). It converts only when told to, taking 750 ms, and checks each reading's CRC. 
+ *                   Arduino builds only.
+ *     ATmegaSensor  The temperature sensor built into the ATmega328P, read with whatever ADC reference is in use 
+ *                   (the Escapement's external one, normally). Fast, but coarse and, until its offset is set, 
+ *                   only good to about 10 C. ATmega328P (and 168) builds only.
+ *     SimSensor     Reads whatever it's been told to. For host builds, tests and replay.
+ *
+ *   A FusedSensor combines up to FUSED_MAX of them -- say, TMP102s at different addresses at the top, middle and 
+ *   bottom of a tall case -- into one weighted average, a better estimate of the temperature of the whole rod than 
+ *   any one sensor near the electronics. The weights are relative and may be negative, so a combination fitted 
+ *   elsewhere (e.g., one extrapolating from two sensors to the rod's middle) can be used as is. The members are 
+ *   read one after another in the background, each busy() call starting the next member's read once the last one 
+ *   is done; the Escapement calls busy() through beat()'s settle delay, so a fused reading takes one beat, like 
+ *   any other sensor's, and none of it is left on the bus when beat() returns. A member whose reading fails is 
+ *   represented by its last good one, but only for FUSED_MAX_MISSES readings in a row; the fused reading fails if 
+ *   none of them read, a member has never read at all or one has missed more than that, so a dead member can't 
+ *   bias the estimate for long and the Escapement's hold on the last good temperature (see setTempHold()) takes 
+ *   over. 
+ *
+ *   A sensor's begin() gets it ready; read() reads it, blocking. For reading in the background, startRead() starts 
+ *   a read, busy() says whether it's still going and collect() picks up the result; by default startRead() just 
+ *   does the whole read. setOneShot() asks a sensor to convert only when trigger() tells it to, if it can.
+ *
+ ****/
+
+#ifndef EscapementSensor_H
+#define EscapementSensor_H
+
+#include "EscapementHAL.h"
+
+#ifndef INT16_MIN
+#define INT16_MIN		(-0x7fff - 1)		// (avr-libc's stdint.h leaves it out of C++ without __STDC_LIMIT_MACROS)
+#endif
+#define NO_TEMP			INT16_MIN			// Temperature reported when no reading is available (=-128 degrees C, 
+											//   below anything a sensor reads)
+#define ADDRESS_TMP102	(0x48)				// Default I2C address of the TMP102 temperature sensor
+
+// TMP102 registers
+#define TMP102_TEMP		(0x00)				// Pointer register value for the temperature register
+#define TMP102_CONFIG	(0x01)				// Pointer register value for the configuration register
+#define TMP102_CFG_OS	(0x80)				// Configuration byte 1: start a one-shot conversion
+#define TMP102_CFG_RES	(0x60)				// Configuration byte 1: 12-bit resolution (read-only)
+#define TMP102_CFG_SD	(0x01)				// Configuration byte 1: shut down between one-shot conversions
+#define TMP102_CFG_1HZ	(0x60)				// Configuration byte 2: convert once a second, alert bit idle
+
+// DS18B20 commands
+#define DS18B20_SKIP_ROM	(0xcc)			// Address the only device on the bus
+#define DS18B20_CONVERT		(0x44)			// Start a conversion
+#define DS18B20_READ		(0xbe)			// Read the scratchpad: 9 bytes, the last a CRC
+
+// What a sensor is like
+struct tempSensorInfo_t {
+	uint16_t conversionMs;					// Time from trigger() to a reading (ms); 0 if readings are always ready
+	uint16_t readUs;						// About how long a read takes (μs)
+	uint16_t resolution;					// Smallest change it reports (degrees C * 256)
+	uint16_t accuracy;						// Typical error (degrees C * 256)
+};
+
+class EscapementSensor {
+protected:
+	EscapementHAL *hal;						// The hardware we run on
+	tempSensorInfo_t info;					// What this sensor is like
+	int16_t reading;						// What the default startRead() read
+public:
+	EscapementSensor();
+	virtual void begin(EscapementHAL *h) { hal = h; }
+											// Get ready for use
+	virtual int16_t read() = 0;				// Read the temperature (degrees C * 256); NO_TEMP if that fails
+	virtual boolean setOneShot(boolean oneShot) { (void)oneShot; return false; }
+											// Convert only when triggered (or continuously); true if it now is
+	virtual boolean trigger() { return true; }
+											// Start a one-shot conversion; true if successful
+	virtual boolean startRead();			// Start reading the temperature in the background; false if that can't
+											//   be done now
+	virtual boolean busy() { return false; }// True while a started read is still going; moves it along
+	virtual int16_t collect();				// Get what the started read read; NO_TEMP if it failed
+	const tempSensorInfo_t &getInfo();		// Get what this sensor is like
+};
+
+// A TMP102 on the I2C bus
+class TMP102Sensor : public EscapementSensor {
+private:
+	byte addr;								// Its I2C address
+	int16_t convert(const byte *buf, byte n);
+											// Convert the n bytes read from it to degrees C * 256
+public:
+	TMP102Sensor(byte i2cAddr = ADDRESS_TMP102);
+	void begin(EscapementHAL *h);
+	int16_t read();
+	boolean setOneShot(boolean oneShot);
+	boolean trigger();
+	boolean startRead();
+	boolean busy();
+	int16_t collect();
+};
+
+#if defined(ARDUINO)
+
+// A DS18B20 alone on a 1-Wire bus
+class DS18B20Sensor : public EscapementSensor {
+private:
+	byte pin;								// The 1-Wire bus
+	boolean reset();						// Reset the bus; true if a device answered
+	void writeByte(byte b);
+	byte readByte();
+	boolean command(byte cmd);				// Reset, skip ROM and send cmd; true if a device answered
+public:
+	DS18B20Sensor(byte busPin);
+	void begin(EscapementHAL *h);
+	int16_t read();
+	boolean setOneShot(boolean oneShot);
+	boolean trigger();
+};
+
+#endif
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__)
+
+#define ATMEGA_SENSOR_MV_C	(314)			// ATmega328P temperature sensor output at 25 C (mV); about 1 mV per C
+
+// The ATmega's own temperature sensor
+class ATmegaSensor : public EscapementSensor {
+private:
+	uint16_t arefMv;						// The ADC reference voltage (mV)
+	int16_t offset;							// Correction for this chip (degrees C * 256)
+	uint16_t convert();						// Do one conversion of the temperature sensor channel
+public:
+	ATmegaSensor(uint16_t aref = 1650, int16_t offsetC256 = 0);
+	int16_t read();
+};
+
+#endif
+
+#define FUSED_MAX		(4)					// Most sensors a FusedSensor can combine
+#define FUSED_MAX_MISSES (3)				// Most readings in a row a FusedSensor member may miss and still count
+
+// A weighted combination of other sensors
+class FusedSensor : public EscapementSensor {
+private:
+	struct member_t {
+		EscapementSensor *sensor;
+		int16_t weight;						// Relative weight
+		int16_t last;						// Its last good reading, NO_TEMP if none yet
+		boolean oneShot;					// Whether it converts only when triggered
+		uint16_t failures;					// Its readings that failed
+		byte misses;						// Those in a row, up to the latest (saturating)
+	} members[FUSED_MAX];
+	byte count;								// Number of members
+	byte next;								// Member whose background read is under way; count if none
+	boolean good;							// Whether any member has read since the last fuse()
+	void start();							// Start member next's background read, skipping any that can't
+	void take(byte i, int16_t t);			// Take in member i's reading t
+	int16_t fuse();							// Combine the members' readings
+public:
+	FusedSensor();
+	boolean add(EscapementSensor *s, int16_t weight = 1);
+											// Add s to the combination; false if there's no room
+	void begin(EscapementHAL *h);
+	int16_t read();
+	boolean setOneShot(boolean oneShot);
+	boolean trigger();
+	boolean startRead();
+	boolean busy();
+	int16_t collect();
+	int16_t getReading(byte i);				// Get member i's last good reading; NO_TEMP if none
+	uint16_t getFailures(byte i);			// Get the number of member i's readings that failed
+	boolean isStale(byte i);				// Whether member i has missed too many readings in a row to count
+};
+
+// Whatever it's told
+class SimSensor : public EscapementSensor {
+private:
+	int16_t value;							// What it reads
+public:
+	SimSensor(uint16_t conversionMs = 0, uint16_t readUs = 0, uint16_t resolution = 1, uint16_t accuracy = 0);
+	void set(int16_t t);					// Read t (degrees C * 256) from now on; NO_TEMP makes readings fail
+	int16_t read();
+};
+
+#endif
@@ -0,0 +1,171 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementStore.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See EscapementStore.h for description.
+ *
+ ****/
+
+#include "EscapementStore.h"
+
+#if defined(__AVR__)
+
+#include <avr/eeprom.h> // EEPROM read write library
+
+/*
+ *
+ * EEPROMStore: the ATmega's internal EEPROM
+ *
+ */
+
+EEPROMStore::EEPROMStore(unsigned int b) {
+	base = b;
+}
+
+bool EEPROMStore::read(unsigned int addr, void *buf, unsigned int len) {
+	eeprom_read_block(buf, (const void*)(base + addr), len);
+	return true;
+}
+
+bool EEPROMStore::write(unsigned int addr, const void *buf, unsigned int len) {
+	eeprom_update_block(buf, (void*)(base + addr), len);	// Only bytes that differ are actually written
+	return true;
+}
+
+#endif
+
+#if defined(ARDUINO)
+
+#include <Wire.h>       // FRAM chips are I2C devices
+
+/*
+ *
+ * FRAMStore: an I2C FRAM chip
+ *
+ */
+
+FRAMStore::FRAMStore(byte a, unsigned int b) {
+	i2cAddr = a;
+	base = b;
+}
+
+// Make sure the chip answers
+bool FRAMStore::begin() {
+	Wire.beginTransmission(i2cAddr);
+	return Wire.endTransmission() == 0;
+}
+
+bool FRAMStore::read(unsigned int addr, void *buf, unsigned int len) {
+	byte *p = (byte *)buf;
+	addr += base;
+	while (len > 0) {						// Wire can only move so much at once, so go a chunk at a time
+		byte n = len > FRAM_CHUNK ? FRAM_CHUNK : len;
+		Wire.beginTransmission(i2cAddr);	//   Set the chip's address pointer
+		Wire.write((byte)(addr >> 8));
+		Wire.write((byte)addr);
+		if (Wire.endTransmission(false) != 0) return false;
+		if (Wire.requestFrom(i2cAddr, n) != n) return false;
+		for (byte i = 0; i < n; i++) {		//   And read the data
+			*p++ = Wire.read();
+		}
+		addr += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool FRAMStore::write(unsigned int addr, const void *buf, unsigned int len) {
+	const byte *p = (const byte *)buf;
+	addr += base;
+	while (len > 0) {
+		byte n = len > FRAM_CHUNK ? FRAM_CHUNK : len;
+		Wire.beginTransmission(i2cAddr);
+		Wire.write((byte)(addr >> 8));
+		Wire.write((byte)addr);
+		Wire.write(p, n);
+		if (Wire.endTransmission() != 0) return false;
+		p += n;
+		addr += n;
+		len -= n;
+	}
+	return true;
+}
+
+#endif
+
+#if !defined(__AVR__)
+
+#include <string.h>
+
+/*
+ *
+ * FileStore: a file on the host
+ *
+ */
+
+FileStore::FileStore(const char *p) {
+	path = p;
+	file = NULL;
+}
+
+FileStore::~FileStore() {
+	if (file != NULL) fclose(file);
+}
+
+// Open the file, creating it if it doesn't exist
+bool FileStore::begin() {
+	if (file == NULL) {
+		file = fopen(path, "r+b");
+		if (file == NULL) file = fopen(path, "w+b");
+	}
+	return file != NULL;
+}
+
+// Read. Bytes beyond the end of the file read as 0xff, the way erased EEPROM does
+bool FileStore::read(unsigned int addr, void *buf, unsigned int len) {
+	if (file == NULL) return false;
+	unsigned char *p = (unsigned char *)buf;
+	size_t n = 0;
+	if (fseek(file, addr, SEEK_SET) == 0) {
+		n = fread(p, 1, len, file);
+	}
+	for (; n < len; n++) {
+		p[n] = 0xff;
+	}
+	return true;
+}
+
+bool FileStore::write(unsigned int addr, const void *buf, unsigned int len) {
+	if (file == NULL) return false;
+	if (fseek(file, addr, SEEK_SET) != 0) return false;
+	if (fwrite(buf, 1, len, file) != len) return false;
+	return fflush(file) == 0;
+}
+
+/*
+ *
+ * RAMStore: RAM on the host
+ *
+ */
+
+RAMStore::RAMStore() {
+	memset(data, 0xff, sizeof(data));		// Start out looking like erased EEPROM
+}
+
+bool RAMStore::read(unsigned int addr, void *buf, unsigned int len) {
+	if (addr + len > sizeof(data)) return false;
+	memcpy(buf, data + addr, len);
+	return true;
+}
+
+bool RAMStore::write(unsigned int addr, const void *buf, unsigned int len) {
+	if (addr + len > sizeof(data)) return false;
+	memcpy(data + addr, buf, len);
+	return true;
+}
+
+#endif
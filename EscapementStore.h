@@ -0,0 +1,117 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementStore.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Persistent storage backends for the Escapement's calibration data. An Escapement keeps its persistent 
+ *   parameters (the eeprom settings_t structure) in whatever EscapementStore it's given via setStore(). These 
+ *   backends are provided:
+ *
+ *     EEPROMStore   The ATmega's internal EEPROM. This is the default on AVRs. Only changed bytes are written, but 
+ *                   EEPROM cells wear out after about 100,000 writes, so checkpoints should be infrequent.
+ *     FRAMStore     An I2C FRAM chip (e.g., Fujitsu MB85RC256V) with two-byte memory addressing. FRAM is fast and 
+ *                   has effectively unlimited write endurance, so it's fine to checkpoint every beat. This is the 
+ *                   default on other Arduino boards.
+ *     FileStore     A file on the host. Only available in host (non-Arduino) builds; lets the persistence logic 
+ *                   be run in host-side tests.
+ *     RAMStore      RAM that looks like erased EEPROM to start with. Only available in host builds; it's what 
+ *                   HostHAL uses by default.
+ *
+ ****/
+
+#ifndef EscapementStore_H
+#define EscapementStore_H
+
+#if defined(ARDUINO)
+  #if ARDUINO >= 100
+    #include <Arduino.h>  // Arduino 1.0
+  #else
+    #include <WProgram.h> // Arduino 0022
+  #endif
+#else
+  #include <stdint.h>
+  typedef uint8_t byte;
+#endif
+#if !defined(__AVR__)
+  #include <stdio.h>
+#endif
+
+#define FRAM_ADDRESS	(0x50)				// Default I2C address of an FRAM chip
+#define FRAM_CHUNK		(30)				// Bytes per FRAM transfer (Wire buffer less two address bytes)
+#define RAM_STORE_SIZE	(1024)				// Size of a RAMStore (bytes); the same as an ATmega328's EEPROM
+
+class EscapementStore {
+public:
+	virtual bool begin() { return true; }	// Get ready for use; true if the store is usable
+	virtual bool read(unsigned int addr, void *buf, unsigned int len) = 0;
+											// Read len bytes at addr into buf; true if successful
+	virtual bool write(unsigned int addr, const void *buf, unsigned int len) = 0;
+											// Write len bytes from buf to addr; true if successful
+	virtual bool isWearFree() { return false; }
+											// True if frequent writes don't wear out the store
+};
+
+#if defined(__AVR__)
+
+// The ATmega's internal EEPROM
+class EEPROMStore : public EscapementStore {
+private:
+	unsigned int base;						// EEPROM address at which our data starts
+public:
+	EEPROMStore(unsigned int base = 0);
+	bool read(unsigned int addr, void *buf, unsigned int len);
+	bool write(unsigned int addr, const void *buf, unsigned int len);
+};
+
+#endif
+
+#if defined(ARDUINO)
+
+// An I2C FRAM chip with two-byte memory addresses
+class FRAMStore : public EscapementStore {
+private:
+	byte i2cAddr;							// I2C address of the FRAM chip
+	unsigned int base;						// FRAM address at which our data starts
+public:
+	FRAMStore(byte i2cAddr = FRAM_ADDRESS, unsigned int base = 0);
+	bool begin();
+	bool read(unsigned int addr, void *buf, unsigned int len);
+	bool write(unsigned int addr, const void *buf, unsigned int len);
+	bool isWearFree() { return true; }
+};
+
+#endif
+
+#if !defined(__AVR__)
+
+// A file on the host
+class FileStore : public EscapementStore {
+private:
+	const char *path;						// Name of the file
+	FILE *file;								// The file once it's open
+public:
+	FileStore(const char *path);
+	~FileStore();
+	bool begin();
+	bool read(unsigned int addr, void *buf, unsigned int len);
+	bool write(unsigned int addr, const void *buf, unsigned int len);
+	bool isWearFree() { return true; }
+};
+
+// RAM on the host
+class RAMStore : public EscapementStore {
+private:
+	unsigned char data[RAM_STORE_SIZE];		// The contents
+public:
+	RAMStore();
+	bool read(unsigned int addr, void *buf, unsigned int len);
+	bool write(unsigned int addr, const void *buf, unsigned int len);
+	bool isWearFree() { return true; }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementTWI.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See EscapementTWI.h for description.
+ *
+ ****/
+
+#include "EscapementTWI.h"
+
+#if defined(TWI_AVAILABLE)
+
+#include <util/delay.h>
+
+// Where SDA and SCL are
+#if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+  #define TWI_PORT		PORTD
+  #define TWI_DDR		DDRD
+  #define TWI_PIN		PIND
+  #define TWI_SDA		_BV(1)
+  #define TWI_SCL		_BV(0)
+#else										// The ATmega328P and its relatives
+  #define TWI_PORT		PORTC
+  #define TWI_DDR		DDRC
+  #define TWI_PIN		PINC
+  #define TWI_SDA		_BV(4)
+  #define TWI_SCL		_BV(5)
+#endif
+
+// TWI status codes (TWSR with the prescaler bits masked off)
+#define TWS_START		(0x08)				// START sent
+#define TWS_REP_START	(0x10)				// Repeated START sent
+#define TWS_SLAW_ACK	(0x18)				// SLA+W sent, ACK received
+#define TWS_DATA_ACK	(0x28)				// Data byte sent, ACK received
+#define TWS_SLAR_ACK	(0x40)				// SLA+R sent, ACK received
+#define TWS_READ_ACK	(0x50)				// Data byte received, ACK returned
+#define TWS_READ_NACK	(0x58)				// Data byte received, NACK returned
+
+EscapementTWI::EscapementTWI() {
+	timeouts = 0;
+	recoveries = 0;
+	aState = TWA_IDLE;
+	setClock(TWI_FREQ);
+}
+
+// If the TWI is off, turn it on with the internal pull-ups and prescaler 1, as Wire does. The bit rate is left 
+// alone; each transfer sets its own.
+void EscapementTWI::begin() {
+	if ((TWCR & _BV(TWEN)) == 0) {
+		TWSR &= ~(_BV(TWPS0) | _BV(TWPS1));
+		TWI_PORT |= TWI_SDA | TWI_SCL;
+		TWCR = _BV(TWEN);
+	}
+}
+
+// Set the bit rate for the driver's transfers (with prescaler 1, which Wire uses too)
+void EscapementTWI::setClock(uint32_t hz) {
+	uint32_t r = F_CPU / hz > 16 ? (F_CPU / hz - 16) / 2 : 0;
+	bitRate = r > 255 ? 255 : r;
+}
+
+// Read up to len bytes from device addr into buf; return the number read
+byte EscapementTWI::read(byte addr, byte *buf, byte len) {
+	byte keep = TWCR & (_BV(TWIE) | _BV(TWEA));	// Keep Wire's interrupt out of it
+	take();
+	byte s = start((addr << 1) | 1);
+	if (s != TWS_SLAR_ACK) {
+		if (s == TWI_TIMEOUT) {
+			fail(keep);
+		} else {
+			stop(keep);
+		}
+		return 0;
+	}
+	for (byte i = 0; i < len; i++) {			// ACK every byte but the last
+		TWCR = _BV(TWINT) | _BV(TWEN) | (i + 1 < len ? _BV(TWEA) : 0);
+		s = status();
+		if (s != TWS_READ_ACK && s != TWS_READ_NACK) {
+			fail(keep);
+			return i;
+		}
+		buf[i] = TWDR;
+	}
+	stop(keep);
+	return len;
+}
+
+// Write len bytes from buf to device addr; true if the device took them all
+boolean EscapementTWI::write(byte addr, const byte *buf, byte len) {
+	byte keep = TWCR & (_BV(TWIE) | _BV(TWEA));
+	take();
+	byte s = start(addr << 1);
+	for (byte i = 0; s == TWS_SLAW_ACK && i < len; i++) {
+		TWDR = buf[i];
+		TWCR = _BV(TWINT) | _BV(TWEN);
+		if ((s = status()) == TWS_DATA_ACK) s = TWS_SLAW_ACK;
+	}
+	if (s == TWI_TIMEOUT) {
+		fail(keep);
+		return false;
+	}
+	stop(keep);
+	return s == TWS_SLAW_ACK;
+}
+
+// Start a background read: send the START and leave the rest to busy()
+boolean EscapementTWI::startRead(byte addr, byte len, uint32_t now) {
+	if ((aState != TWA_IDLE && aState != TWA_DONE) || len > TWI_ASYNC_MAX) return false;
+	aKeep = TWCR & (_BV(TWIE) | _BV(TWEA));	// Keep Wire's interrupt out of it
+	take();
+	aSla = (addr << 1) | 1;
+	aLen = len;
+	aCount = 0;
+	aMark = now;
+	aState = TWA_START;
+	TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+	return true;
+}
+
+// Take each step of the background read whose predecessor has finished, and time out one that's taking too long. 
+// The steps and their failures are read()'s.
+boolean EscapementTWI::busy(uint32_t now) {
+	while (aState != TWA_IDLE && aState != TWA_DONE) {
+		if (aState == TWA_STOP ? (TWCR & _BV(TWSTO)) != 0 : (TWCR & _BV(TWINT)) == 0) {
+			if (now - aMark < TWI_TIMEOUT_US) return true;	// The step is still going
+			timeouts++;
+			fail(aKeep);
+			aState = TWA_DONE;
+			return false;
+		}
+		aMark = now;
+		byte s = TWSR & 0xf8;
+		switch (aState) {
+			case TWA_START:
+				if (s != TWS_START && s != TWS_REP_START) {
+					aStop(0);
+					break;
+				}
+				TWDR = aSla;
+				TWCR = _BV(TWINT) | _BV(TWEN);
+				aState = TWA_SLA;
+				break;
+			case TWA_SLA:
+				if (s != TWS_SLAR_ACK || aLen == 0) {
+					aStop(0);
+					break;
+				}
+				TWCR = _BV(TWINT) | _BV(TWEN) | (aLen > 1 ? _BV(TWEA) : 0);	// ACK every byte but the last
+				aState = TWA_DATA;
+				break;
+			case TWA_DATA:
+				if (s != TWS_READ_ACK && s != TWS_READ_NACK) {
+					fail(aKeep);
+					aState = TWA_DONE;
+					break;
+				}
+				aBuf[aCount++] = TWDR;
+				if (aCount == aLen) {
+					aStop(aCount);
+					break;
+				}
+				TWCR = _BV(TWINT) | _BV(TWEN) | (aCount + 1 < aLen ? _BV(TWEA) : 0);
+				break;
+			case TWA_STOP:
+				TWCR = _BV(TWEN) | aKeep;
+				TWBR = wireRate;
+				aState = TWA_DONE;
+				break;
+		}
+	}
+	return false;
+}
+
+byte EscapementTWI::collect(byte *buf, byte len) {
+	if (aState != TWA_DONE) return 0;
+	byte n = aCount < len ? aCount : len;
+	for (byte i = 0; i < n; i++) {
+		buf[i] = aBuf[i];
+	}
+	aState = TWA_IDLE;
+	return n;
+}
+
+// Free a stuck bus. With the TWI off, clock SCL until whoever is holding SDA low lets go (a device mid-byte 
+// needs at most nine clocks), then send a STOP by hand and turn the TWI back on.
+boolean EscapementTWI::recover() {
+	byte twcr = TWCR & (_BV(TWIE) | _BV(TWEA));
+	byte pullups = TWI_PORT & (TWI_SDA | TWI_SCL);
+	recoveries++;
+	TWCR = 0;									// Let go of the pins
+	TWI_PORT &= ~(TWI_SDA | TWI_SCL);			// Driving a pin is making it an output, low; releasing it is
+	TWI_DDR &= ~(TWI_SDA | TWI_SCL);			//   making it an input and letting the pull-up have it
+	for (byte i = 0; i < TWI_RECOVER_CLOCKS && (TWI_PIN & TWI_SDA) == 0; i++) {
+		TWI_DDR |= TWI_SCL;
+		_delay_us(5);
+		TWI_DDR &= ~TWI_SCL;
+		_delay_us(5);
+	}
+	TWI_DDR |= TWI_SDA;							// STOP: SDA rising while SCL is high
+	_delay_us(5);
+	TWI_DDR &= ~TWI_SDA;
+	_delay_us(5);
+	boolean clear = (TWI_PIN & (TWI_SDA | TWI_SCL)) == (TWI_SDA | TWI_SCL);
+	TWI_PORT |= pullups;
+	TWCR = _BV(TWEN) | twcr;
+	return clear;
+}
+
+uint16_t EscapementTWI::getTimeouts() {
+	return timeouts;
+}
+uint16_t EscapementTWI::getRecoveries() {
+	return recoveries;
+}
+
+// Wait, for at most TWI_TIMEOUT_US, for the step under way to finish; return the TWI status or TWI_TIMEOUT
+byte EscapementTWI::status() {
+	for (uint16_t n = TWI_TIMEOUT_LOOPS; (TWCR & _BV(TWINT)) == 0; n--) {
+		if (n == 0) {
+			timeouts++;
+			return TWI_TIMEOUT;
+		}
+	}
+	return TWSR & 0xf8;
+}
+
+// Send a START and then sla, the device address and read/write bit; return the TWI status after the address
+byte EscapementTWI::start(byte sla) {
+	TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+	byte s = status();
+	if (s != TWS_START && s != TWS_REP_START) return s == TWI_TIMEOUT ? s : 0;
+	TWDR = sla;
+	TWCR = _BV(TWINT) | _BV(TWEN);
+	return status();
+}
+
+// Send a STOP, wait (for a while) for it to go out, and hand the TWI back with keep's TWIE and TWEA and Wire's 
+// bit rate
+void EscapementTWI::stop(byte keep) {
+	TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+	for (uint16_t n = TWI_TIMEOUT_LOOPS; (TWCR & _BV(TWSTO)) != 0; n--) {
+		if (n == 0) {
+			timeouts++;
+			fail(keep);
+			return;
+		}
+	}
+	TWCR = _BV(TWEN) | keep;
+	TWBR = wireRate;
+}
+
+// Note Wire's bit rate and put the driver's in its place, for a transfer about to start
+void EscapementTWI::take() {
+	wireRate = TWBR;
+	TWBR = bitRate;
+}
+
+// End the background read, having read count bytes: send a STOP, which busy() waits for
+void EscapementTWI::aStop(byte count) {
+	aCount = count;
+	TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+	aState = TWA_STOP;
+}
+
+// A step timed out: recover the bus, which also hands the TWI back, and give Wire its bit rate back
+void EscapementTWI::fail(byte keep) {
+	TWCR = _BV(TWEN) | keep;
+	recover();
+	TWBR = wireRate;
+}
+
+#endif
@@ -0,0 +1,104 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementTWI.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   A small I2C master driver for the AVR's TWI peripheral, which ArduinoHAL uses for the temperature sensor in 
+ *   place of Wire. Wire waits for the bus with no time limit, so a device holding SDA low -- say, one that was 
+ *   reset part way through a transfer -- would hang beat() and the pendulum would stop being kicked. Here, every 
+ *   wait for the bus gives up after TWI_TIMEOUT_US. After a timeout, or when the bus is found stuck, the driver 
+ *   takes the pins over and clocks SCL up to TWI_RECOVER_CLOCKS times, until the device lets go of SDA, then sends 
+ *   a STOP and starts the TWI over. It runs its transfers at TWI_FREQ, fast mode, so reading the TMP102 takes about 
+ *   100 μs, and it uses no heap and no buffers of its own. If something on the bus can't take fast mode, 
+ *   setClock() slows the driver's transfers down (to 100000 Hz, say).
+ *
+ *   The driver polls rather than using the TWI interrupt, so that it can share the bus with Wire (which FRAMStore 
+ *   uses): Wire owns the interrupt, and the driver turns it off for the length of each of its own transfers. The 
+ *   same goes for the bit rate register: the driver puts its own rate in it for each transfer and Wire's back 
+ *   afterward, so Wire (and Wire.setClock()) keeps the rate it was given. Call begin() after Wire.begin().
+ *
+ *   read() and write() wait for the bus. startRead() instead starts a read of up to TWI_ASYNC_MAX bytes and 
+ *   returns; each call to busy() then takes it as far as it can go without waiting -- the TWI does each step on 
+ *   its own -- and collect() picks up what it read. busy() is given the time (μs) and times each step out after 
+ *   TWI_TIMEOUT_US, recovering the bus, as read() does. Nothing else should use the bus until busy() says the 
+ *   read is done.
+ *
+ *   It's only available on AVRs that have a TWI; elsewhere TWI_AVAILABLE isn't defined and ArduinoHAL uses Wire.
+ *
+ ****/
+
+#ifndef EscapementTWI_H
+#define EscapementTWI_H
+
+#include "EscapementHAL.h"
+
+#if defined(__AVR__)
+  #include <avr/io.h>
+  #if defined(TWCR)
+    #define TWI_AVAILABLE
+  #endif
+#endif
+
+#if defined(TWI_AVAILABLE)
+
+#define TWI_FREQ		(400000UL)			// Bus clock (Hz)
+#define TWI_TIMEOUT_US	(1000)				// Longest wait for any one step of a transfer (μs)
+#define TWI_TIMEOUT_LOOPS	((uint16_t)(F_CPU / 1000000UL * TWI_TIMEOUT_US / 8))
+											// Polling loops in that long (a loop is at least 8 cycles)
+#define TWI_RECOVER_CLOCKS	(9)				// Most SCL pulses given to free a stuck bus
+#define TWI_TIMEOUT		(0x01)				// status() value for a step that timed out (not a TWI status)
+#define TWI_ASYNC_MAX	(4)					// Most bytes startRead() can read
+
+// Background read states
+#define TWA_IDLE		(0)					// None under way or waiting to be collected
+#define TWA_START		(1)					// Sending the START
+#define TWA_SLA			(2)					// Sending the device address
+#define TWA_DATA		(3)					// Receiving a byte
+#define TWA_STOP		(4)					// Sending the STOP
+#define TWA_DONE		(5)					// Finished; waiting to be collected
+
+class EscapementTWI {
+private:
+	uint16_t timeouts;						// Steps that timed out
+	uint16_t recoveries;					// Bus recoveries done
+	byte status();							// Wait for the current step; return the TWI status or TWI_TIMEOUT
+	byte start(byte sla);					// Send a (repeated) START and sla; return the TWI status
+	void stop(byte keep);					// Send a STOP and give the TWI back, restoring keep's TWIE and TWEA
+	void fail(byte keep);					// Give up on the transfer: recover the bus and give the TWI back
+	byte aState;							// State of the background read (TWA_...)
+	byte aSla;								// Its device address and read bit
+	byte aLen;								// Bytes it's to read
+	byte aCount;							// Bytes it has read
+	byte aKeep;								// Wire's TWIE and TWEA, to restore when it's done
+	byte bitRate;							// TWBR for the driver's own transfers
+	byte wireRate;							// Wire's TWBR, to restore when the transfer under way is done
+	void take();							// Put the driver's bit rate in place for a transfer
+	uint32_t aMark;							// Time (μs) its current step started
+	byte aBuf[TWI_ASYNC_MAX];				// What it has read
+	void aStop(byte count);					// End it with a STOP, having read count bytes
+public:
+	EscapementTWI();
+	void begin();							// Enable the TWI, if Wire hasn't
+	void setClock(uint32_t hz);				// Set the bus clock for the driver's own transfers (TWI_FREQ to start)
+	byte read(byte addr, byte *buf, byte len);
+											// Read up to len bytes from device addr into buf; return count read
+	boolean write(byte addr, const byte *buf, byte len);
+											// Write len bytes from buf to device addr; true if successful
+	boolean startRead(byte addr, byte len, uint32_t now);
+											// Start reading len bytes from device addr in the background at time 
+											//   now (μs); false if one is under way or len is too many
+	boolean busy(uint32_t now);				// Take the background read as far as it goes at time now (μs); true 
+											//   while it's still going
+	byte collect(byte *buf, byte len);		// Copy up to len bytes it read into buf and return the count; 0 if it 
+											//   failed, none was started, or it's still going
+	boolean recover();						// Free a stuck bus; true if SDA and SCL are both high afterward
+	uint16_t getTimeouts();					// Get the number of steps that have timed out
+	uint16_t getRecoveries();				// Get the number of bus recoveries done
+};
+
+#endif
+
+#endif
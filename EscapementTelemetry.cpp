@@ -0,0 +1,163 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementTelemetry.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See EscapementTelemetry.h for description.
+ *
+ ****/
+
+#include "EscapementTelemetry.h"
+
+#if defined(ARDUINO) || !defined(__AVR__)
+
+// Append v to p as an unsigned varint; return the new end
+static byte *putVarint(byte *p, uint32_t v) {
+	while (v >= 0x80) {
+		*p++ = (byte)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (byte)v;
+	return p;
+}
+
+// Return v zigzag encoded: 0, -1, 1, -2, ... as 0, 1, 2, 3, ...
+static uint32_t zigzag(int32_t v) {
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+// Append v to p as a zigzag-encoded signed varint; return the new end
+static byte *putSigned(byte *p, int32_t v) {
+	return putVarint(p, zigzag(v));
+}
+
+#if defined(ARDUINO)
+TelemetryRecorder::TelemetryRecorder(Print &p) {
+	out = &p;
+#else
+TelemetryRecorder::TelemetryRecorder(FILE *f) {
+	out = f;
+#endif
+	head = 0;
+	count = 0;
+	lastTime = 0;
+	lastTemp = 0;
+	lastFill = 0;
+	beatsToKey = 0;
+	dropped = 0;
+}
+
+void TelemetryRecorder::record(const beatRecord_t &r) {
+	byte frame[TLM_MAX_RECORD];
+	byte *p = frame + 3;					// Leave room for TLM_SYNC, length and the type byte
+	byte flags = 0;
+	if (r.type == REC_BEAT) {
+		uint32_t dt = r.time - lastTime;
+		if (beatsToKey == 0) {
+			flags = TLM_KEY;
+			for (byte i = 0; i < 4; i++) {
+				*p++ = (byte)(r.time >> (8 * i));
+			}
+			p = putSigned(p, r.value);
+			p = putSigned(p, r.temp);
+			p = putVarint(p, (uint32_t)r.aux);
+		} else {
+			p = putVarint(p, dt);
+			p = putSigned(p, r.value - (int32_t)dt);
+			if (r.temp != lastTemp || r.aux != lastFill) {
+				flags = TLM_CHANGED;
+				p = putSigned(p, r.temp - lastTemp);
+				p = putSigned(p, r.aux - lastFill);
+			}
+		}
+		p = putVarint(p, r.model == 0 ? 0 : zigzag(r.model - r.value) + 1);
+	} else {
+		p = putSigned(p, (int32_t)(r.time - lastTime));
+		p = putSigned(p, r.value);
+		p = putSigned(p, r.aux);
+		p = putSigned(p, r.temp);
+	}
+	frame[0] = TLM_SYNC;
+	frame[1] = (byte)(p - frame - 2);
+	frame[2] = (byte)((r.type << 5) | ((r.mode & 0x07) << 2) | flags);
+	if (enqueue(frame, p - frame)) {
+		if (r.type == REC_BEAT) {
+			lastTime = r.time;
+			lastTemp = r.temp;
+			lastFill = r.aux;
+			beatsToKey = beatsToKey == 0 ? TLM_KEY_BEATS - 1 : beatsToKey - 1;
+		}
+	} else if (r.type == REC_BEAT) {
+		beatsToKey = 0;						// The decoder lost track; the next beat has to be a key frame
+	}
+	service();
+}
+
+void TelemetryRecorder::recordSettings(const void *settings, unsigned int len) {
+	const byte *b = (const byte *)settings;
+	if (len > 254 || TLM_BUFFER - count < len + 4) {
+		dropped++;
+		return;
+	}
+	byte sum = (byte)(len + 1);
+	byte type = TLM_SETTINGS << 5;
+	put(TLM_SYNC);
+	put(sum);
+	put(type);
+	sum += type;
+	for (unsigned int i = 0; i < len; i++) {
+		put(b[i]);
+		sum += b[i];
+	}
+	put(sum);
+	service();
+}
+
+// Queue the frame's len bytes, adding the checksum; false (and counted as dropped) if there isn't room
+bool TelemetryRecorder::enqueue(const byte *frame, unsigned int len) {
+	if (TLM_BUFFER - count < len + 1) {
+		dropped++;
+		return false;
+	}
+	byte sum = 0;
+	for (unsigned int i = 0; i < len; i++) {
+		put(frame[i]);
+		if (i > 0) sum += frame[i];
+	}
+	put(sum);
+	return true;
+}
+
+void TelemetryRecorder::put(byte b) {
+	unsigned int ix = head + count;
+	if (ix >= TLM_BUFFER) ix -= TLM_BUFFER;
+	buf[ix] = b;
+	count++;
+}
+
+void TelemetryRecorder::service() {
+#if defined(ARDUINO)
+	int room = out->availableForWrite();
+#else
+	int room = count;
+#endif
+	while (room > 0 && count > 0) {
+#if defined(ARDUINO)
+		out->write(buf[head]);
+#else
+		fputc(buf[head], out);
+#endif
+		if (++head == TLM_BUFFER) head = 0;
+		count--;
+		room--;
+	}
+}
+
+uint32_t TelemetryRecorder::getDropped() {
+	return dropped;
+}
+
+#endif
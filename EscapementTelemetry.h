@@ -0,0 +1,89 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   EscapementTelemetry.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   A compact binary form of the Escapement's recording (see EscapementRecorder.h), for logging every beat over a 
+ *   slow serial line without holding up beat(). A TelemetryRecorder encodes each record into a small ring buffer 
+ *   and sends only as many bytes as the output can take without waiting. If the buffer fills, whole records are 
+ *   dropped and counted. extras/telemetry/decode turns the stream back into the text recording, which is CSV and 
+ *   which extras/replay can replay.
+ *
+ *   The stream is a sequence of frames:
+ *
+ *     TLM_SYNC  length  payload (length bytes)  checksum (the low byte of the sum of length and payload bytes)
+ *
+ *   The payload's first byte is the type (bits 7-5, REC_ENABLE .. REC_MODEL or TLM_SETTINGS), the mode (bits 4-2) 
+ *   and the flags TLM_KEY (bit 1) and TLM_CHANGED (bit 0). The rest is made of unsigned varints (seven bits per 
+ *   byte, low bits first, high bit set on all but the last byte) and signed ones (zigzag encoded, then as unsigned):
+ *
+ *     REC_BEAT, TLM_KEY     time (4 bytes, little-endian), deltaT, temp, bucket fill (unsigned), prediction
+ *     REC_BEAT              time - last beat's time (unsigned), deltaT - that, then, if TLM_CHANGED, temp -
+ *                           last beat's temp and bucket fill - last beat's, then prediction
+ *     other records         time - last beat's time, value, aux, temp
+ *     TLM_SETTINGS          the persistent parameters' bytes
+ *
+ *   The prediction (unsigned) is 0 if the record's model is, else the zigzag encoding of model - deltaT plus one, 
+ *   so that in RUN, where they're the same, it's a single byte.
+ *
+ *   A beat usually takes 9 to 11 bytes, under a third of its text line, and a key frame 16. At 9600 baud that is 
+ *   about 10 ms of sending, done by the serial interrupt while beat() goes on. Every TLM_KEY_BEATS beats, and 
+ *   after a dropped beat, the beat is sent with TLM_KEY so that a decoder can pick up the stream from there.
+ *
+ *   Waveforms (recordWave()) aren't sent.
+ *
+ ****/
+
+#ifndef EscapementTelemetry_H
+#define EscapementTelemetry_H
+
+#include "EscapementRecorder.h"
+
+#ifndef TLM_BUFFER
+#define TLM_BUFFER		(192)				// Size of the TelemetryRecorder's buffer (bytes); must hold the settings
+#endif
+#define TLM_KEY_BEATS	(64)				// Beats between key frames
+#define TLM_SYNC		(0xa5)				// First byte of a frame
+#define TLM_SETTINGS	(6)					// Frame type for the persistent parameters
+#define TLM_KEY			(0x02)				// Flag: beat values are absolute
+#define TLM_CHANGED		(0x01)				// Flag: beat temp and bucket fill deltas follow
+#define TLM_MAX_RECORD	(28)				// Longest frame other than TLM_SETTINGS
+
+#if defined(ARDUINO) || !defined(__AVR__)
+
+// Binary frames to an Arduino Print or a stdio FILE
+class TelemetryRecorder : public EscapementRecorder {
+private:
+#if defined(ARDUINO)
+	Print *out;
+#else
+	FILE *out;
+#endif
+	byte buf[TLM_BUFFER];					// Ring of bytes waiting to be sent
+	unsigned int head;						// Index in buf of the next byte to send
+	unsigned int count;						// Number of bytes waiting
+	uint32_t lastTime;						// The last beat sent's time, temp and bucket fill
+	int16_t lastTemp;
+	int32_t lastFill;
+	byte beatsToKey;						// Beats to go until the next key frame; 0 if the next is one
+	uint32_t dropped;						// Records dropped for lack of buffer space
+	bool enqueue(const byte *frame, unsigned int len);
+	void put(byte b);
+public:
+#if defined(ARDUINO)
+	TelemetryRecorder(Print &p);			// p must report availableForWrite(), as HardwareSerial does
+#else
+	TelemetryRecorder(FILE *f);
+#endif
+	void record(const beatRecord_t &r);
+	void recordSettings(const void *settings, unsigned int len);
+	void service();							// Send what can be sent without waiting; call from loop() too
+	uint32_t getDropped();					// Return the number of records dropped so far
+};
+
+#endif
+
+#endif
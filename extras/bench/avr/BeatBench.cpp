@@ -0,0 +1,123 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   BeatBench.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Benchmark firmware for an ATmega328P, meant to be run under simavr by simbench. It's built without the Arduino 
+ *   core and with ESCAPEMENT_PROBES defined, so the library marks its probe points in GPIOR0 (see EscapementHAL.h).
+ *
+ *   The Escapement runs on a BenchHAL, which stands in for the hardware with scripts: 
+ *
+ *     ADC           Each beat, quiet to start with and then a short rising and falling pulse, so detection takes 
+ *                   the same, small, number of conversions every beat. 
+ *     Timebase      Virtual: delay() and each conversion advance it, and the beats come out about a second long, 
+ *                   alternating slightly between tick and tock. No time is actually spent waiting.
+ *     I2C           A TMP102 whose temperature follows a script that walks the Escapement through every mode.
+ *     Storage       The real (well, simavr's) EEPROM, so EEPROM writes cost what they really do.
+ *
+ *   The script: cold start, WARMSTART, MODEL, and COLLECT at 18.0 C until that bucket is full, then MODEL and RUN; 
+ *   a move to 18.5 C, which puts it back in COLLECT; back to 18.0 C and RUN; a few beats of CALRTC; and a 
+ *   setBias(), which writes all of EEPROM. Then it marks BENCH_DONE and sleeps with interrupts off, which ends the 
+ *   simulation.
+ *
+ ****/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "Escapement.h"
+
+#define BENCH_DONE		(PROBE_USER | 0x7f)	// Probe id that tells simbench we're finished
+#define BENCH_T1		(12000)				// Beats at 18.0 C: enough to fill the bucket
+#define BENCH_T2		(14000)				// Then 18.5 C until this beat
+#define BENCH_BEATS		(16000)				// Then 18.0 C again until this beat
+#define BENCH_CALRTC	(16)				// Beats in CALRTC mode at the end
+#define BENCH_GROUP		(N_SAMPLES)			// Conversions in one of beat()'s averaging groups
+
+extern "C" void __cxa_pure_virtual() {		// Needed for virtual methods without the Arduino core
+	for (;;);
+}
+
+class BenchHAL : public EscapementHAL {
+private:
+	uint32_t now;							// Virtual time (μs)
+	uint16_t reads;							// Conversions so far this beat
+	uint16_t beats;							// Beats so far
+	EEPROMStore eepromStore;				// The (simulated) internal EEPROM
+public:
+	BenchHAL() {
+		now = 0;
+		reads = 0;
+		beats = 0;
+	}
+	// A quiet reading, then one averaging group of quiet, then a pulse: up, up, down
+	unsigned int adcRead(byte pin) {
+		(void)pin;
+		now += 112;
+		uint16_t r = reads++;
+		if (r <= BENCH_GROUP) return 0;
+		if (r <= 2 * BENCH_GROUP) return 100;
+		if (r <= 3 * BENCH_GROUP) return 200;
+		return 100;
+	}
+	uint32_t micros() {
+		return now;
+	}
+	// The settle delay at the start of each beat starts a new beat, about a second after the last one
+	void delay(uint32_t ms) {
+		now += ms * 1000;
+		if (ms == SETTLE_TIME) {
+			beats++;
+			reads = 0;
+			now += 700000UL + ((beats & 1) ? 2000 : 0) + (beats * 7919UL) % 200;
+		}
+	}
+	void pinMode(byte pin, byte mode) {
+		(void)pin;
+		(void)mode;
+	}
+	void digitalWrite(byte pin, byte value) {
+		(void)pin;
+		(void)value;
+	}
+	// A TMP102 following the script
+	byte i2cRead(byte addr, byte *buf, byte len) {
+		if (addr != ADDRESS_TMP102 || len < 2) return 0;
+		int16_t t = (beats >= BENCH_T1 && beats < BENCH_T2) ? 0x1280 : 0x1200;	// 18.5 C or 18.0 C
+		buf[0] = (byte)(t >> 8);
+		buf[1] = (byte)t;
+		return 2;
+	}
+	boolean i2cWrite(byte addr, const byte *buf, byte len) {
+		(void)addr;
+		(void)buf;
+		(void)len;
+		return true;
+	}
+	EscapementStore *store() {
+		return &eepromStore;
+	}
+};
+
+BenchHAL hal;
+Escapement e(&hal);
+
+int main() {
+	e.enable(COLDSTART);
+	for (uint16_t i = 0; i < BENCH_BEATS; i++) {
+		e.beat();
+	}
+	e.setRunMode(CALRTC);
+	for (uint16_t i = 0; i < BENCH_CALRTC; i++) {
+		e.beat();
+	}
+	e.setBias(10);
+	ESCAPEMENT_PROBE(BENCH_DONE);
+	cli();
+	sleep_enable();
+	sleep_cpu();
+	return 0;
+}
@@ -0,0 +1,19 @@
+#!/bin/sh
+#
+# Build the BeatBench firmware and the simbench runner, then run the benchmark. Needs avr-gcc, avr-libc and 
+# simavr (with its headers). Arguments are passed on to simbench, so
+#
+#   ./run.sh > baseline.txt       saves a baseline, and
+#   ./run.sh baseline.txt         compares against it, exiting with status 1 on a regression.
+#
+set -e
+cd "$(dirname "$0")"
+LIB=../../..
+CXXFLAGS="-mmcu=atmega328p -DF_CPU=16000000UL -Os -std=gnu++11 -fno-exceptions -fno-threadsafe-statics \
+	-ffunction-sections -fdata-sections -Wl,--gc-sections -DESCAPEMENT_PROBES"
+avr-g++ $CXXFLAGS -I$LIB BeatBench.cpp $LIB/Escapement.cpp $LIB/EscapementHAL.cpp $LIB/EscapementStore.cpp \
+	$LIB/EscapementSensor.cpp -o BeatBench.elf
+avr-size BeatBench.elf >&2
+cc -O2 -std=gnu99 $(pkg-config --cflags simavr 2>/dev/null) simbench.c \
+	$(pkg-config --libs simavr 2>/dev/null || echo -lsimavr) -lelf -o simbench
+./simbench BeatBench.elf "$@"
@@ -0,0 +1,196 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   simbench.c Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Runs the BeatBench firmware on a simulated ATmega328P using simavr and reports how many CPU cycles the 
+ *   instrumented parts of beat() take. It watches the writes the firmware makes to GPIOR0 (see ESCAPEMENT_PROBE in 
+ *   EscapementHAL.h) and timestamps each one with simavr's cycle counter, which is exact, so the numbers are the 
+ *   same from run to run.
+ *
+ *   What's reported, in cycles and in μs at 16 MHz:
+ *
+ *     Per state machine path, the time from PROBE_PROCESS (kick done) to PROBE_BEAT_END. That's the work beat() 
+ *     does between one beat's detection and being ready to look for the next. It includes reading the 
+ *     temperature, which is reported separately too. "(none)" is the first beat and beats rejected as too long, 
+ *     which return before the state machine.
+ *     The temperature read, PROBE_TEMP_START to PROBE_TEMP_END.
+ *     Writes to the persistent store, PROBE_STORE_START to PROBE_STORE_END.
+ *
+ *   Usage:  simbench firmware.elf [baseline]
+ *
+ *   The report's lines are "name count min mean max" and it can be saved and passed back as a baseline. With a 
+ *   baseline, any mean or max more than REGRESS_PCT percent worse than the baseline's is flagged, and simbench 
+ *   exits with status 1. That makes it usable as a check before flashing.
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+
+#define MCU				"atmega328p"
+#define F_CPU_HZ		(16000000UL)
+#define GPIOR0_ADDR		(0x3e)				// GPIOR0's data-space address (I/O address 0x1e)
+
+// These must agree with EscapementHAL.h, Escapement.h and BeatBench.cpp
+#define PROBE_BEAT_START	(0x01)
+#define PROBE_DETECTED		(0x02)
+#define PROBE_PROCESS		(0x03)
+#define PROBE_BEAT_END		(0x04)
+#define PROBE_TEMP_START	(0x05)
+#define PROBE_TEMP_END		(0x06)
+#define PROBE_STORE_START	(0x07)
+#define PROBE_STORE_END		(0x08)
+#define PROBE_MODE			(0x10)
+#define BENCH_DONE			(0xff)
+
+#define N_MODES			(7)					// COLDSTART .. CALRTC
+#define S_NONE			(N_MODES)			// Index of the "(none)" path
+#define S_TEMP			(N_MODES + 1)		// Index of the temperature read stats
+#define S_STORE			(N_MODES + 2)		// Index of the store write stats
+#define N_STATS			(N_MODES + 3)
+#define REGRESS_PCT		(5)					// How much worse than the baseline counts as a regression
+
+typedef struct {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+} stat_t;
+
+static const char *statName[N_STATS] = {
+	"COLDSTART", "WARMSTART", "CALIBRATE", "COLLECT", "MODEL", "RUN", "CALRTC", "(none)", "temp-read", "store-write"
+};
+static stat_t stats[N_STATS];
+static int mode;							// Path the current beat is taking (-1 if none yet)
+static uint64_t processAt, tempAt, storeAt;	// Cycle counts at the matching start probes (0 if not started)
+static int done;
+
+static void record(int ix, uint64_t cycles) {
+	stat_t *s = &stats[ix];
+	if (s->count == 0 || cycles < s->min) s->min = cycles;
+	if (cycles > s->max) s->max = cycles;
+	s->total += cycles;
+	s->count++;
+}
+
+// Called by simavr for every write to GPIOR0
+static void onProbe(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+	uint64_t now = avr->cycle;
+	(void)addr;
+	(void)param;
+	if ((v & 0xf0) == PROBE_MODE) {
+		mode = v & 0x0f;
+		return;
+	}
+	switch (v) {
+	case PROBE_PROCESS:
+		processAt = now;
+		mode = -1;
+		break;
+	case PROBE_BEAT_END:
+		if (processAt != 0) record(mode >= 0 && mode < N_MODES ? mode : S_NONE, now - processAt);
+		processAt = 0;
+		break;
+	case PROBE_TEMP_START:
+		tempAt = now;
+		break;
+	case PROBE_TEMP_END:
+		if (tempAt != 0) record(S_TEMP, now - tempAt);
+		tempAt = 0;
+		break;
+	case PROBE_STORE_START:
+		storeAt = now;
+		break;
+	case PROBE_STORE_END:
+		if (storeAt != 0) record(S_STORE, now - storeAt);
+		storeAt = 0;
+		break;
+	case BENCH_DONE:
+		done = 1;
+		break;
+	}
+}
+
+static double toMicros(double cycles) {
+	return cycles * 1e6 / F_CPU_HZ;
+}
+
+// Compare against a saved report; return the number of regressions
+static int compare(const char *path) {
+	FILE *f = fopen(path, "r");
+	char name[32];
+	unsigned long long count, min, mean, max;
+	int regressions = 0;
+	if (f == NULL) {
+		fprintf(stderr, "simbench: can't open baseline %s\n", path);
+		exit(2);
+	}
+	while (fscanf(f, "%31s %llu %llu %llu %llu%*[^\n]", name, &count, &min, &mean, &max) == 5) {
+		for (int i = 0; i < N_STATS; i++) {
+			if (strcmp(name, statName[i]) != 0 || stats[i].count == 0) continue;
+			uint64_t newMean = stats[i].total / stats[i].count;
+			if (newMean * 100 > mean * (100 + REGRESS_PCT) || stats[i].max * 100 > max * (100 + REGRESS_PCT)) {
+				printf("REGRESSION %-12s mean %llu -> %llu, max %llu -> %llu cycles\n", name, mean, 
+					(unsigned long long)newMean, max, (unsigned long long)stats[i].max);
+				regressions++;
+			}
+		}
+	}
+	fclose(f);
+	return regressions;
+}
+
+int main(int argc, char *argv[]) {
+	elf_firmware_t fw;
+	avr_t *avr;
+	int state = cpu_Running;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s firmware.elf [baseline]\n", argv[0]);
+		return 2;
+	}
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[1], &fw) != 0) {
+		fprintf(stderr, "simbench: can't read %s\n", argv[1]);
+		return 2;
+	}
+	avr = avr_make_mcu_by_name(MCU);
+	if (avr == NULL) {
+		fprintf(stderr, "simbench: simavr doesn't know the %s\n", MCU);
+		return 2;
+	}
+	avr_init(avr);
+	avr->frequency = F_CPU_HZ;
+	avr_load_firmware(avr, &fw);
+	avr_register_io_write(avr, GPIOR0_ADDR, onProbe, NULL);
+	mode = -1;
+
+	while (!done && state != cpu_Done && state != cpu_Crashed) {
+		state = avr_run(avr);
+	}
+	if (!done) {
+		fprintf(stderr, "simbench: firmware stopped before finishing (state %d)\n", state);
+		return 2;
+	}
+
+	printf("# %llu cycles (%.3f s at 16 MHz)\n", (unsigned long long)avr->cycle, (double)avr->cycle / F_CPU_HZ);
+	printf("# %-10s %8s %8s %8s %8s %10s %10s\n", "name", "count", "min", "mean", "max", "mean us", "max us");
+	for (int i = 0; i < N_STATS; i++) {
+		stat_t *s = &stats[i];
+		if (s->count == 0) continue;
+		printf("%-12s %8llu %8llu %8llu %8llu %10.1f %10.1f\n", statName[i], (unsigned long long)s->count, 
+			(unsigned long long)s->min, (unsigned long long)(s->total / s->count), (unsigned long long)s->max, 
+			toMicros((double)s->total / s->count), toMicros((double)s->max));
+	}
+	if (argc > 2 && compare(argv[2]) > 0) return 1;
+	return 0;
+}
@@ -0,0 +1,393 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   microbench.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Host microbenchmarks for the arithmetic kernels in EscapementMath.h, each run over a representative, fixed
+ *   (pseudo-random but repeatable) set of inputs:
+ *
+ *     bias       escBiasCorrect(): beats of 0.5 to 2 s, biases of -50 to +50 s/day, and one input in 16 a gap 
+ *                of 2 to 16 s with a bias of -500 to +500 s/day, as on a ceramic resonator's clock
+ *     tempix     escTempIx(): temperatures of 10 to 35 C
+ *     average    escRunningAverage(): one COLLECT bucket's worth of beats (8193), as beat() measures them
+ *     fit        escFitLinear(): tables with 1 to TEMP_STEPS complete buckets on a slope of -40 to +40 μs/C
+ *     model      escModelUspb(): temperatures of 10 to 35 C and speed adjustments of -60 to +60 s/day. The 
+ *                "knots" variant is escModelKnots(), which RUN uses, on the same lines given as knots.
+ *
+ *   Alongside each library kernel ("lib") are alternatives -- float versions of the fixed-point ones, fixed-point
+ *   versions of the float ones, and so on -- so they can be compared. For each it reports the number of operations
+ *   timed, the time per operation in ns, and the largest difference from the answer computed in double precision
+ *   ("err", in the kernel's units: μs, buckets, or for fit, μs of model output across the temperature range). For
+ *   average, the error is that of the final average after a whole bucket, which is what matters to calibration.
+ *
+ *   Host timings only rank the variants; on an ATmega, 32-bit division and float are both done in software and
+ *   the ratios differ. Use extras/bench/avr for cycle counts there.
+ *
+ *   Build: g++ -O2 -I../../.. microbench.cpp -o microbench
+ *   Usage: microbench [kernel...]     (default: all of them)
+ *
+ ****/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "Escapement.h"
+
+#define N_INPUTS		(4096)				// Inputs per kernel (a power of 2)
+#define MIN_NS			(200000000LL)		// Time each variant for at least this long (ns)
+
+static int32_t sink;						// Results go here so the optimizer can't drop the work
+
+// A small, repeatable pseudo-random number generator; returns a value in [lo, hi]
+static uint32_t rngState = 12345;
+static int32_t rnd(int32_t lo, int32_t hi) {
+	rngState = rngState * 1664525UL + 1013904223UL;
+	return lo + (int32_t)((rngState >> 8) % (uint32_t)(hi - lo + 1));
+}
+
+static long long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Run pass (which does opsPerPass operations) until MIN_NS have gone by; report the result
+template <typename F> static void timeIt(const char *kernel, const char *variant, long opsPerPass, double err,
+		F pass) {
+	long long ops = 0;
+	long long start = nowNs();
+	long long elapsed;
+	do {
+		pass();
+		ops += opsPerPass;
+		elapsed = nowNs() - start;
+	} while (elapsed < MIN_NS);
+	printf("%-8s %-10s %12lld %10.2f %12.3f\n", kernel, variant, ops, (double)elapsed / ops, err);
+}
+
+/*
+ *
+ * bias: correcting a measured beat for the real-time clock's error
+ *
+ */
+
+static int32_t biasFloat(int32_t deltaT, int16_t bias) {
+	return deltaT + (int32_t)lroundf(deltaT * (bias / 864000.0f));
+}
+
+static int32_t biasWide(int32_t deltaT, int16_t bias) {		// 64-bit intermediate always
+	int64_t n = (int64_t)bias * deltaT;
+	return deltaT + (int32_t)((n + (n < 0 ? -432000 : 432000)) / 864000);
+}
+
+static int32_t biasRecip(int32_t deltaT, int16_t bias) {	// Multiply by 2^40 / 864000 instead of dividing
+	return deltaT + (int32_t)(((int64_t)bias * deltaT * 1272582LL + (1LL << 39)) >> 40);
+}
+
+static void benchBias() {
+	static int32_t dt[N_INPUTS];
+	static int16_t b[N_INPUTS];
+	for (int i = 0; i < N_INPUTS; i++) {
+		bool gap = i % 16 == 0;
+		dt[i] = gap ? rnd(2000000, 16000000) : rnd(500000, 2000000);
+		b[i] = gap ? rnd(-5000, 5000) : rnd(-500, 500);
+	}
+	struct { const char *name; int32_t (*f)(int32_t, int16_t); } v[] = {
+		{"lib", escBiasCorrect}, {"float", biasFloat}, {"wide", biasWide}, {"recip", biasRecip}
+	};
+	for (unsigned k = 0; k < sizeof(v) / sizeof(v[0]); k++) {
+		double err = 0;
+		for (int i = 0; i < N_INPUTS; i++) {
+			double exact = dt[i] + dt[i] * (b[i] / 864000.0);
+			err = fmax(err, fabs(v[k].f(dt[i], b[i]) - exact));
+		}
+		timeIt("bias", v[k].name, N_INPUTS, err, [&]() {
+			int32_t s = 0;
+			for (int i = 0; i < N_INPUTS; i++) s += v[k].f(dt[i], b[i]);
+			sink += s;
+		});
+	}
+}
+
+/*
+ *
+ * tempix: finding a temperature's bucket
+ *
+ */
+
+static int tempIxDivide(int t, int tempMin, int steps, int res) {	// 16 bits, divide; truncates rather than floors
+	int width = 256 / res;
+	t = ((t + width / 2) / width) - (res * tempMin);
+	return (t >= 0 && t < steps) ? t : -1;
+}
+
+static int tempIxFloat(int t, int tempMin, int steps, int res) {
+	t = (int)floorf(t * res / 256.0f + 0.5f) - (res * tempMin);
+	return (t >= 0 && t < steps) ? t : -1;
+}
+
+static void benchTempIx() {
+	static int t[N_INPUTS];
+	for (int i = 0; i < N_INPUTS; i++) t[i] = rnd(10 * 256, 35 * 256);
+	struct { const char *name; int (*f)(int, int, int, int); } v[] = {
+		{"lib", escTempIx}, {"divide", tempIxDivide}, {"float", tempIxFloat}
+	};
+	for (unsigned k = 0; k < sizeof(v) / sizeof(v[0]); k++) {
+		double err = 0;
+		for (int i = 0; i < N_INPUTS; i++) {
+			int exact = (int)floor(t[i] * TEMP_RES / 256.0 + 0.5) - TEMP_RES * TEMP_MIN;
+			if (exact < 0 || exact >= TEMP_STEPS) exact = -1;
+			err = fmax(err, abs(v[k].f(t[i], TEMP_MIN, TEMP_STEPS, TEMP_RES) - exact));
+		}
+		timeIt("tempix", v[k].name, N_INPUTS, err, [&]() {
+			int32_t s = 0;
+			for (int i = 0; i < N_INPUTS; i++) s += v[k].f(t[i], TEMP_MIN, TEMP_STEPS, TEMP_RES);
+			sink += s;
+		});
+	}
+}
+
+/*
+ *
+ * average: the COLLECT running average over one bucket's worth of beats
+ *
+ * Each variant keeps whatever state it needs in an avgState_t and is fed the same beats. The library's version
+ * carries the remainder of each division to the next update, so it's exact; "trunc", the form it replaced, just
+ * truncates each update, so once n is larger than the difference between a beat and the average, updates stop
+ * having any effect and the average freezes wherever it was.
+ *
+ * The beats are what beat() measures: it sees the magnet in averaging groups of N_SAMPLES conversions, counted
+ * from when it started looking, a fixed time after the last detection, so a beat's measured length is a fixed
+ * time plus a whole number of groups (3.92 ms at VT_ADC_TIME). With the ticks and tocks of a real escapement a
+ * little unequal, the measured beats alternate between lengths a group apart.
+ *
+ */
+
+#define AVG_GROUP		(N_SAMPLES * 112)	// Length of one of beat()'s averaging groups (μs)
+#define AVG_LEAD		(300000)			// Time from a detection to the start of the next search (μs)
+
+struct avgState_t {
+	int32_t avg;							// The running average (μs)
+	int16_t rem;							// For "lib": carried remainder of the divisions
+	float favg;								// For "float": the running average as a float
+};
+
+static void avgLib(avgState_t &s, int32_t sample, uint16_t n) {
+	s.avg = escRunningAverage(s.avg, sample, n, &s.rem);
+}
+
+static void avgTrunc(avgState_t &s, int32_t sample, uint16_t n) {
+	s.avg += (sample - s.avg) / (int32_t)n;
+}
+
+static void avgFloat(avgState_t &s, int32_t sample, uint16_t n) {
+	s.favg += (sample - s.favg) / n;
+	s.avg = (int32_t)lroundf(s.favg);
+}
+
+static void benchAverage() {
+	static int32_t beat[TGT_SAMPLES + 1];
+	double sum = 0;
+	int64_t pass = 0;							// When the magnet passed (μs)
+	int64_t seen = 0;							// When beat() saw it
+	for (int i = 0; i <= TGT_SAMPLES; i++) {
+		pass += 1000000 + ((i & 1) ? 700 : -700) + rnd(-100, 100);	// Tick and tock 1.4 ms apart, plus noise
+		int64_t start = seen + AVG_LEAD;
+		int64_t next = start + (pass - start + AVG_GROUP - 1) / AVG_GROUP * AVG_GROUP;
+		beat[i] = (int32_t)(next - seen);
+		seen = next;
+		sum += beat[i];
+	}
+	double exact = sum / (TGT_SAMPLES + 1);
+	struct { const char *name; void (*f)(avgState_t&, int32_t, uint16_t); } v[] = {
+		{"lib", avgLib}, {"trunc", avgTrunc}, {"float", avgFloat}
+	};
+	for (unsigned k = 0; k < sizeof(v) / sizeof(v[0]); k++) {
+		avgState_t s = {0, 0, 0.0f};
+		for (int i = 0; i <= TGT_SAMPLES; i++) v[k].f(s, beat[i], i + 1);
+		double err = fabs(s.avg - exact);
+		timeIt("average", v[k].name, TGT_SAMPLES + 1, err, [&]() {
+			avgState_t s = {0, 0, 0.0f};
+			for (int i = 0; i <= TGT_SAMPLES; i++) v[k].f(s, beat[i], i + 1);
+			sink += s.avg;
+		});
+	}
+}
+
+/*
+ *
+ * fit: the MODEL least-squares fit
+ *
+ */
+
+struct table_t {
+	int32_t base;
+	int16_t offset[TEMP_STEPS];
+	uint16_t count[TEMP_STEPS];
+};
+
+// Fixed point: x measured in buckets from the first, sums in 64 bits, then converted to the library's form
+static int fitFixed(int32_t uspbBase, const int16_t uspbOffset[], const uint16_t sampleCount[], int tempMin,
+		int steps, int res, uint16_t minSamples, int32_t *slope, int32_t *yIntercept) {
+	int shift = escTempShift(res);				// A bucket is 1 << shift units of temp
+	int64_t xSum = 0, ySum = 0, xxSum = 0, xySum = 0;
+	int count = 0;
+	for (int i = 0; i < steps; i++) {
+		if (sampleCount[i] > minSamples) {
+			count++;
+			xSum += i;
+			ySum += uspbOffset[i];
+			xxSum += i * i;
+			xySum += (int64_t)i * uspbOffset[i];
+		}
+	}
+	if (count > 0) {
+		int64_t den = count * xxSum - xSum * xSum;
+		// Slope per bucket * 4096 is per unit temp * 4096 * (1 << shift), so scale by 4096 >> shift
+		int32_t m = den == 0 ? 0 : (int32_t)(((count * xySum - xSum * ySum) * (4096 >> shift)) / den);
+		*slope = m;
+		*yIntercept = uspbBase + (int32_t)((ySum * 4096 - ((int64_t)m * xSum << shift)) / (4096LL * count)) -
+			(int32_t)((int64_t)m * ((int32_t)tempMin << 8) / 4096);
+	}
+	return count;
+}
+
+static void fitDouble(const table_t &t, double &m, double &b) {
+	double xSum = 0, ySum = 0, xxSum = 0, xySum = 0;
+	int count = 0;
+	for (int i = 0; i < TEMP_STEPS; i++) {
+		if (t.count[i] > TGT_SAMPLES) {
+			double x = escBucketTemp(i, TEMP_MIN, TEMP_RES);
+			double y = t.base + t.offset[i];
+			count++;
+			xSum += x;
+			ySum += y;
+			xxSum += x * x;
+			xySum += x * y;
+		}
+	}
+	m = count > 1 ? (count * xySum - xSum * ySum) / (count * xxSum - xSum * xSum) : 0;
+	b = (ySum - m * xSum) / count;
+}
+
+static void benchFit() {
+	static const int N_TABLES = 256;
+	static table_t table[N_TABLES];
+	for (int k = 0; k < N_TABLES; k++) {
+		table_t &t = table[k];
+		int32_t slope = rnd(-40, 40);		// μs per degree C
+		t.base = rnd(900000, 1100000);
+		int complete = rnd(1, TEMP_STEPS);
+		for (int i = 0; i < TEMP_STEPS; i++) {
+			t.offset[i] = slope * i / 2 + rnd(-5, 5);
+			t.count[i] = (rnd(0, TEMP_STEPS - 1) < complete) ? TGT_SAMPLES + 1 : rnd(1, TGT_SAMPLES);
+		}
+		t.count[rnd(0, TEMP_STEPS - 1)] = TGT_SAMPLES + 1;
+	}
+	struct { const char *name; int (*f)(int32_t, const int16_t[], const uint16_t[], int, int, int, uint16_t, 
+		int32_t*, int32_t*); } v[] = {
+		{"lib", escFitLinear}, {"fixed", fitFixed}
+	};
+	for (unsigned k = 0; k < sizeof(v) / sizeof(v[0]); k++) {
+		double err = 0;
+		for (int j = 0; j < N_TABLES; j++) {
+			const table_t &t = table[j];
+			int32_t slope = 0, yIntercept = 0;
+			double m, b;
+			v[k].f(t.base, t.offset, t.count, TEMP_MIN, TEMP_STEPS, TEMP_RES, TGT_SAMPLES, &slope, &yIntercept);
+			fitDouble(t, m, b);
+			for (int i = 0; i < TEMP_STEPS; i++) {
+				int temp = escBucketTemp(i, TEMP_MIN, TEMP_RES);
+				err = fmax(err, fabs((double)slope * temp / 4096 + yIntercept - (m * temp + b)));
+			}
+		}
+		timeIt("fit", v[k].name, N_TABLES, err, [&]() {
+			int32_t s = 0;
+			for (int j = 0; j < N_TABLES; j++) {
+				int32_t slope = 0, yIntercept = 0;
+				const table_t &t = table[j];
+				v[k].f(t.base, t.offset, t.count, TEMP_MIN, TEMP_STEPS, TEMP_RES, TGT_SAMPLES, &slope, &yIntercept);
+				s += slope + yIntercept;
+			}
+			sink += s;
+		});
+	}
+}
+
+/*
+ *
+ * model: evaluating the model in RUN mode
+ *
+ */
+
+static int32_t modelFloat(int32_t slope, int32_t yIntercept, int16_t temp, int32_t speedAdj) {
+	float uspb = slope / 4096.0f * temp + yIntercept;
+	return (int32_t)lroundf(uspb * (1.0f + speedAdj / 864000.0f));
+}
+
+static int32_t modelWide(int32_t slope, int32_t yIntercept, int16_t temp, int32_t speedAdj) {
+	int32_t uspb = (int32_t)(((int64_t)slope * temp) >> 12) + yIntercept;	// Floors rather than truncates
+	return uspb + (int32_t)((int64_t)uspb * speedAdj / 864000);
+}
+
+static void benchModel() {
+	static int32_t m[N_INPUTS], b[N_INPUTS], adj[N_INPUTS];
+	static int16_t t[N_INPUTS];
+	for (int i = 0; i < N_INPUTS; i++) {
+		m[i] = rnd(-1280, 1280);			// ±40 μs per degree C
+		b[i] = rnd(900000, 1100000);
+		t[i] = rnd(10 * 256, 35 * 256);
+		adj[i] = rnd(-600, 600);
+	}
+	struct { const char *name; int32_t (*f)(int32_t, int32_t, int16_t, int32_t); } v[] = {
+		{"lib", escModelUspb}, {"float", modelFloat}, {"wide", modelWide}
+	};
+	for (unsigned k = 0; k < sizeof(v) / sizeof(v[0]); k++) {
+		double err = 0;
+		for (int i = 0; i < N_INPUTS; i++) {
+			double exact = (m[i] / 4096.0 * t[i] + b[i]) * (1.0 + adj[i] / 864000.0);
+			err = fmax(err, fabs(v[k].f(m[i], b[i], t[i], adj[i]) - exact));
+		}
+		timeIt("model", v[k].name, N_INPUTS, err, [&]() {
+			int32_t s = 0;
+			for (int i = 0; i < N_INPUTS; i++) s += v[k].f(m[i], b[i], t[i], adj[i]);
+			sink += s;
+		});
+	}
+	static int32_t knots[N_INPUTS][TEMP_STEPS];
+	double err = 0;
+	for (int i = 0; i < N_INPUTS; i++) {
+		for (int j = 0; j < TEMP_STEPS; j++) {
+			knots[i][j] = lround((m[i] / 4096.0 * escBucketTemp(j, TEMP_MIN, TEMP_RES) + b[i]) * 16.0);
+		}
+		double exact = (m[i] / 4096.0 * t[i] + b[i]) * (1.0 + adj[i] / 864000.0);
+		err = fmax(err, fabs(escModelKnots(knots[i], TEMP_STEPS, TEMP_MIN, TEMP_RES, t[i], 0, adj[i]) - exact));
+	}
+	timeIt("model", "knots", N_INPUTS, err, [&]() {
+		int32_t s = 0;
+		for (int i = 0; i < N_INPUTS; i++) {
+			s += escModelKnots(knots[i], TEMP_STEPS, TEMP_MIN, TEMP_RES, t[i], 0, adj[i]);
+		}
+		sink += s;
+	});
+}
+
+int main(int argc, char *argv[]) {
+	struct { const char *name; void (*run)(); } kernels[] = {
+		{"bias", benchBias}, {"tempix", benchTempIx}, {"average", benchAverage}, {"fit", benchFit},
+		{"model", benchModel}
+	};
+	printf("%-8s %-10s %12s %10s %12s\n", "kernel", "variant", "ops", "ns/op", "err");
+	for (unsigned k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		bool wanted = argc < 2;
+		for (int a = 1; a < argc; a++) {
+			if (strcmp(argv[a], kernels[k].name) == 0) wanted = true;
+		}
+		if (wanted) kernels[k].run();
+	}
+	return sink == 0x7fffffff;				// Never true in practice; keeps sink live
+}
@@ -0,0 +1,255 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   detect.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Run the coil waveforms captured in a recording (see Escapement::setWaveCapture() and EscapementRecorder.h) 
+ *   through the magnet detector and variants of it, and compare them.
+ *
+ *   The variants:
+ *
+ *     beat()       The library's own detector: an Escapement on a WaveHAL, which plays the captured readings 
+ *                  back to beat() and notes which reading it was on when beat() asked for the time.
+ *     groups-N     The same algorithm written out, averaging groups of N readings instead of N_SAMPLES. 
+ *                  groups-35 should agree exactly with beat() when N_SAMPLES is 35.
+ *     peak         The peak of the readings smoothed by a SMOOTH-reading moving average, located to a fraction of a 
+ *                  reading by fitting a parabola through the highest smoothed reading and its neighbours.
+ *     rise         When the smoothed readings first rise through half their peak, interpolated linearly.
+ *
+ *   Each reading is taken to have been made at a time interpolated from the capture's span and count of readings, 
+ *   the last one just before topTime. A detector's timestamps then give a series of beat durations. What matters 
+ *   for timekeeping is the random part of the error in the timestamps, so for each variant the report gives:
+ *
+ *     jitter       The standard deviation of the timestamp error, estimated from the durations d[k] as the 
+ *                  standard deviation of d[k] - d[k-2] divided by 2. (For white timestamp noise, d[k] - d[k-2] has 
+ *                  four times its variance.) Real changes in the pendulum's period inflate it slightly.
+ *     offset       The mean difference between the variant's timestamps and beat()'s (μs).
+ *     missed       Waveforms in which the variant found nothing.
+ *     ns/wave      Host CPU time per waveform.
+ *
+ *   Only runs of consecutive captured beats count toward jitter, so record with capture on from the start.
+ *
+ *   Build (from this directory):
+ *     g++ -O2 -I../.. detect.cpp ../../Escapement.cpp ../../EscapementHAL.cpp ../../EscapementStore.cpp \
+ *         ../../EscapementSensor.cpp -o detect
+ *
+ *   Usage: detect recording
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include "Escapement.h"
+
+#define SMOOTH			(8)					// Readings in the moving average used by peak and rise
+#define MAX_LINE		(65536)				// Longest line in a recording
+
+struct wave_t {
+	uint32_t time;							// topTime (μs)
+	double dt;								// Time between readings (μs)
+	std::vector<uint16_t> s;				// The readings, oldest first
+};
+
+// Plays a captured waveform to beat(): a quiet reading for the noise floor wait, then the capture, then quiet
+class WaveHAL : public HostHAL {
+public:
+	const wave_t *wave;
+	long next;								// Index of the next reading; -1 for the noise floor reading
+	long detected;							// Index of the last reading before micros() was called
+	unsigned int adcRead(byte pin) {
+		(void)pin;
+		long i = next++;
+		return (i >= 0 && i < (long)wave->s.size()) ? wave->s[i] : 0;
+	}
+	uint32_t micros() {
+		detected = next - 1;
+		return (uint32_t)next;
+	}
+	void delay(uint32_t ms) {
+		(void)ms;
+	}
+};
+
+// The library's detector; returns the index of the reading at which it detected the magnet
+static double detectBeat(const wave_t &w) {
+	static WaveHAL hal;
+	static Escapement e(&hal);
+	static bool enabled = false;
+	if (!enabled) {
+		e.enable(COLDSTART);
+		enabled = true;
+	}
+	hal.wave = &w;
+	hal.next = -1;
+	hal.detected = -1;
+	e.beat();
+	return hal.detected < (long)w.s.size() ? hal.detected : -1;
+}
+
+// beat()'s algorithm with groups of n readings; the capture starts at a group boundary
+static double detectGroups(const wave_t &w, int n) {
+	unsigned long curr = 0, past;
+	long i = 0;
+	long size = (long)w.s.size();
+	do {
+		past = curr;
+		curr = 0;
+		for (int k = 0; k < n; k++, i++) {
+			curr += i < size ? w.s[i] : 0;
+		}
+		curr /= n * NOISE_SIZE;
+	} while (curr >= past);
+	return i - 1 < size ? i - 1 : -1;
+}
+static double detectGroups35(const wave_t &w) { return detectGroups(w, 35); }
+static double detectGroups17(const wave_t &w) { return detectGroups(w, 17); }
+static double detectGroups8(const wave_t &w) { return detectGroups(w, 8); }
+
+// Moving average of SMOOTH readings, centered (so m[i] is centered on reading i + (SMOOTH - 1) / 2)
+static void smooth(const wave_t &w, std::vector<double> &m) {
+	m.clear();
+	double sum = 0.0;
+	for (size_t i = 0; i < w.s.size(); i++) {
+		sum += w.s[i];
+		if (i >= SMOOTH) sum -= w.s[i - SMOOTH];
+		if (i >= SMOOTH - 1) m.push_back(sum / SMOOTH);
+	}
+}
+
+static double detectPeak(const wave_t &w) {
+	std::vector<double> m;
+	smooth(w, m);
+	if (m.size() < 3) return -1;
+	size_t p = 1;
+	for (size_t i = 1; i + 1 < m.size(); i++) {
+		if (m[i] > m[p]) p = i;
+	}
+	double den = m[p - 1] - 2.0 * m[p] + m[p + 1];
+	double frac = den == 0.0 ? 0.0 : 0.5 * (m[p - 1] - m[p + 1]) / den;
+	return p + frac + (SMOOTH - 1) / 2.0;
+}
+
+static double detectRise(const wave_t &w) {
+	std::vector<double> m;
+	smooth(w, m);
+	if (m.empty()) return -1;
+	double peak = 0.0;
+	for (size_t i = 0; i < m.size(); i++) peak = fmax(peak, m[i]);
+	double half = peak / 2.0;
+	for (size_t i = 1; i < m.size(); i++) {
+		if (m[i - 1] < half && m[i] >= half) {
+			return i - 1 + (half - m[i - 1]) / (m[i] - m[i - 1]) + (SMOOTH - 1) / 2.0;
+		}
+	}
+	return -1;
+}
+
+static bool parseWave(const char *line, wave_t &w) {
+	unsigned long time, span, reads;
+	unsigned int n;
+	int used;
+	if (sscanf(line, "W,%lu,%lu,%lu,%u,%n", &time, &span, &reads, &n, &used) != 4 || reads == 0) return false;
+	w.time = (uint32_t)time;
+	w.dt = (double)span / reads;
+	w.s.clear();
+	const char *p = line + used;
+	for (unsigned int i = 0; i < n; i++) {
+		char *end;
+		unsigned long v = strtoul(p, &end, 10);
+		if (end == p) return false;
+		w.s.push_back((uint16_t)v);
+		p = end;
+	}
+	return true;
+}
+
+static long long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s recording\n", argv[0]);
+		return 2;
+	}
+	FILE *in = fopen(argv[1], "r");
+	if (in == NULL) {
+		fprintf(stderr, "detect: can't open %s\n", argv[1]);
+		return 2;
+	}
+	std::vector<wave_t> waves;
+	std::vector<bool> follows;				// Whether each wave's beat directly follows the previous wave's
+	static char line[MAX_LINE];
+	bool chained = false;					// Whether the last beat had a waveform
+	bool waveThisBeat = false;				// Whether this one has
+	while (fgets(line, sizeof(line), in) != NULL) {
+		wave_t w;
+		if (parseWave(line, w)) {			// A beat's waveform comes just before its B record
+			follows.push_back(chained);
+			waves.push_back(w);
+			waveThisBeat = true;
+		} else if (line[0] == 'B') {
+			chained = waveThisBeat;
+			waveThisBeat = false;
+		}
+	}
+	fclose(in);
+	printf("%lu waveforms\n", (unsigned long)waves.size());
+	if (waves.empty()) return 1;
+
+	struct { const char *name; double (*f)(const wave_t &); } v[] = {
+		{"beat()", detectBeat}, {"groups-35", detectGroups35}, {"groups-17", detectGroups17}, 
+		{"groups-8", detectGroups8}, {"peak", detectPeak}, {"rise", detectRise}
+	};
+	const int nv = sizeof(v) / sizeof(v[0]);
+	std::vector<double> ref;				// beat()'s timestamps
+	printf("%-10s %10s %10s %8s %10s\n", "variant", "jitter us", "offset us", "missed", "ns/wave");
+	for (int k = 0; k < nv; k++) {
+		std::vector<double> t(waves.size());
+		unsigned long missed = 0;
+		long long start = nowNs();
+		for (size_t i = 0; i < waves.size(); i++) {
+			t[i] = v[k].f(waves[i]);
+		}
+		long long ns = nowNs() - start;
+		for (size_t i = 0; i < waves.size(); i++) {
+			const wave_t &w = waves[i];
+			if (t[i] < 0) {
+				missed++;
+				t[i] = NAN;
+			} else {						// Index to time relative to topTime, which is just after the last reading
+				t[i] = -(w.s.size() - 1 - t[i]) * w.dt;
+			}
+		}
+		if (k == 0) ref = t;
+		double sum = 0.0, sumSq = 0.0, offset = 0.0;
+		unsigned long n = 0, nOffset = 0;
+		for (size_t i = 3; i < t.size(); i++) {
+			if (!follows[i] || !follows[i - 1] || !follows[i - 2]) continue;
+			double dd = ((uint32_t)(waves[i].time - waves[i - 1].time) + t[i] - t[i - 1]) - 
+				((uint32_t)(waves[i - 2].time - waves[i - 3].time) + t[i - 2] - t[i - 3]);
+			if (isnan(dd)) continue;
+			sum += dd;
+			sumSq += dd * dd;
+			n++;
+		}
+		for (size_t i = 0; i < t.size(); i++) {
+			if (isnan(t[i]) || isnan(ref[i])) continue;
+			offset += t[i] - ref[i];
+			nOffset++;
+		}
+		double jitter = n > 1 ? sqrt((sumSq - sum * sum / n) / (n - 1)) / 2.0 : NAN;
+		printf("%-10s %10.1f %10.1f %8lu %10.0f\n", v[k].name, jitter, nOffset ? offset / nOffset : NAN, missed, 
+			(double)ns / waves.size());
+	}
+	return 0;
+}
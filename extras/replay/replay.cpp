@@ -0,0 +1,264 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   replay.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Replay a recording made with a PrintRecorder or FileRecorder (see EscapementRecorder.h) through 
+ *   Escapement::beat() and compare what this build of the library makes of the inputs with what the recorded one 
+ *   did. The Escapement runs on a ReplayHAL, which plays back the recorded real-time clock times and temperature 
+ *   readings (through a SimSensor); the recorded settings, temperature range, mode changes and clock adjustments 
+ *   are applied as they come.
+ *
+ *   Reported:
+ *
+ *     The number of beats whose deltaT, resulting run mode or model prediction differ, and the largest deltaT 
+ *     difference. Unless -q is given, the first MAX_SHOWN differing beats are listed. Recordings made before 
+ *     beats carried the model's prediction have no prediction to compare.
+ *     Each recorded model (slope and yIntercept) next to the replayed one.
+ *     The total time kept (the sum of the deltaTs) by each, and the difference.
+ *     The host CPU time per beat spent in beat(), which includes the ReplayHAL's share.
+ *
+ *   With -d, the whole deltaT series is written to standard output as CSV (beat,recorded,replayed) instead. With 
+ *   -o file, the replay is itself recorded to file. The exit status is 1 if anything differed.
+ *
+ *   Build (from this directory):
+ *     g++ -O2 -I../.. replay.cpp ../../Escapement.cpp ../../EscapementHAL.cpp ../../EscapementStore.cpp \
+ *         ../../EscapementRecorder.cpp ../../EscapementSensor.cpp -o replay
+ *
+ *   Usage: replay [-q] [-d] [-o file] recording
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "Escapement.h"
+
+#define MAX_LINE		(1024)				// Longest line in a recording
+#define MAX_SHOWN		(10)				// Most differing beats listed
+
+// Plays back recorded inputs: micros() is the recorded beat time and the ADC produces a pulse that beat() detects 
+// promptly
+class ReplayHAL : public HostHAL {
+private:
+	uint16_t reads;							// ADC readings since the last delay()
+public:
+	uint32_t time;							// What micros() returns
+	ReplayHAL() {
+		reads = 0;
+		time = 0;
+	}
+	unsigned int adcRead(byte pin) {
+		(void)pin;
+		reads++;
+		if (reads <= N_SAMPLES + 1) return 0;
+		if (reads <= 3 * N_SAMPLES + 1) return 100 * ((reads - 2) / N_SAMPLES);
+		return 100;
+	}
+	uint32_t micros() {
+		return time;
+	}
+	void delay(uint32_t ms) {
+		(void)ms;
+		reads = 0;
+	}
+};
+
+// Keeps the replayed models and the last beat's prediction, passing everything on to another recorder if there is 
+// one
+class ModelRecorder : public EscapementRecorder {
+public:
+	std::vector<beatRecord_t> models;
+	int32_t prediction;
+	EscapementRecorder *next;
+	ModelRecorder() {
+		prediction = 0;
+		next = NULL;
+	}
+	void record(const beatRecord_t &r) {
+		if (r.type == REC_MODEL) models.push_back(r);
+		if (r.type == REC_BEAT) prediction = r.model;
+		if (next != NULL) next->record(r);
+	}
+	void recordSettings(const void *buf, unsigned int len) {
+		if (next != NULL) next->recordSettings(buf, len);
+	}
+};
+
+// Parse a record line; false if it isn't one. hasModel is set to whether the line has the model field.
+static bool parseRecord(const char *line, beatRecord_t &r, bool &hasModel) {
+	const char *t = strchr(REC_TYPES, line[0]);
+	unsigned long time;
+	int temp;
+	unsigned mode;
+	long value, aux, model = 0;
+	if (line[0] == '\0' || t == NULL || line[1] != ',') return false;
+	int n = sscanf(line + 2, "%lu,%d,%u,%ld,%ld,%ld", &time, &temp, &mode, &value, &aux, &model);
+	if (n < 5) return false;
+	hasModel = n == 6;
+	r.type = (byte)(t - REC_TYPES);
+	r.time = (uint32_t)time;
+	r.temp = (int16_t)temp;
+	r.mode = (byte)mode;
+	r.value = (int32_t)value;
+	r.aux = (int32_t)aux;
+	r.model = (int32_t)model;
+	return true;
+}
+
+// Parse a settings line into buf; return the number of bytes
+static unsigned int parseSettings(const char *line, byte *buf, unsigned int size) {
+	unsigned int n = 0;
+	unsigned int b;
+	for (const char *p = line + 2; n < size && sscanf(p, "%2x", &b) == 1; p += 2) {
+		buf[n++] = (byte)b;
+	}
+	return n;
+}
+
+static long long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+	bool quiet = false;
+	bool dump = false;
+	const char *outName = NULL;
+	const char *inName = NULL;
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "-q") == 0) quiet = true;
+		else if (strcmp(argv[a], "-d") == 0) dump = true;
+		else if (strcmp(argv[a], "-o") == 0 && a + 1 < argc) outName = argv[++a];
+		else inName = argv[a];
+	}
+	if (inName == NULL) {
+		fprintf(stderr, "Usage: %s [-q] [-d] [-o file] recording\n", argv[0]);
+		return 2;
+	}
+	FILE *in = fopen(inName, "r");
+	if (in == NULL) {
+		fprintf(stderr, "replay: can't open %s\n", inName);
+		return 2;
+	}
+	FILE *out = NULL;
+	FileRecorder *outRecorder = NULL;
+	if (outName != NULL) {
+		out = fopen(outName, "w");
+		if (out == NULL) {
+			fprintf(stderr, "replay: can't create %s\n", outName);
+			return 2;
+		}
+		outRecorder = new FileRecorder(out);
+	}
+
+	ReplayHAL hal;
+	SimSensor sensor;						// Reads the recorded temperature, NO_TEMP if there was no sensor
+	Escapement e(&hal);
+	e.setTempSensor(&sensor);
+	e.setTempInterval(0);					// The recorded temperatures are already what beat() used; take each as is
+	e.setTempHold(0);						//   Including NO_TEMP (though retries after it may land a few beats off)
+	ModelRecorder models;
+	models.next = outRecorder;
+	e.setRecorder(&models);
+
+	std::vector<beatRecord_t> recordedModels;
+	char line[MAX_LINE];
+	unsigned long beats = 0, lines = 0, deltaDiffs = 0, modeDiffs = 0, predictionDiffs = 0, shown = 0;
+	long maxDiff = 0;
+	double keptRecorded = 0.0, keptReplayed = 0.0;
+	long long ns = 0;
+	beatRecord_t r;
+	bool hasModel;
+	if (dump) printf("beat,recorded,replayed\n");
+	while (fgets(line, sizeof(line), in) != NULL) {
+		lines++;
+		if (line[0] == 'S' && line[1] == ',') {
+			byte buf[MAX_LINE / 2];
+			unsigned int n = parseSettings(line, buf, sizeof(buf));
+			hal.store()->write(0, buf, n);	// What the recorded Escapement found in its store
+			continue;
+		}
+		if (!parseRecord(line, r, hasModel)) {		// Anything else (e.g., the sketch's own output) is skipped
+			continue;
+		}
+		switch (r.type) {
+			case REC_ENABLE:
+				sensor.set(r.temp);
+				if (r.aux != 0) {			// The temp range the recorded Escapement was given, if any
+					int res = r.aux >> 16;
+					int minC = (int8_t)(r.aux & 0xff);
+					e.setTempRange(minC, minC + (((r.aux >> 8) & 0xff) - 1) / res, res);
+				}
+				e.enable(r.value);
+				break;
+			case REC_BEAT: {
+				hal.time = r.time;
+				sensor.set(r.temp);
+				long long start = nowNs();
+				long dT = e.beat();
+				ns += nowNs() - start;
+				beats++;
+				keptRecorded += r.value / 1e6;
+				keptReplayed += dT / 1e6;
+				long diff = dT - r.value;
+				if (diff != 0) deltaDiffs++;
+				if (labs(diff) > maxDiff) maxDiff = labs(diff);
+				if (e.getRunMode() != r.mode) modeDiffs++;
+				bool predictionDiffers = hasModel && models.prediction != r.model;
+				if (predictionDiffers) predictionDiffs++;
+				if (dump) {
+					printf("%lu,%ld,%ld\n", beats, (long)r.value, dT);
+				} else if (!quiet && (diff != 0 || e.getRunMode() != r.mode || predictionDiffers) && 
+						shown++ < MAX_SHOWN) {
+					printf("beat %lu (line %lu): deltaT %ld, replayed %ld; mode %u, replayed %u; prediction %ld, "
+						"replayed %ld\n", beats, lines, (long)r.value, dT, r.mode, e.getRunMode(), (long)r.model, 
+						(long)models.prediction);
+				}
+				break;
+			}
+			case REC_MODE:
+				e.setRunMode(r.mode);
+				break;
+			case REC_BIAS:
+				e.setBias(r.value);
+				break;
+			case REC_SPEED:
+				e.setSpeedAdj(r.value);
+				break;
+			case REC_MODEL:
+				recordedModels.push_back(r);
+				break;
+		}
+	}
+	fclose(in);
+	if (out != NULL) fclose(out);
+	if (dump) return 0;
+
+	unsigned long modelDiffs = 0;
+	printf("beats %lu: deltaT differs for %lu (max %ld us), mode for %lu, prediction for %lu\n", beats, deltaDiffs, 
+		maxDiff, modeDiffs, predictionDiffs);
+	size_t n = recordedModels.size() > models.models.size() ? recordedModels.size() : models.models.size();
+	for (size_t i = 0; i < n; i++) {
+		bool haveRec = i < recordedModels.size();
+		bool haveRep = i < models.models.size();
+		long recM = haveRec ? (long)recordedModels[i].value : 0, recB = haveRec ? (long)recordedModels[i].aux : 0;
+		long repM = haveRep ? (long)models.models[i].value : 0, repB = haveRep ? (long)models.models[i].aux : 0;
+		bool same = haveRec && haveRep && recM == repM && recB == repB;
+		if (!same) modelDiffs++;
+		if (!quiet || !same) {
+			printf("model %lu: recorded %s%ld/%ld, replayed %s%ld/%ld%s\n", (unsigned long)i + 1, 
+				haveRec ? "" : "(none) ", recM, recB, haveRep ? "" : "(none) ", repM, repB, same ? "" : " DIFFERS");
+		}
+	}
+	printf("time kept: recorded %.6f s, replayed %.6f s, difference %.6f s\n", keptRecorded, keptReplayed, 
+		keptReplayed - keptRecorded);
+	if (beats > 0) printf("cpu: %.0f ns per beat()\n", (double)ns / beats);
+	return (deltaDiffs != 0 || modeDiffs != 0 || predictionDiffs != 0 || modelDiffs != 0) ? 1 : 0;
+}
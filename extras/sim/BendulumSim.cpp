@@ -0,0 +1,168 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   BendulumSim.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See BendulumSim.h for description.
+ *
+ ****/
+
+#include "BendulumSim.h"
+#include <math.h>
+
+BendulumSim::BendulumSim(byte kPin) {
+	kickPin = kPin;
+	q = 200.0;
+	amplitude0 = 0.03;
+	coilWidth = 0.003;
+	emfScale = 2500.0;
+	adcNoise = 1.0;
+	kickAccel = 0.08;
+	seed = 12345;
+	reset();
+}
+
+// Start over
+void BendulumSim::reset() {
+	VirtualTimeHAL::reset();
+	stateTime = 0;
+	farUntil = 0;
+	x = amplitude0;
+	v = 0.0;
+	rng = seed == 0 ? 1 : seed;
+	for (int i = 0; i < (1 << SIM_NOISE_BITS); i++) {
+		double sum = 0.0;					// Approximately Gaussian: the scaled sum of four uniform deviates
+		for (int j = 0; j < 4; j++) {
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			sum += rng / 4294967296.0 - 0.5;
+		}
+		noiseTable[i] = sum * 1.7320508;	// sqrt(3): the sum's variance is 1/3
+		double counts = adcNoise * noiseTable[i];
+		quietTable[i] = counts < 0.0 ? 0 : counts > 1023.0 ? 1023 : (unsigned int)(counts + 0.5);
+	}
+	kicking = false;
+	kickStart = 0;
+	updateTemp();
+}
+
+double BendulumSim::getX() {
+	sync();
+	return x;
+}
+
+double BendulumSim::getV() {
+	sync();
+	return v;
+}
+
+double BendulumSim::getPeriod() {
+	return 2.0 * M_PI / omega0;
+}
+
+// Recalculate the temperature, the natural frequency and the cached single-ADC-step propagation factors
+void BendulumSim::updateTemp() {
+	sync();									// The period is about to change
+	VirtualTimeHAL::updateTemp();
+	double d = rodTemp - tempRef;
+	omega0 = 2.0 * M_PI / (period0 * (1.0 + (tempCoef + tempCurve * d) * d));
+	gamma = omega0 / (2.0 * q);
+	omegaD = sqrt(omega0 * omega0 - gamma * gamma);
+	stepMatrix(adcTime / 1e6, step);
+}
+
+// The closed-form solution of the damped oscillator, as a matrix that takes (x, v) at time t to (x, v) at t + dt
+void BendulumSim::stepMatrix(double dt, double m[4]) {
+	double e = exp(-gamma * dt);
+	double c = e * cos(omegaD * dt);
+	double s = e * sin(omegaD * dt) / omegaD;
+	m[0] = c + gamma * s;
+	m[1] = s;
+	m[2] = -omega0 * omega0 * s;
+	m[3] = c - gamma * s;
+}
+
+// Bring x and v up to date. Advancing simulated time doesn't move the pendulum; it catches up here, lazily
+void BendulumSim::sync() {
+	uint64_t us = now - stateTime;
+	if (us == 0) return;
+	double general[4];
+	double *m = step;
+	if (us != adcTime) {
+		stepMatrix(us / 1e6, general);
+		m = general;
+	}
+	double x0 = x;
+	x = m[0] * x0 + m[1] * v;
+	v = m[2] * x0 + m[3] * v;
+	stateTime = now;
+}
+
+// Gaussian noise from the table, indexed by a xorshift generator
+double BendulumSim::noise() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return noiseTable[rng >> (32 - SIM_NOISE_BITS)];
+}
+
+// An ADC reading of noise alone
+unsigned int BendulumSim::quiet() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return quietTable[rng >> (32 - SIM_NOISE_BITS)];
+}
+
+// What the ADC makes of a voltage of counts
+unsigned int BendulumSim::adcCounts(double counts) {
+	counts += adcNoise * noise();
+	if (counts < 0.0) return 0;
+	if (counts > 1023.0) return 1023;
+	return (unsigned int)(counts + 0.5);
+}
+
+/*
+ *
+ * EscapementHAL
+ *
+ */
+
+// Take an ADC reading of the voltage the magnet induces in the coil
+unsigned int BendulumSim::adcRead(byte pin) {
+	(void)pin;
+	advance(adcTime);
+	if (now < farUntil) {					// If the magnet is known to be far away, there's only noise
+		return quiet();
+	}
+	sync();
+	double u = x / coilWidth;
+	if (u > SIM_FAR || u < -SIM_FAR) {		// If it's far away, figure out how long it will stay that way:
+		double amp = sqrt(x * x + (v / omega0) * (v / omega0));
+		double gap = (u < 0.0 ? -x : x) - SIM_FAR * coilWidth;
+		farUntil = now + (uint64_t)(1e6 * gap / (1.01 * amp * omega0));
+		return quiet();						//   at least the distance to go at the top speed it could have
+	}
+	double coupling = 2.3316439 * u * exp(-u * u);	// sqrt(2e) * u * exp(-u^2)
+	return adcCounts(emfScale * v * coupling);
+}
+
+// Kicking starts when the kick pin goes HIGH and the impulse is delivered when it goes LOW
+void BendulumSim::digitalWrite(byte pin, byte value) {
+	HostHAL::digitalWrite(pin, value);
+	if (pin != kickPin) return;
+	if (value == HIGH && !kicking) {
+		kicking = true;
+		kickStart = now;
+	} else if (value == LOW && kicking) {
+		kicking = false;
+		sync();
+		double dv = kickAccel * ((now - kickStart) / 1e6);
+		v += v < 0.0 ? -dv : dv;
+		farUntil = 0;						// The magnet's speed changed, so the bound on when it's near did too
+	}
+}
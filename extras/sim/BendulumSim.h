@@ -0,0 +1,93 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   BendulumSim.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   A physics-based pendulum or bendulum simulator for running the Escapement on a host. It's an EscapementHAL, so 
+ *   an Escapement constructed with one runs its unmodified state machine against the simulated hardware. It's built 
+ *   on VirtualTimeHAL, which supplies the simulated time, the real-time clock, the temperature and the TMP102; 
+ *   where VirtualTimeHAL follows a script of when the magnet passes, BendulumSim works it out from the physics.
+ *
+ *   The pendulum is modeled as a damped harmonic oscillator. Its state is the displacement, x, of the magnet from 
+ *   the center of the coil (m) and its velocity, v (m/s). Between events the state is advanced using the closed-form 
+ *   solution of the oscillator's equation of motion, so simulated time can be skipped over in big steps at no cost in 
+ *   accuracy. The period depends on the rod's temperature: period = period0 * (1 + tempCoef * (T - tempRef) + 
+ *   tempCurve * (T - tempRef)^2).
+ *
+ *   The voltage the magnet induces in the coil is modeled as emfScale * v * c(x) where c(x) = sqrt(2e) * (x / w) * 
+ *   exp(-(x / w)^2) is the coupling between the magnet and a coil of half-width w. The coupling peaks at 1 when x 
+ *   = w / sqrt(2). The ADC adds Gaussian noise, rounds and clips to 0 - 1023. Each adcRead() advances the simulated 
+ *   time by adcTime μs, the time an ATmega328 takes for a conversion.
+ *
+ *   When the Escapement pulses the kick pin, the coil gives the magnet a push in the direction it's moving: an 
+ *   impulse of kickAccel * (duration of the pulse). 
+ *
+ *   Simulated time runs as fast as the host can compute it: on a typical PC a week of 1-second beats takes about 40 
+ *   seconds, some 15,000 times faster than real time. To make that possible, the state of the pendulum is only 
+ *   brought up to date when it's needed. While the magnet is too far from the coil to induce a measurable voltage 
+ *   (more than SIM_FAR coil half-widths away), ADC readings are just noise, and the simulator calculates a 
+ *   conservative bound on when the magnet could next come near. What's left is mostly the readings themselves: 
+ *   beat() polls the coil from the end of its settle delay until the magnet passes, some 6,600 conversions a beat 
+ *   or 4 billion a week, and each costs the host about 10 ns even when it's only noise. The physics is about a fifth 
+ *   of the time, so a bigger step wouldn't buy much; a week in seconds would take a HAL that doesn't model each 
+ *   conversion, like VirtualTimeHAL. 
+ *
+ ****/
+
+#ifndef BendulumSim_H
+#define BendulumSim_H
+
+#include "VirtualTimeHAL.h"
+
+#define SIM_FAR			(3.5)				// Coil half-widths beyond which the coupling is negligible
+#define SIM_NOISE_BITS	(12)				// log2 of the size of the noise table
+
+class BendulumSim : public VirtualTimeHAL {
+protected:
+	uint64_t stateTime;						// Simulated time at which x and v are current (μs)
+	uint64_t farUntil;						// The magnet is far from the coil until at least this time (μs)
+	double x;								// Displacement of magnet from the center of the coil (m)
+	double v;								// Velocity of the magnet (m/s)
+	double omega0;							// Undamped angular frequency at the current temperature (rad/s)
+	double gamma;							// Damping rate (1/s)
+	double omegaD;							// Damped angular frequency (rad/s)
+	double step[4];							// Matrix that advances (x, v) by one adcTime step
+	uint32_t rng;							// Noise generator state
+	double noiseTable[1 << SIM_NOISE_BITS];	// Gaussian deviates, mean 0, standard deviation 1
+	unsigned int quietTable[1 << SIM_NOISE_BITS];
+											// ADC readings of nothing but noise, corresponding to noiseTable
+	byte kickPin;							// Pin the kick is applied on
+	uint64_t kickStart;						// When the kick pin went HIGH (μs)
+	boolean kicking;						// Whether the kick pin is HIGH
+	void sync();							// Bring the state of the pendulum up to the current time
+	void stepMatrix(double dt, double m[4]);// Calculate the matrix that advances (x, v) by dt seconds
+	void updateTemp();						// Recalculate temperature and everything that depends on it
+	double noise();							// Gaussian noise, mean 0, standard deviation 1
+	unsigned int quiet();					// ADC reading when there's only noise
+	unsigned int adcCounts(double counts);	// Add noise to counts, round and clip the way the ADC does
+
+public:
+// Model parameters, in addition to VirtualTimeHAL's; change them before the first call to reset()
+	double q;								// Quality factor of the oscillator
+	double amplitude0;						// Amplitude at reset (m)
+	double coilWidth;						// Half-width of the coil (m)
+	double emfScale;						// ADC counts per m/s of magnet velocity at peak coupling
+	double adcNoise;						// Standard deviation of ADC noise (counts)
+	double kickAccel;						// Acceleration the coil gives the magnet while kicking (m/s^2)
+	uint32_t seed;							// Seed for the noise generator
+
+	BendulumSim(byte kickPin = 12);
+	void reset();							// Start the simulation over using the current parameters
+	double getX();							// Displacement of the magnet (m)
+	double getV();							// Velocity of the magnet (m/s)
+	double getPeriod();						// Current full period (s)
+
+// EscapementHAL
+	unsigned int adcRead(byte pin);
+	void digitalWrite(byte pin, byte value);
+};
+
+#endif
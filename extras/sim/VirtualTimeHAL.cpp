@@ -0,0 +1,138 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   VirtualTimeHAL.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   See VirtualTimeHAL.h for description.
+ *
+ ****/
+
+#include "VirtualTimeHAL.h"
+#include <math.h>
+
+#define VT_DAY			(86400.0)			// Seconds per day
+
+VirtualTimeHAL::VirtualTimeHAL() {
+	period0 = 2.0;							// A 1-second beat
+	asymmetry = 0.002;
+	tempRef = 20.0;
+	tempCoef = 10.0e-6;						// About right for a steel rod
+	tempCurve = 0.0;
+	tempMean = 21.0;
+	tempSwing = 2.0;
+	rodLag = 0.0;
+	rtcPpm = 0.0;
+	microsStart = 0;
+	adcTime = VT_ADC_TIME;
+	reset();
+}
+
+// Start over
+void VirtualTimeHAL::reset() {
+	now = 0;
+	tempTime = 0;
+	curTemp = temperature(0.0);
+	rodTemp = curTemp;
+	passes = 0;
+	nextPass = 0;
+	reads = 0;
+	tmpPointer = TMP102_TEMP;				// The TMP102 powers up converting continuously
+	tmpConfig[0] = TMP102_CFG_RES;
+	tmpConfig[1] = 0xa0;
+	tmpLatched = curTemp;
+}
+
+uint64_t VirtualTimeHAL::getTime() {
+	return now;
+}
+
+uint32_t VirtualTimeHAL::getPasses() {
+	return passes;
+}
+
+// Default temperature profile: a daily sinusoid
+double VirtualTimeHAL::temperature(double t) {
+	return tempMean + tempSwing * sin(2.0 * M_PI * t / VT_DAY);
+}
+
+// Default beat script: half a period at the rod's current temperature; odd beats are ticks
+uint64_t VirtualTimeHAL::beatLength(uint32_t n) {
+	double d = rodTemp - tempRef;
+	double beat = period0 / 2.0 * (1.0 + (tempCoef + tempCurve * d) * d) + ((n & 1) ? asymmetry : -asymmetry) / 2.0;
+	return (uint64_t)(beat * 1e6 + 0.5);
+}
+
+// Advance simulated time by us μs
+void VirtualTimeHAL::updateTemp() {
+	curTemp = temperature(now / 1e6);
+	rodTemp = rodLag <= 0.0 ? curTemp : curTemp + (rodTemp - curTemp) * exp(-((now - tempTime) / 1e6) / rodLag);
+	tempTime = now;
+}
+
+/*
+ *
+ * EscapementHAL
+ *
+ */
+
+// The scripted pulse: a conversion of quiet, then N_SAMPLES each of quiet, half height, full height and half height 
+// again. The first reading after a delay() skips ahead so that the full-height readings are centered on the next 
+// pass that's far enough off to be caught.
+unsigned int VirtualTimeHAL::adcRead(byte pin) {
+	(void)pin;
+	if (reads == 0) {
+		uint64_t lead = (uint64_t)VT_PEAK * adcTime;
+		while (nextPass < now + lead) {		// Passes too close to catch (or already caught) are missed
+			nextPass += beatLength(++passes);
+		}
+		advance(nextPass - lead - now);
+	}
+	advance(adcTime);
+	reads++;
+	if (reads <= N_SAMPLES + 1) return 0;
+	if (reads <= 2 * N_SAMPLES + 1) return VT_PULSE / 2;
+	if (reads <= 3 * N_SAMPLES + 1) return VT_PULSE;
+	return VT_PULSE / 2;
+}
+
+// The Arduino's (inaccurate) real-time clock
+uint32_t VirtualTimeHAL::micros() {
+	return microsStart + (uint32_t)(now + (int64_t)(now * (rtcPpm / 1e6)));
+}
+
+void VirtualTimeHAL::delay(uint32_t ms) {
+	advance(ms * 1000ULL);
+	reads = 0;
+}
+
+// The TMP102: two bytes of the register the pointer selects. The temperature is 12-bit left-justified, 1/16 degree 
+// C per count.
+byte VirtualTimeHAL::i2cRead(byte addr, byte *buf, byte len) {
+	if (addr != ADDRESS_TMP102 || len < 2) return 0;
+	if (tmpPointer == TMP102_CONFIG) {
+		buf[0] = tmpConfig[0];
+		buf[1] = tmpConfig[1];
+		return 2;
+	}
+	double reading = (tmpConfig[0] & TMP102_CFG_SD) ? tmpLatched : curTemp;
+	int16_t t = (int16_t)floor(reading * 16.0 + 0.5) << 4;
+	buf[0] = (byte)(t >> 8);
+	buf[1] = (byte)t;
+	return 2;
+}
+
+// Set the TMP102's pointer register and, if it's the configuration register, write it. A one-shot conversion is 
+// done at once.
+boolean VirtualTimeHAL::i2cWrite(byte addr, const byte *buf, byte len) {
+	if (addr != ADDRESS_TMP102 || len < 1 || buf[0] > TMP102_CONFIG) return false;
+	tmpPointer = buf[0];
+	if (tmpPointer == TMP102_CONFIG && len >= 3) {
+		tmpConfig[0] = (tmpConfig[0] & TMP102_CFG_RES) | (buf[1] & ~(TMP102_CFG_RES | TMP102_CFG_OS));
+		tmpConfig[1] = buf[2];
+		if (buf[1] & TMP102_CFG_OS) tmpLatched = curTemp;
+	}
+	return true;
+}
@@ -0,0 +1,95 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   VirtualTimeHAL.h Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   A deterministic virtual-time EscapementHAL for driving the Escapement's state machine on a host. Nothing in it 
+ *   depends on the host's clock: delay() and each adcRead() just advance simulated time, so a simulated week takes 
+ *   a fraction of a second and every run with the same parameters gives the same results.
+ *
+ *   Instead of simulating the pendulum, it follows a script of when the magnet passes over the coil. The true length 
+ *   of beat n (μs) is beatLength(n). By default that's half of period0, stretched by tempCoef per degree C that the 
+ *   rod's temperature is away from tempRef, plus tempCurve per degree C squared (0, by default), with ticks asymmetry 
+ *   seconds longer than tocks. The rod follows the air temperature with a first-order lag of rodLag seconds (0, by 
+ *   default, for none). At the first ADC reading after a delay() -- that is, when beat() starts looking for the 
+ *   magnet -- simulated time skips ahead to just before the next pass, and the readings then form a clean pulse 
+ *   centered on the pass. beat() sees the pass VT_DETECT_LAG ADC conversions after it happens, every time, so the 
+ *   durations it measures are exactly the scripted ones (as seen by the real-time clock). A pass that's already too 
+ *   close when beat() starts looking is missed, the way it would be on real hardware, and the next one is used.
+ *
+ *   The real-time clock, micros(), runs rtcPpm parts per million fast and starts at microsStart, so micros() 
+ *   wraparound is just a matter of starting near 0xffffffff. Override micros() for other behavior.
+ *
+ *   The temperature follows temperature(), by default a daily sinusoid, tempMean +/- tempSwing, and is reported the 
+ *   way a TMP102 at ADDRESS_TMP102 would: 12 bits, 1/16 degree C per count. The TMP102's pointer and configuration 
+ *   registers work too: in shutdown, the temperature register holds what the last one-shot conversion read. 
+ *   Override temperature() for other profiles, such as sweeps and steps, and beatLength() for other beat scripts.
+ *
+ *   BendulumSim is built on this class; it replaces the scripted passes with a physical model of the pendulum.
+ *
+ ****/
+
+#ifndef VirtualTimeHAL_H
+#define VirtualTimeHAL_H
+
+#include "Escapement.h"
+
+#define VT_ADC_TIME		(112)				// Time an analog conversion takes on an ATmega328 (μs)
+#define VT_TEMP_UPDATE	(1000000ULL)		// How often the temperature is updated (μs)
+#define VT_PULSE		(200)				// Height of the scripted pulse (ADC counts)
+#define VT_PEAK			(2 * N_SAMPLES + N_SAMPLES / 2 + 2)
+											// Conversion, counting from 1, at the middle of the pulse's peak
+#define VT_DETECT_LAG	(4 * N_SAMPLES + 1 - VT_PEAK)
+											// Conversions from the middle of the peak to when beat() detects it
+
+class VirtualTimeHAL : public HostHAL {
+protected:
+	uint64_t now;							// Simulated time (μs)
+	double curTemp;							// Current temperature (degrees C)
+	double rodTemp;							// Current temperature of the rod (degrees C)
+	uint64_t tempTime;						// When curTemp was last updated (μs)
+	uint32_t passes;						// Number of scripted passes so far
+	uint64_t nextPass;						// When the magnet next passes over the coil, or last did (μs)
+	uint16_t reads;							// ADC readings since the last delay()
+	byte tmpPointer;						// The TMP102's pointer register
+	byte tmpConfig[2];						// Its configuration register
+	double tmpLatched;						// What its last one-shot conversion read (degrees C)
+	void advance(uint64_t us) {				// Advance simulated time by us μs (inline: every ADC reading does it)
+		now += us;
+		if (now - tempTime >= VT_TEMP_UPDATE) updateTemp();
+	}
+	virtual void updateTemp();				// Recalculate the temperature and the rod's
+
+public:
+// Script parameters; change them before calling reset()
+	double period0;							// Full period at tempRef (s); one beat is half of this
+	double asymmetry;						// How much longer a tick is than a tock (s)
+	double tempRef;							// Temperature at which the period is period0 (degrees C)
+	double tempCoef;						// Fractional change in period per degree C
+	double tempCurve;						// And per degree C squared
+	double tempMean;						// Mean temperature (degrees C)
+	double tempSwing;						// Amplitude of the daily temperature swing (degrees C)
+	double rodLag;							// Time constant with which the rod follows the temperature (s)
+	double rtcPpm;							// How fast the Arduino's clock runs (parts per million)
+	uint32_t microsStart;					// What micros() returns at reset
+	uint32_t adcTime;						// Time an ADC conversion takes (μs)
+
+	VirtualTimeHAL();
+	virtual void reset();					// Start over using the current parameters
+	uint64_t getTime();						// Simulated time (μs since reset)
+	uint32_t getPasses();					// Number of scripted passes so far, detected or not
+	virtual double temperature(double t);	// Temperature (degrees C) at time t (s since reset)
+	virtual uint64_t beatLength(uint32_t n);// True length of beat n (μs), n counting from 1
+
+// EscapementHAL
+	unsigned int adcRead(byte pin);
+	uint32_t micros();
+	void delay(uint32_t ms);
+	byte i2cRead(byte addr, byte *buf, byte len);
+	boolean i2cWrite(byte addr, const byte *buf, byte len);
+};
+
+#endif
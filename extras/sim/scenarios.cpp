@@ -0,0 +1,561 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   scenarios.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Long-running scenarios for the Escapement's state machine, run in virtual time on a VirtualTimeHAL:
+ *
+ *     week       A week from a cold start with the temperature swinging 19 - 23 C daily. Must reach RUN.
+ *     sweep      The temperature held for SWEEP_HOURS at each calibration temperature in turn, then a day of the
+ *                daily swing. Every bucket must be filled before the end of its step.
+ *     wrap       Three hours from a cold start with micros() a minute from wrapping around. It wraps three times;
+ *                no beat may be rejected and the time kept must match true time.
+ *     missed     Six hours at a constant temperature from a cold start, with beat() held up past one or two passes 
+ *                every STALL_BEATS beats, as a slow EEPROM write would. It must reach RUN, every missed pass must 
+ *                be counted and none rejected, and the time kept must be within 5 ms of true time. (In RUN, a gap 
+ *                of an odd number of beats is timed as that many average beats, off by half the tick/tock 
+ *                difference.)
+ *     resonator  The missed scenario on a real-time clock running 0.5% fast, as one run off a ceramic resonator 
+ *                can, corrected by setBias(RESONATOR_BIAS). The bias is too big for bias * deltaT to fit in 32 
+ *                bits, even for a single beat, and the same checks apply.
+ *     noise      The same, but with a spurious pulse between passes every NOISE_BEATS beats. Each must be caught 
+ *                by the acceptance gate, and the time kept must still be within 5 ms of true time.
+ *     flaky      The week, but with every FLAKY_READS-th temperature reading failing and, on the third day, the 
+ *                TMP102 off the bus for FLAKY_HOURS, coming back reset. It must reach RUN still compensated, lose 
+ *                the temperature exactly once, have none from TEMP_HOLD (plus a minute) into the outage to its 
+ *                end -- more than the 71.6 minutes it takes topTime to wrap -- get it back, and keep time within 
+ *                2 s of true time.
+ *     lag        The week, but with the rod lagging the air temperature by LAG_SECONDS. It must reach RUN with 
+ *                the thermal lag estimated to within a quarter of that, and keep time within 2 s of true time.
+ *     rate       The lag scenario with the Escapement's thermal lag fixed at 0, so that the model's rate-of-change 
+ *                term has to account for it. The term must come out within a quarter of what the lag amounts to 
+ *                (minus the rod's temperature coefficient times the lag), and time must be kept within 2 s.
+ *     curve      A week of a wider daily swing, 18.5 - 25.5 C, with the period curving by CURVE_COEF per degree C 
+ *                squared. The model chosen must be one that curves, and time must be kept within 1 s (the line 
+ *                alone is off by more).
+ *     workshop   Three days of the daily swing, calibrating over the default temperature range, then a restart 
+ *                with the range set to WORKSHOP_MIN - WORKSHOP_MAX C a degree at a time and a week of the heating 
+ *                off, the temperature swinging over all of that daily. The restart must keep the whole-degree 
+ *                buckets' calibration and start the rest empty, and the week must fill buckets outside the 
+ *                default range, spend at least a quarter of it in RUN and keep time within 2 s.
+ *     torn       Two days on a store that cuts every TORN_WRITES-th write short, after a varying number of bytes, 
+ *                then a restart just after the next one is and the rest of the week. The restart must find good 
+ *                persistent parameters (warm starting) with no sample count below 1, and time must be kept within 
+ *                2 s.
+ *     fused      A FusedSensor's arithmetic on SimSensors -- rounding, negative weights and a member going stale 
+ *                after FUSED_MAX_MISSES failed readings and coming back -- then the week read through one whose 
+ *                members read 1 C and 2 C above the air, weighted 2 and -1, with the second dead for 
+ *                FUSED_HOURS on the third day. It must read the air temperature to within 0.1 C until then, have 
+ *                none from TEMP_HOLD (plus two minutes) into the outage to its end, get it back, reach RUN still 
+ *                compensated and keep time within 2 s.
+ *     setup      The setters that change persistent parameters -- setBias(), incrBias(), setSpeedAdj(), 
+ *                incrSpeedAdj() and setTempLag() -- called before enable(), with no store yet, then a cold start 
+ *                and a day, then the same after a restart. Nothing may be written before enable(), the cold 
+ *                start must zero the bias and speed adjustment and the warm start must keep what was persisted, 
+ *                both must take up the thermal lag set, a setTempLag() after enable() mustn't write anything, and 
+ *                time must be kept within 2 s.
+ *
+ *   Each scenario is run twice and must give the same sequence of beat durations both times. For each, a line of
+ *   CSV reports the number of beats, beats rejected (beat() returning 0 after the first), mode changes, how far the
+ *   time kept by the Escapement has drifted from true time, a hash of the beat durations, the host time taken and
+ *   whether the scenario's checks passed. The exit status is 1 if any failed.
+ *
+ *   Build (from this directory):
+ *     g++ -O2 -I../.. -I. scenarios.cpp VirtualTimeHAL.cpp ../../Escapement.cpp ../../EscapementHAL.cpp \
+ *         ../../EscapementStore.cpp ../../EscapementSensor.cpp -o scenarios
+ *
+ *   Usage: scenarios [scenario...]     (default: all of them)
+ *
+ ****/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "VirtualTimeHAL.h"
+
+#define DAY_US			(86400000000ULL)	// μs per day
+#define HOUR_US			(3600000000ULL)		// μs per hour
+#define SWEEP_HOURS		(3.0)				// How long the sweep holds each temperature (h)
+#define STALL_BEATS		(500)				// Beats between stalls in the missed scenario
+#define RESONATOR_BIAS	(-4320)				// The bias that corrects the resonator scenario's clock (0.1 s/day)
+#define NOISE_BEATS		(300)				// Beats between spurious pulses in the noise scenario
+#define FLAKY_READS		(20)				// Temperature readings between failures in the flaky scenario
+#define FLAKY_HOURS		(2)					// How long the TMP102 is off the bus in the flaky scenario (h)
+#define LAG_SECONDS		(3600)				// The rod's thermal lag in the lag scenario (s)
+#define CURVE_COEF		(2.0e-6)			// The period's change per degree C squared in the curve scenario
+#define WORKSHOP_MIN	(5)					// The workshop scenario's temperature range (degrees C)
+#define WORKSHOP_MAX	(30)
+#define WORKSHOP_HEATED	(3)					// Days before the workshop's heating goes off
+#define FUSED_HOURS		(1)					// How long a member is dead in the fused scenario (h)
+#define TORN_WRITES		(1000)				// Writes between ones cut short in the torn scenario
+
+struct result_t {
+	uint64_t beats;							// Beats run
+	uint32_t rejected;						// Beats for which beat() returned 0, not counting the first
+	uint32_t transitions;					// Changes of run mode
+	double errorSec;						// Time kept less true time (s)
+	uint32_t hash;							// FNV-1a hash of the beat durations
+	boolean ok;								// Whether the scenario's own checks passed
+};
+
+// Temperature held at each calibration bucket's temperature in turn, then the daily swing
+class SweepHAL : public VirtualTimeHAL {
+public:
+	double temperature(double t) {
+		int step = (int)(t / (SWEEP_HOURS * 3600.0));
+		if (step < TEMP_STEPS) return TEMP_MIN + step * 0.5;
+		return VirtualTimeHAL::temperature(t);
+	}
+};
+
+// The daily swing until the heating goes off after WORKSHOP_HEATED days, then WORKSHOP_MIN - WORKSHOP_MAX daily
+class WorkshopHAL : public VirtualTimeHAL {
+public:
+	double temperature(double t) {
+		if (t < WORKSHOP_HEATED * 86400.0) return VirtualTimeHAL::temperature(t);
+		return (WORKSHOP_MAX + WORKSHOP_MIN) / 2.0 + 
+			(WORKSHOP_MAX - WORKSHOP_MIN) / 2.0 * sin(2.0 * M_PI * t / 86400.0);
+	}
+};
+
+// Every STALL_BEATS beats, beat()'s settling delay runs long enough to miss the next pass, or the next two
+class StallHAL : public VirtualTimeHAL {
+public:
+	uint32_t settles;						// Settling delays so far
+	uint32_t missed;						// Passes made to be missed
+	void reset() {
+		VirtualTimeHAL::reset();
+		settles = missed = 0;
+	}
+	void delay(uint32_t ms) {
+		if (ms == SETTLE_TIME && ++settles % STALL_BEATS == 0) {
+			uint32_t n = 1 + (settles / STALL_BEATS) % 2;
+			missed += n;
+			ms += n * (uint32_t)(period0 * 500.0);
+		}
+		VirtualTimeHAL::delay(ms);
+	}
+};
+
+// Every NOISE_BEATS beats, a pulse shows up as soon as beat() starts looking, well before the real pass
+class NoiseHAL : public VirtualTimeHAL {
+public:
+	uint32_t looks;							// Times beat() started looking for a pass
+	uint32_t spurious;						// Spurious pulses so far
+	boolean inPulse;						// Whether the readings are of a spurious pulse
+	void reset() {
+		VirtualTimeHAL::reset();
+		looks = spurious = 0;
+		inPulse = false;
+	}
+	unsigned int adcRead(byte pin) {
+		if (reads == 0 && ++looks % NOISE_BEATS == 0) {
+			inPulse = true;
+			spurious++;
+		}
+		if (!inPulse) return VirtualTimeHAL::adcRead(pin);
+		advance(adcTime);					// The same shape as a real pass, without using one up
+		reads++;
+		if (reads <= N_SAMPLES + 1) return 0;
+		if (reads <= 2 * N_SAMPLES + 1) return VT_PULSE / 2;
+		if (reads <= 3 * N_SAMPLES + 1) return VT_PULSE;
+		inPulse = false;
+		return VT_PULSE / 2;
+	}
+};
+
+// Every FLAKY_READS-th TMP102 reading fails, and it's gone for an hour on the third day, then powers up again
+class FlakyHAL : public VirtualTimeHAL {
+public:
+	uint32_t readings;						// TMP102 readings attempted
+	boolean gone;							// Whether the TMP102 is off the bus
+	void reset() {
+		VirtualTimeHAL::reset();
+		readings = 0;
+		gone = false;
+	}
+	boolean absent() {
+		boolean out = now >= 2 * DAY_US && now < 2 * DAY_US + FLAKY_HOURS * HOUR_US;
+		if (gone && !out) {					// Back, as it is at power-up
+			tmpPointer = TMP102_TEMP;
+			tmpConfig[0] = TMP102_CFG_RES;
+			tmpConfig[1] = 0xa0;
+		}
+		gone = out;
+		return out;
+	}
+	byte i2cRead(byte addr, byte *buf, byte len) {
+		if (absent() || ++readings % FLAKY_READS == 0) return 0;
+		return VirtualTimeHAL::i2cRead(addr, buf, len);
+	}
+	boolean i2cWrite(byte addr, const byte *buf, byte len) {
+		if (absent()) return false;
+		return VirtualTimeHAL::i2cWrite(addr, buf, len);
+	}
+};
+
+// RAM that, every TORN_WRITES-th write, writes only some of the bytes (as a reset part way through would) and fails
+class TornStore : public RAMStore {
+public:
+	uint32_t writes;						// Writes so far
+	uint32_t torn;							// Those cut short
+	TornStore() {
+		writes = torn = 0;
+	}
+	bool write(unsigned int addr, const void *buf, unsigned int len) {
+		if (++writes % TORN_WRITES != 0) return RAMStore::write(addr, buf, len);
+		torn++;
+		RAMStore::write(addr, buf, (writes / TORN_WRITES) % len);
+		return false;
+	}
+};
+
+// Run e on hal until simulated time end (μs), calling check(e, hal) after every beat. If check() ever returns 
+// false, the run isn't ok.
+template <typename C> static void run(Escapement &e, VirtualTimeHAL &hal, uint64_t end, result_t &r, C check) {
+	double kept = 0.0;
+	double startTime = -1.0;
+	byte mode = e.getRunMode();
+	memset(&r, 0, sizeof(r));
+	r.hash = 2166136261UL;
+	r.ok = true;
+	while (hal.getTime() < end) {
+		long dT = e.beat();
+		r.beats++;
+		for (int i = 0; i < 4; i++) {
+			r.hash = (r.hash ^ ((dT >> (8 * i)) & 0xff)) * 16777619UL;
+		}
+		if (e.getRunMode() != mode) {
+			mode = e.getRunMode();
+			r.transitions++;
+		}
+		if (!check(e, hal)) r.ok = false;
+		if (startTime < 0.0) {				// The first beat just starts the clock
+			startTime = hal.getTime() / 1e6;
+			continue;
+		}
+		if (dT == 0) r.rejected++;
+		kept += dT / 1e6;
+	}
+	r.errorSec = kept - (hal.getTime() / 1e6 - startTime);
+}
+
+static void week(result_t &r) {
+	VirtualTimeHAL hal;
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	run(e, hal, 7 * DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = r.ok && r.rejected == 0 && e.getRunMode() == RUN;
+}
+
+static void sweep(result_t &r) {
+	SweepHAL hal;
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	uint64_t stepUs = (uint64_t)(SWEEP_HOURS * HOUR_US);
+	uint64_t nextCheck = stepUs - HOUR_US / 6;
+	int checked = 0;
+	run(e, hal, TEMP_STEPS * stepUs + DAY_US, r, [&](Escapement &e, VirtualTimeHAL &h) {
+		if (checked >= TEMP_STEPS || h.getTime() < nextCheck) return true;
+		checked++;							// Ten minutes before the end of a step, its bucket should be full
+		nextCheck += stepUs;
+		return e.getSmoothing() > TGT_SAMPLES;
+	});
+	r.ok = r.ok && checked == TEMP_STEPS && r.rejected == 0 && e.getRunMode() == RUN;
+}
+
+static void wrap(result_t &r) {
+	VirtualTimeHAL hal;
+	hal.microsStart = 0xffffffffUL - 60000000UL;
+	hal.rtcPpm = 0.0;
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	run(e, hal, 3 * HOUR_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = r.ok && r.rejected == 0 && r.errorSec > -0.001 && r.errorSec < 0.001;
+}
+
+static void missed(result_t &r) {
+	StallHAL hal;
+	hal.tempSwing = 0.0;
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	run(e, hal, 6 * HOUR_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = r.ok && r.rejected == 0 && e.getStats().missed == hal.missed && e.getRunMode() == RUN && 
+		r.errorSec > -0.005 && r.errorSec < 0.005;
+}
+
+static void resonator(result_t &r) {
+	StallHAL hal;
+	hal.tempSwing = 0.0;
+	hal.rtcPpm = -1e6 * RESONATOR_BIAS / (864000.0 + RESONATOR_BIAS);	// What RESONATOR_BIAS exactly corrects
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	e.setBias(RESONATOR_BIAS);
+	run(e, hal, 6 * HOUR_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = r.ok && r.rejected == 0 && e.getStats().missed == hal.missed && e.getRunMode() == RUN && 
+		r.errorSec > -0.005 && r.errorSec < 0.005;
+}
+
+static void noise(result_t &r) {
+	NoiseHAL hal;
+	hal.tempSwing = 0.0;
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	run(e, hal, 6 * HOUR_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = r.ok && r.rejected == hal.spurious && e.getStats().outliers == hal.spurious && e.getRunMode() == RUN && 
+		r.errorSec > -0.005 && r.errorSec < 0.005;
+}
+
+static void flaky(result_t &r) {
+	FlakyHAL hal;
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	run(e, hal, 7 * DAY_US, r, [](Escapement &e, VirtualTimeHAL &hal) {
+		return hal.getTime() < 2 * DAY_US + (TEMP_HOLD + 60) * 1000000ULL || 
+			hal.getTime() >= 2 * DAY_US + FLAKY_HOURS * HOUR_US || 
+			e.getTemp() == (float)ABS_ZERO;	// (getTemp() is a float)
+	});
+	const beatStats_t &st = e.getStats();
+	r.ok = r.ok && r.rejected == 0 && e.getRunMode() == RUN && e.isTempComp() && e.getTemp() != (float)ABS_ZERO && 
+		st.tempLost == 1 && st.tempRecovered == 1 && r.errorSec > -2.0 && r.errorSec < 2.0;
+}
+
+static void lag(result_t &r) {
+	VirtualTimeHAL hal;
+	hal.rodLag = LAG_SECONDS;
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	run(e, hal, 7 * DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = r.ok && r.rejected == 0 && e.getRunMode() == RUN && e.getTempLag() > LAG_SECONDS * 3 / 4 && 
+		e.getTempLag() < LAG_SECONDS * 5 / 4 && r.errorSec > -2.0 && r.errorSec < 2.0;
+}
+
+static void rate(result_t &r) {
+	VirtualTimeHAL hal;
+	hal.rodLag = LAG_SECONDS;
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	e.setTempLag(0);
+	run(e, hal, 7 * DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	double expected = -hal.period0 / 2 * 1e6 * hal.tempCoef * LAG_SECONDS / 3600;	// μs per degree C per hour
+	r.ok = r.ok && r.rejected == 0 && e.getRunMode() == RUN && e.getRateM() < expected * 3 / 4 && 
+		e.getRateM() > expected * 5 / 4 && r.errorSec > -2.0 && r.errorSec < 2.0;
+}
+
+static void curve(result_t &r) {
+	VirtualTimeHAL hal;
+	hal.tempMean = 22.0;
+	hal.tempSwing = 3.5;
+	hal.tempCurve = CURVE_COEF;
+	hal.reset();
+	Escapement e(&hal);
+	e.enable(COLDSTART);
+	run(e, hal, 7 * DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = r.ok && r.rejected == 0 && e.getRunMode() == RUN && e.getModelOrder() != MODEL_LINEAR && 
+		r.errorSec > -1.0 && r.errorSec < 1.0;
+}
+
+// Read the latest of the two copies of the persistent parameters in store into s
+static void readSettings(EscapementStore *store, settings_t &s) {
+	settings_t other;
+	store->read(0, &s, sizeof(s));
+	store->read(sizeof(s), &other, sizeof(other));
+	if (other.id == SETTINGS_TAG && (s.id != SETTINGS_TAG || (int16_t)(other.seq - s.seq) > 0)) s = other;
+}
+
+static void workshop(result_t &r) {
+	WorkshopHAL hal;
+	hal.reset();
+	Escapement heated(&hal);
+	heated.enable(COLDSTART);
+	run(heated, hal, WORKSHOP_HEATED * DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	boolean ok = r.ok && r.rejected == 0;
+	settings_t before, after;
+	readSettings(hal.store(), before);
+
+	Escapement e(&hal);						// Restart with the workshop's range
+	ok = ok && e.setTempRange(WORKSHOP_MIN, WORKSHOP_MAX, 1);
+	e.enable();
+	readSettings(hal.store(), after);
+	ok = ok && e.getTempMin() == WORKSHOP_MIN && e.getTempMax() == WORKSHOP_MAX && after.uspbBase == before.uspbBase;
+	int kept = 0;
+	for (int i = 0; i < after.tempSteps; i++) {
+		int old = (WORKSHOP_MIN + i - TEMP_MIN) * TEMP_RES;	// The default range's bucket at this one's temp
+		boolean shared = old >= 0 && old < TEMP_STEPS;
+		if (shared && before.sampleCount[old] > TGT_SAMPLES) kept++;
+		ok = ok && after.sampleCount[i] == (shared ? before.sampleCount[old] : 1) && 
+			after.uspbOffset[i] == (shared ? before.uspbOffset[old] : 0);
+	}
+
+	uint64_t inRun = 0;						// Beats in RUN (at any moment it may well be collecting)
+	run(e, hal, (WORKSHOP_HEATED + 7) * DAY_US, r, [&](Escapement &e, VirtualTimeHAL &) {
+		if (e.getRunMode() == RUN) inRun++;
+		return true;
+	});
+	readSettings(hal.store(), after);
+	int outside = 0;						// Buckets filled outside the default range
+	for (int i = 0; i < after.tempSteps; i++) {
+		int t = WORKSHOP_MIN + i;
+		if ((t < TEMP_MIN || t > TEMP_MIN + (TEMP_STEPS - 1) / TEMP_RES) && after.sampleCount[i] > TGT_SAMPLES) {
+			outside++;
+		}
+	}
+	r.ok = ok && kept > 0 && outside > 0 && r.rejected == 0 && inRun > r.beats / 4 && r.errorSec > -2.0 && 
+		r.errorSec < 2.0;
+}
+
+static void torn(result_t &r) {
+	VirtualTimeHAL hal;
+	hal.reset();
+	TornStore store;
+	Escapement first(&hal);
+	first.setStore(&store);
+	first.enable(COLDSTART);
+	run(first, hal, 2 * DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	uint32_t n = store.torn;				// Then keep going until a write is cut short, and restart right there
+	while (store.torn == n) first.beat();
+	boolean ok = r.ok && r.rejected == 0 && store.torn > 1 && first.getStats().storeFailures == store.torn;
+
+	Escapement e(&hal);						// Restart from whatever's there
+	e.setStore(&store);
+	e.enable();
+	settings_t s;
+	readSettings(&store, s);
+	ok = ok && e.getRunMode() == WARMSTART && s.id == SETTINGS_TAG;
+	for (int i = 0; i < TEMP_STEPS_MAX; i++) ok = ok && s.sampleCount[i] >= 1;
+	run(e, hal, 7 * DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = ok && r.ok && r.rejected == 0 && e.getRunMode() == RUN && r.errorSec > -2.0 && r.errorSec < 2.0;
+}
+
+// Whether a FusedSensor of SimSensors reading a and b (degrees C * 256), weighted wa and wb, reads want
+static boolean fuses(int16_t a, int16_t wa, int16_t b, int16_t wb, int16_t want) {
+	SimSensor sa, sb;
+	FusedSensor f;
+	f.add(&sa, wa);
+	f.add(&sb, wb);
+	sa.set(a);
+	sb.set(b);
+	return f.read() == want;
+}
+
+static void fused(result_t &r) {
+	boolean ok = fuses(1, 1, 2, 1, 2) && fuses(-1, 1, -2, 1, -2) && fuses(0, 1, 1, 2, 1) && 
+		fuses(0, 2, 1, -1, -1) && fuses(256, 3, 512, -1, 128) && fuses(256, -1, 512, -1, 384);
+	SimSensor sa, sb;						// Member b fails, goes stale and comes back
+	FusedSensor f;
+	f.add(&sa);
+	f.add(&sb);
+	sa.set(256);
+	sb.set(512);
+	ok = ok && f.read() == 384;
+	sb.set(NO_TEMP);
+	for (int i = 0; i < FUSED_MAX_MISSES; i++) ok = ok && f.read() == 384 && !f.isStale(1);
+	ok = ok && f.read() == NO_TEMP && f.isStale(1) && !f.isStale(0) && f.getFailures(1) == FUSED_MAX_MISSES + 1;
+	sb.set(768);
+	ok = ok && f.read() == 512 && !f.isStale(1);
+
+	VirtualTimeHAL hal;
+	hal.reset();
+	SimSensor top, bottom;
+	FusedSensor rod;
+	rod.add(&top, 2);
+	rod.add(&bottom, -1);
+	double maxErr = 0;						// Largest difference from the air temperature before the outage (C)
+	auto sense = [&]() {
+		double t = hal.temperature(hal.getTime() / 1e6);
+		boolean dead = hal.getTime() >= 2 * DAY_US && hal.getTime() < 2 * DAY_US + FUSED_HOURS * HOUR_US;
+		top.set((int16_t)lround((t + 1.0) * 256));
+		bottom.set(dead ? NO_TEMP : (int16_t)lround((t + 2.0) * 256));
+		return t;
+	};
+	sense();
+	Escapement e(&hal);
+	e.setTempSensor(&rod);
+	e.enable(COLDSTART);
+	run(e, hal, 7 * DAY_US, r, [&](Escapement &e, VirtualTimeHAL &hal) {
+		double t = sense();
+		if (hal.getTime() < 2 * DAY_US) {
+			if (fabs(e.getTemp() - t) > maxErr) maxErr = fabs(e.getTemp() - t);
+			return true;
+		}
+		return hal.getTime() < 2 * DAY_US + (TEMP_HOLD + 120) * 1000000ULL || 
+			hal.getTime() >= 2 * DAY_US + FUSED_HOURS * HOUR_US || e.getTemp() == (float)ABS_ZERO;
+	});
+	const beatStats_t &st = e.getStats();
+	r.ok = ok && r.ok && maxErr < 0.1 && r.rejected == 0 && e.getRunMode() == RUN && e.isTempComp() && 
+		st.tempLost == 1 && st.tempRecovered == 1 && r.errorSec > -2.0 && r.errorSec < 2.0;
+}
+
+// Call the setters that change persistent parameters, as a sketch might in setup() before enable()
+static void setters(Escapement &e) {
+	e.setBias(100);
+	e.incrBias(5);
+	e.setSpeedAdj(20);
+	e.incrSpeedAdj(-5);
+	e.setTempLag(1800);
+}
+
+static void setup(result_t &r) {
+	VirtualTimeHAL hal;
+	hal.reset();
+	Escapement first(&hal);
+	setters(first);
+	boolean ok = first.getStats().eepromWrites == 0 && first.getStats().storeFailures == 0;
+	first.enable(COLDSTART);
+	ok = ok && first.getBias() == 0 && first.getSpeedAdj() == 0 && first.getTempLag() == 1800;
+	run(first, hal, DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	ok = ok && r.ok && r.rejected == 0;
+	first.setBias(-4);						// Persisted, since it's after enable()
+	first.setSpeedAdj(2);
+
+	Escapement e(&hal);						// Restart, with the setters called again first
+	setters(e);
+	ok = ok && e.getStats().eepromWrites == 0;
+	e.enable();
+	ok = ok && e.getRunMode() == WARMSTART && e.getBias() == -4 && e.getSpeedAdj() == 2 && e.getTempLag() == 1800;
+	uint32_t writes = e.getStats().eepromWrites;
+	e.setTempLag(0);
+	ok = ok && e.getTempLag() == 0 && e.getStats().eepromWrites == writes;
+	run(e, hal, 2 * DAY_US, r, [](Escapement &, VirtualTimeHAL &) { return true; });
+	r.ok = ok && r.ok && r.rejected == 0 && r.errorSec > -2.0 && r.errorSec < 2.0;
+}
+
+int main(int argc, char *argv[]) {
+	struct { const char *name; void (*run)(result_t &); } scenarios[] = {
+		{"week", week}, {"sweep", sweep}, {"wrap", wrap}, {"missed", missed}, {"resonator", resonator},
+		{"noise", noise}, {"flaky", flaky},
+		{"lag", lag}, {"rate", rate}, {"curve", curve}, {"workshop", workshop}, {"torn", torn},
+		{"fused", fused}, {"setup", setup}
+	};
+	int failures = 0;
+	printf("scenario,beats,rejected,transitions,errorSec,hash,hostMs,result\n");
+	for (unsigned k = 0; k < sizeof(scenarios) / sizeof(scenarios[0]); k++) {
+		bool wanted = argc < 2;
+		for (int a = 1; a < argc; a++) {
+			if (strcmp(argv[a], scenarios[k].name) == 0) wanted = true;
+		}
+		if (!wanted) continue;
+		result_t r1, r2;
+		clock_t start = clock();
+		scenarios[k].run(r1);
+		double ms = (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+		scenarios[k].run(r2);
+		boolean ok = r1.ok && r1.hash == r2.hash && r1.beats == r2.beats;
+		printf("%s,%llu,%u,%u,%.3f,%08x,%.0f,%s\n", scenarios[k].name, (unsigned long long)r1.beats,
+			(unsigned)r1.rejected, (unsigned)r1.transitions, r1.errorSec, (unsigned)r1.hash, ms, ok ? "pass" : "FAIL");
+		if (!ok) failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
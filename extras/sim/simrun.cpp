@@ -0,0 +1,87 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   simrun.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Run an Escapement against a BendulumSim for a number of simulated days and report, once an hour, the run mode, 
+ *   temperature, modeled bpm and how far the time kept by the Escapement has drifted from true (simulated) time. 
+ *   At the end, the Escapement's hot-path counters (see getStats()) and a BeatAnalyzer's residual histogram and 
+ *   Allan deviations are summarized on standard error. 
+ *   If a recording file is named, the run is recorded to it for extras/replay, along with waveSamples coil readings 
+ *   around each pass if that's given.
+ *
+ *   Build (from this directory):
+ *     g++ -O2 -I../.. -I. simrun.cpp BendulumSim.cpp VirtualTimeHAL.cpp ../../Escapement.cpp \
+ *         ../../EscapementHAL.cpp ../../EscapementStore.cpp ../../EscapementRecorder.cpp \
+ *         ../../EscapementAnalyzer.cpp ../../EscapementSensor.cpp -o simrun
+ *
+ *   Usage: simrun [days [tempSwing [rtcPpm [recording [waveSamples]]]]]
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "BendulumSim.h"
+#include "EscapementAnalyzer.h"
+
+int main(int argc, char *argv[]) {
+	double days = argc > 1 ? atof(argv[1]) : 7.0;
+	BendulumSim sim;
+	if (argc > 2) sim.tempSwing = atof(argv[2]);
+	if (argc > 3) sim.rtcPpm = atof(argv[3]);
+	sim.reset();
+	Escapement e(&sim);
+	FILE *rec = argc > 4 ? fopen(argv[4], "w") : NULL;
+	FileRecorder recorder(rec);
+	BeatAnalyzer analyzer(JITTER_BIN_US, rec != NULL ? &recorder : NULL);
+	e.setRecorder(&analyzer);
+	unsigned int waveSamples = argc > 5 ? atoi(argv[5]) : 0;
+	uint16_t *wave = new uint16_t[waveSamples + 1];
+	if (waveSamples > 0) e.setWaveCapture(wave, waveSamples);
+	e.enable(COLDSTART);
+
+	uint64_t end = (uint64_t)(days * 86400e6);
+	uint64_t nextReport = 0;
+	uint64_t beats = 0;
+	double kept = 0.0;						// Time kept by the Escapement (s)
+	double startTime = -1.0;				// Simulated time at the first beat (s)
+	printf("hour,mode,temp,bpmModel,bpmRTC,errorSec\n");
+	while (sim.getTime() < end) {
+		long dT = e.beat();
+		beats++;
+		if (startTime < 0.0) {				// The first beat just starts the clock
+			startTime = sim.getTime() / 1e6;
+			continue;
+		}
+		kept += dT / 1e6;
+		if (sim.getTime() >= nextReport) {
+			printf("%.0f,%d,%.3f,%.5f,%.5f,%.3f\n", sim.getTime() / 3600e6, e.getRunMode(), e.getTemp(), 
+				e.getBpmModel(), e.getBpmRTC(), kept - (sim.getTime() / 1e6 - startTime));
+			nextReport += 3600000000ULL;
+		}
+	}
+	fprintf(stderr, "%llu beats, final error %.3f s\n", (unsigned long long)beats, kept - (sim.getTime() / 1e6 - startTime));
+	const beatStats_t &st = e.getStats();
+	fprintf(stderr, "%.1f ADC reads/beat (max %u), noise wait %.1f ms/beat (max %.1f), peak search %.1f ms/beat "
+		"(max %.1f), %u rejected, %lu missed, %u outliers, %u EEPROM writes (%lu bytes, %u store failures), %lu temperature readings, %u I2C failures (temperature lost %u times, recovered %u), %u mode changes, thermal lag %u s, rate term %.2f us per C/h, model order %u\n",
+		(double)st.adcReads / st.beats, st.adcReadsMax, (double)st.noiseWaitMs / st.beats, st.noiseWaitMax / 1e3,
+		(double)st.peakMs / st.beats, st.peakMax / 1e3, st.rejected, (unsigned long)st.missed, st.outliers, st.eepromWrites, (unsigned long)st.eepromBytes, st.storeFailures,
+		(unsigned long)st.tempReads, st.i2cFailures, st.tempLost, st.tempRecovered, st.transitions, e.getTempLag(), 
+		e.getRateM(), e.getModelOrder());
+	fprintf(stderr, "residuals: %lu, mean %.1f us, rms %.1f us; histogram (%u us bins from %d us):", 
+		(unsigned long)analyzer.getResidualCount(), analyzer.getResidualMean(), analyzer.getResidualRms(), 
+		analyzer.getBinWidth(), -(JITTER_BINS / 2) * analyzer.getBinWidth());
+	for (byte i = 0; i < JITTER_BINS; i++) {
+		fprintf(stderr, " %lu", (unsigned long)analyzer.getBin(i));
+	}
+	fprintf(stderr, "\nAllan deviation:");
+	for (byte i = 0; i < ADEV_TAUS; i++) {
+		fprintf(stderr, " %.1f s %.2f ppm;", analyzer.getTau(i), analyzer.getAdev(i));
+	}
+	fprintf(stderr, "\n");
+	if (rec != NULL) fclose(rec);
+	return 0;
+}
@@ -0,0 +1,163 @@
+/****
+ *
+ *   Part of the "Escapement" library for Arduino. Version 0.88
+ *
+ *   decode.cpp Copyright 2014-2016 by D. L. Ehnebuske 
+ *   License terms: Creative Commons Attribution-ShareAlike 3.0 United States (CC BY-SA 3.0 US) 
+ *                  See http://creativecommons.org/licenses/by-sa/3.0/us/ for specifics. 
+ *
+ *   Decode a TelemetryRecorder's binary stream (see EscapementTelemetry.h), as captured from the serial port, into 
+ *   the text recording a FileRecorder would have written: CSV with a header line, which extras/replay can replay.
+ *
+ *   Bytes that aren't part of a frame with a good checksum (the sketch's own output, line noise, a capture started 
+ *   part way through a frame) are skipped. After that, records are skipped until the next key frame, since the 
+ *   beats in between are relative to one that was lost. A summary (frames decoded, bytes skipped, beats lost 
+ *   waiting for a key frame and the average bytes per beat) goes to standard error.
+ *
+ *   Build (from this directory):
+ *     g++ -O2 -I../.. decode.cpp ../../EscapementRecorder.cpp -o decode
+ *
+ *   Usage: decode [capture]     (default: standard input)
+ *
+ ****/
+
+#include <stdio.h>
+#include "EscapementTelemetry.h"
+
+// Reads varints from a frame's payload
+class Reader {
+private:
+	const byte *p;
+	const byte *end;
+public:
+	bool ok;								// False once a read ran off the end
+	Reader(const byte *buf, unsigned int len) {
+		p = buf;
+		end = buf + len;
+		ok = true;
+	}
+	uint32_t varint() {
+		uint32_t v = 0;
+		for (byte shift = 0; shift < 35; shift += 7) {
+			if (p == end) break;
+			byte b = *p++;
+			v |= (uint32_t)(b & 0x7f) << shift;
+			if ((b & 0x80) == 0) return v;
+		}
+		ok = false;
+		return 0;
+	}
+	int32_t signedVarint() {
+		uint32_t v = varint();
+		return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+	}
+	uint32_t fixed32() {
+		uint32_t v = 0;
+		for (byte i = 0; i < 4; i++) {
+			if (p == end) {
+				ok = false;
+				return 0;
+			}
+			v |= (uint32_t)*p++ << (8 * i);
+		}
+		return v;
+	}
+	bool done() {
+		return ok && p == end;
+	}
+};
+
+int main(int argc, char *argv[]) {
+	FILE *in = stdin;
+	if (argc > 2 || (argc == 2 && (in = fopen(argv[1], "rb")) == NULL)) {
+		fprintf(stderr, "Usage: %s [capture]\n", argv[0]);
+		return 2;
+	}
+	FileRecorder rec(stdout);
+	byte frame[256];
+	unsigned long frames = 0, skipped = 0, lost = 0, beats = 0, beatBytes = 0;
+	bool synced = false;					// Whether the beat state below is good
+	uint32_t lastTime = 0;
+	int16_t lastTemp = 0;
+	int32_t lastFill = 0;
+	printf("type,time,temp,mode,value,aux,model\n");
+	int c = fgetc(in);
+	while (c != EOF) {
+		if (c != TLM_SYNC) {
+			skipped++;
+			c = fgetc(in);
+			continue;
+		}
+		// Read length, payload and checksum; on a bad frame, resume looking just after this TLM_SYNC
+		long resume = ftell(in);
+		int len = fgetc(in);
+		bool good = len > 0;
+		byte sum = (byte)len;
+		for (int i = 0; good && i < len; i++) {
+			int b = fgetc(in);
+			if (b == EOF) good = false;
+			frame[i] = (byte)b;
+			sum += (byte)b;
+		}
+		if (good && fgetc(in) != sum) good = false;
+		if (!good) {
+			skipped++;
+			if (resume < 0 || fseek(in, resume, SEEK_SET) != 0) break;
+			synced = false;
+			c = fgetc(in);
+			continue;
+		}
+		frames++;
+		byte type = frame[0] >> 5;
+		Reader rd(frame + 1, len - 1);
+		beatRecord_t r;
+		r.type = type;
+		r.mode = (frame[0] >> 2) & 0x07;
+		if (type == TLM_SETTINGS) {
+			rec.recordSettings(frame + 1, len - 1);
+		} else if (type == REC_BEAT) {
+			if (frame[0] & TLM_KEY) {
+				r.time = rd.fixed32();
+				r.value = rd.signedVarint();
+				r.temp = (int16_t)rd.signedVarint();
+				r.aux = (int32_t)rd.varint();
+			} else {
+				uint32_t dt = rd.varint();
+				r.time = lastTime + dt;
+				r.value = rd.signedVarint() + (int32_t)dt;
+				r.temp = lastTemp;
+				r.aux = lastFill;
+				if (frame[0] & TLM_CHANGED) {
+					r.temp = (int16_t)(lastTemp + rd.signedVarint());
+					r.aux = lastFill + rd.signedVarint();
+				}
+			}
+			uint32_t m = rd.varint();
+			r.model = m == 0 ? 0 : r.value + ((int32_t)((m - 1) >> 1) ^ -(int32_t)((m - 1) & 1));
+			if (!rd.done()) {
+				synced = false;
+			} else if ((frame[0] & TLM_KEY) || synced) {
+				synced = true;
+				lastTime = r.time;
+				lastTemp = r.temp;
+				lastFill = r.aux;
+				beats++;
+				beatBytes += len + 3;
+				rec.record(r);
+			} else {
+				lost++;
+			}
+		} else if (type <= REC_MODEL) {
+			r.time = lastTime + (uint32_t)rd.signedVarint();
+			r.value = rd.signedVarint();
+			r.aux = rd.signedVarint();
+			r.temp = (int16_t)rd.signedVarint();
+			r.model = 0;
+			if (rd.done() && (synced || type == REC_ENABLE)) rec.record(r);
+		}
+		c = fgetc(in);
+	}
+	fprintf(stderr, "%lu frames, %lu bytes skipped, %lu beats lost, %.1f bytes/beat\n", frames, skipped, lost,
+		beats == 0 ? 0.0 : (double)beatBytes / beats);
+	return 0;
+}